@@ -0,0 +1,224 @@
+#ifndef AUTOTUNE_HH
+#define AUTOTUNE_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
+
+// one point of the tuning grid
+struct tune_config
+{
+    size_t bits_per_key;
+    size_t slots_per_bucket;
+    // the lowest and highest load factors asked for in TUNE_LOADS that round
+    // to this power-of-two bucket count, and the load it gives the full set R
+    double target_load, max_target_load, load;
+    size_t seed_bits;
+};
+
+/**
+ * tune_estimate predicts the filter a full build with one configuration
+ * ships, from a build on a sample:
+ *
+ *   tag_bytes        the packed tags of every bucket
+ *   seed_bytes       the bucket seeds entropy-coded, i.e. the empirical
+ *                    entropy of the sample's seeds per bucket
+ *   exclusion_bytes  the keys of S spilled at the seed cap (see
+ *                    cuckoo_hashtable::set_max_seed)
+ *   build_seconds    inserting R and eliminating false positives, scaled
+ *                    linearly from the sample
+ *
+ * A configuration is not feasible, and has no estimate, when its sample
+ * table fills before R is inserted, or when its seed search would compare
+ * more than TUNE_MAX_PROBES fingerprints: short tags in wide buckets see so
+ * many keys of S that no seed clears a bucket, and every bucket is searched
+ * up to the cap.
+ */
+struct tune_estimate
+{
+    tune_config config;
+    bool feasible;
+    double tag_bytes, seed_bytes, exclusion_bytes;
+    double build_seconds;
+    // whether CuckooFilter can hold the tags, which needs 4 slots per bucket
+    bool shippable;
+
+    double total_bytes() const { return tag_bytes + seed_bytes + exclusion_bytes; }
+};
+
+// the seed_bits tried per table configuration, from a 3-seed cap to none
+const size_t TUNE_SEED_BITS[] = {2, 4, 8, 16};
+const double TUNE_LOADS[] = {0.80, 0.90, 0.95};
+const double TUNE_MAX_PROBES = 1e10;
+
+// empirical entropy of the seeds in bits per seed
+inline double seed_entropy(const std::vector<uint16_t> &seeds)
+{
+    std::map<uint16_t, size_t> counts;
+    for (const uint16_t s : seeds)
+        counts[s]++;
+    double bits = 0;
+    for (const auto &c : counts)
+    {
+        const double p = double(c.second) / seeds.size();
+        bits -= p * std::log2(p);
+    }
+    return bits;
+}
+
+/**
+ * tune_table estimates every load and seed width of one table shape. The
+ * sample keeps the full build's load and ratio of S to R per bucket: its
+ * table has at most 2^sample_hp buckets, and takes the matching prefixes of
+ * r and s, so both must be in random order.
+ */
+template <typename KeyType, std::size_t bits_per_key, std::size_t slots, typename Hash, typename IndexPolicy>
+void tune_table(const KeyType *r, const size_t nr, const KeyType *s, const size_t ns, const size_t full_nr,
+                const size_t full_ns, const size_t sample_hp, std::vector<tune_estimate> &out)
+{
+    typedef cuckoohashtable::cuckoo_hashtable<KeyType, bits_per_key, Hash, std::equal_to<KeyType>,
+                                              std::allocator<KeyType>, slots, cuckoohashtable::identity_key_source,
+                                              IndexPolicy>
+        Table;
+    using clock = std::chrono::steady_clock;
+
+    size_t last_hp = std::numeric_limits<size_t>::max();
+    for (const double target : TUNE_LOADS)
+    {
+        size_t hp = 0;
+        while ((double(uint64_t(1) << hp) * slots) * target < full_nr)
+            hp++;
+        // a coarser load rounds to the same bucket count as a finer one, and
+        // only widens the targets the estimates of that count stand for
+        if (hp == last_hp)
+        {
+            for (auto e = out.end() - sizeof(TUNE_SEED_BITS) / sizeof(TUNE_SEED_BITS[0]); e != out.end(); ++e)
+                e->config.max_target_load = target;
+            continue;
+        }
+        last_hp = hp;
+
+        // the sample shrinks until both prefixes are long enough
+        size_t shp = std::min(hp, sample_hp);
+        while (shp > 0 && (full_nr >> (hp - shp) > nr || full_ns >> (hp - shp) > ns))
+            shp--;
+        const double scale = double(uint64_t(1) << (hp - shp));
+        const size_t m = full_nr >> (hp - shp), ms = full_ns >> (hp - shp);
+
+        tune_config config;
+        config.bits_per_key = bits_per_key;
+        config.slots_per_bucket = slots;
+        config.target_load = target;
+        config.max_target_load = target;
+        config.load = double(full_nr) / (double(uint64_t(1) << hp) * slots);
+
+        // keys of S per bucket, and the fingerprints each seed of a bucket
+        // expects to match; a seed clears it with probability exp(-matches)
+        const double per_bucket = 2.0 * ms / double(uint64_t(1) << shp);
+        const double matches = per_bucket * slots / double(uint64_t(1) << bits_per_key);
+
+        // the table holds an atomic and cannot be copied, so each seed width
+        // inserts the sample again; a table that fills does so for all of them
+        bool feasible = true;
+        for (const size_t seed_bits : TUNE_SEED_BITS)
+        {
+            tune_estimate e = tune_estimate();
+            e.config = config;
+            e.config.seed_bits = seed_bits;
+            e.shippable = slots == 4;
+            const double seeds = std::min(std::exp(matches), double(uint64_t(1) << seed_bits));
+            const double probes = double(uint64_t(1) << shp) * seeds * per_bucket * slots;
+            if (feasible && probes <= TUNE_MAX_PROBES)
+            {
+                const clock::time_point start = clock::now();
+                std::unique_ptr<Table> table(new Table((size_t(1) << shp) * slots));
+                table->set_max_seed(uint16_t((uint32_t(1) << seed_bits) - 1));
+                try
+                {
+                    for (size_t i = 0; i < m; ++i)
+                        table->insert(r[i]);
+                }
+                catch (const std::out_of_range &)
+                {
+                    feasible = false;
+                }
+                if (feasible)
+                {
+                    table->eliminate_false_positives(s, ms, 1);
+                    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+                    const double buckets = double(uint64_t(1) << hp);
+                    e.tag_bytes = buckets * ((bits_per_key * slots + 7) / 8);
+                    e.seed_bytes = buckets * seed_entropy(table->get_seeds()) / 8;
+                    e.exclusion_bytes = table->spilled().size() * scale * sizeof(KeyType);
+                    e.build_seconds = seconds * scale;
+                }
+            }
+            e.feasible = feasible && probes <= TUNE_MAX_PROBES;
+            out.push_back(e);
+        }
+    }
+}
+
+/**
+ * autotune predicts the shipped size and build time of a build of full_nr
+ * keys of R against full_ns keys of S, for 8, 12 and 16-bit tags, 2, 4 and
+ * 8 slots per bucket, the loads in TUNE_LOADS and the seed widths in
+ * TUNE_SEED_BITS, from builds on samples of r and s (see tune_table).
+ * Builds run on one thread, so build times compare configurations rather
+ * than predict a threaded build.
+ *
+ * @return an estimate per configuration, infeasible ones included
+ */
+template <typename KeyType, typename Hash, typename IndexPolicy = cuckoohashtable::raw_index_policy>
+std::vector<tune_estimate> autotune(const KeyType *r, const size_t nr, const KeyType *s, const size_t ns,
+                                    const size_t full_nr, const size_t full_ns, const size_t sample_hp = 12)
+{
+    std::vector<tune_estimate> out;
+    tune_table<KeyType, 8, 2, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 8, 4, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 8, 8, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 12, 2, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 12, 4, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 12, 8, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 16, 2, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 16, 4, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    tune_table<KeyType, 16, 8, Hash, IndexPolicy>(r, nr, s, ns, full_nr, full_ns, sample_hp, out);
+    return out;
+}
+
+// the feasible estimates with the given shippable flag that no other such
+// estimate beats in both total bytes and build time, smallest first. A
+// front over all estimates would let configurations CuckooFilter cannot
+// hold crowd out the ones it can.
+inline std::vector<tune_estimate> pareto_front(const std::vector<tune_estimate> &estimates, const bool shippable)
+{
+    std::vector<tune_estimate> sorted;
+    for (const tune_estimate &e : estimates)
+    {
+        if (e.feasible && e.shippable == shippable)
+            sorted.push_back(e);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const tune_estimate &a, const tune_estimate &b) {
+        return a.total_bytes() < b.total_bytes() ||
+               (a.total_bytes() == b.total_bytes() && a.build_seconds < b.build_seconds);
+    });
+    std::vector<tune_estimate> front;
+    for (const tune_estimate &e : sorted)
+    {
+        if (front.empty() || e.build_seconds < front.back().build_seconds)
+            front.push_back(e);
+    }
+    return front;
+}
+
+#endif // AUTOTUNE_HH
@@ -0,0 +1,400 @@
+#ifndef BUILD_PIPELINE_HH
+#define BUILD_PIPELINE_HH
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cuckoofilter/src/cuckoofilter.h"
+
+/**
+ * task_pool runs tasks on a fixed set of worker threads. Each worker has its
+ * own queue: it runs its newest task first, and when its queue is empty it
+ * steals the oldest task of another worker, so a stage split into many chunks
+ * spreads over idle workers without a central queue.
+ *
+ * Tasks are submitted to a task_group, and wait() returns when all of the
+ * group's tasks have run. The waiting thread runs queued tasks meanwhile, and
+ * sleeps when there are none.
+ */
+class task_pool
+{
+public:
+    class task_group
+    {
+    public:
+        task_group() : pending_(0) {}
+
+    private:
+        friend class task_pool;
+        std::atomic<size_t> pending_;
+        std::mutex error_mutex_;
+        // the first exception thrown by a task of the group
+        std::exception_ptr error_;
+    };
+
+    explicit task_pool(size_t num_threads) : stop_(false), queued_(0), next_queue_(0)
+    {
+        num_threads = std::max<size_t>(1, num_threads);
+        for (size_t i = 0; i < num_threads; ++i)
+            queues_.emplace_back(new task_queue);
+        for (size_t i = 0; i < num_threads; ++i)
+            workers_.emplace_back(&task_pool::work, this, i);
+    }
+
+    task_pool(const task_pool &) = delete;
+    task_pool &operator=(const task_pool &) = delete;
+
+    ~task_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            stop_ = true;
+        }
+        idle_cv_.notify_all();
+        for (auto &w : workers_)
+            w.join();
+    }
+
+    size_t num_threads() const { return workers_.size(); }
+
+    // queues fn on the calling worker's queue, or round-robin from other threads
+    void submit(task_group &group, std::function<void()> fn)
+    {
+        ++group.pending_;
+        const worker_id &self = current_worker();
+        const size_t q = self.pool == this ? self.index : next_queue_++ % queues_.size();
+        {
+            std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+            queues_[q]->tasks.push_back(task{std::move(fn), &group});
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            ++queued_;
+        }
+        idle_cv_.notify_one();
+    }
+
+    // runs queued tasks until every task of group has run, then rethrows the
+    // first exception one of them threw
+    void wait(task_group &group)
+    {
+        while (group.pending_ > 0)
+        {
+            if (try_run())
+                continue;
+            std::unique_lock<std::mutex> lock(idle_mutex_);
+            idle_cv_.wait(lock, [this, &group] { return queued_ > 0 || group.pending_ == 0; });
+        }
+        if (group.error_)
+        {
+            std::exception_ptr error;
+            std::swap(error, group.error_);
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct task
+    {
+        std::function<void()> fn;
+        task_group *group;
+    };
+
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    struct worker_id
+    {
+        const task_pool *pool;
+        size_t index;
+    };
+
+    static worker_id &current_worker()
+    {
+        static thread_local worker_id id{nullptr, 0};
+        return id;
+    }
+
+    // pops the newest task of queue q, or steals the oldest
+    bool take(const size_t q, const bool steal, task &out)
+    {
+        std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+        std::deque<task> &tasks = queues_[q]->tasks;
+        if (tasks.empty())
+            return false;
+        if (steal)
+        {
+            out = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        else
+        {
+            out = std::move(tasks.back());
+            tasks.pop_back();
+        }
+        return true;
+    }
+
+    // runs one task, from the calling worker's queue if it has one
+    bool try_run()
+    {
+        const worker_id &self = current_worker();
+        const bool own = self.pool == this;
+        const size_t first = own ? self.index : 0;
+        task t;
+        bool found = own && take(first, false, t);
+        for (size_t k = own ? 1 : 0; !found && k < queues_.size(); ++k)
+            found = take((first + k) % queues_.size(), true, t);
+        if (!found)
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            --queued_;
+        }
+        try
+        {
+            t.fn();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(t.group->error_mutex_);
+            if (!t.group->error_)
+                t.group->error_ = std::current_exception();
+        }
+        if (--t.group->pending_ == 0)
+        {
+            // wake the threads waiting on the group
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            idle_cv_.notify_all();
+        }
+        return true;
+    }
+
+    void work(const size_t index)
+    {
+        current_worker() = worker_id{this, index};
+        while (true)
+        {
+            if (try_run())
+                continue;
+            std::unique_lock<std::mutex> lock(idle_mutex_);
+            idle_cv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+            if (stop_ && queued_ == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<task_queue>> queues_;
+    std::vector<std::thread> workers_;
+    // idle workers sleep until a task is queued or the pool stops
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    bool stop_;
+    size_t queued_;
+    std::atomic<size_t> next_queue_;
+};
+
+// wall and CPU seconds of one pipeline stage. start is the offset of its
+// first task from the start of the pipeline.
+struct stage_time
+{
+    std::string name;
+    double start;
+    double wall;
+    double cpu;
+};
+
+/**
+ * stage_clock accumulates a stage's time over the tasks it runs: wall time
+ * from the start of its first task to the end of its last, CPU time summed
+ * over the threads that ran them.
+ */
+class stage_clock
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    stage_clock(const std::string &name, clock::time_point origin)
+        : name_(name), origin_(origin), first_(clock::time_point::max()), last_(clock::time_point::min()), cpu_ns_(0) {}
+
+    // runs fn as part of the stage, charging it the calling thread's CPU time
+    template <typename F>
+    void run(F fn)
+    {
+        timed(fn, CLOCK_THREAD_CPUTIME_ID);
+    }
+
+    // runs fn while nothing else runs, charging it the whole process's CPU
+    // time, which includes threads fn starts itself
+    template <typename F>
+    void run_exclusive(F fn)
+    {
+        timed(fn, CLOCK_PROCESS_CPUTIME_ID);
+    }
+
+    stage_time time() const
+    {
+        const double start = std::chrono::duration<double>(first_ - origin_).count();
+        const double wall = std::chrono::duration<double>(last_ - first_).count();
+        return stage_time{name_, start, wall, cpu_ns_ * 1e-9};
+    }
+
+private:
+    static int64_t cpu_now(const clockid_t id)
+    {
+        timespec ts;
+        clock_gettime(id, &ts);
+        return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    template <typename F>
+    void timed(F &fn, const clockid_t id)
+    {
+        const clock::time_point begin = clock::now();
+        const int64_t cpu_begin = cpu_now(id);
+        fn();
+        const int64_t cpu = cpu_now(id) - cpu_begin;
+        const clock::time_point end = clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        first_ = std::min(first_, begin);
+        last_ = std::max(last_, end);
+        cpu_ns_ += cpu;
+    }
+
+    std::string name_;
+    clock::time_point origin_;
+    std::mutex mutex_;
+    clock::time_point first_, last_;
+    int64_t cpu_ns_;
+};
+
+// results of run_build_pipeline
+struct pipeline_report
+{
+    std::vector<stage_time> stages;
+    double wall, cpu;
+    size_t false_negatives, false_positives;
+    size_t serialized_bytes;
+};
+
+/**
+ * run_build_pipeline builds an empty table and its filter from generated keys,
+ * as the sequential build does, but as overlapping stages on a task pool:
+ *
+ *   generate R    gen_r(chunk, out, n) per chunk of R
+ *   generate S    gen_s(chunk, out, n) per chunk of S, alongside R's stages
+ *   insert R      table.bulk_build(R), once all of R is generated
+ *   eliminate FPs table.eliminate_false_positives on the pool's threads, once R
+ *                 is inserted and S generated
+ *   serialize     the Filter view over the table's packed partials written to
+ *                 out, alongside
+ *   verify        Contain over chunks of R and S
+ *
+ * The view replaces the export and copy of the table into a filter: once the
+ * seeds are final, the filter already exists. Generators are called with
+ * chunks of chunk_size keys from several threads, so each chunk must not
+ * depend on the others.
+ *
+ * Filter is a CuckooFilter over the table's hash, index policy and
+ * bits_per_key, and Table a table storing the keys themselves.
+ */
+template <typename Filter, typename Table, typename KeyType, typename GenR, typename GenS>
+pipeline_report run_build_pipeline(task_pool &pool, Table &table, std::vector<KeyType> &r, const size_t nr,
+                                   std::vector<KeyType> &s, const size_t ns, GenR gen_r, GenS gen_s,
+                                   std::ostream &out, const size_t chunk_size = size_t(1) << 16)
+{
+    using clock = std::chrono::steady_clock;
+    const clock::time_point origin = clock::now();
+    timespec cpu_origin;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_origin);
+
+    stage_clock generate_r("generate R", origin), generate_s("generate S", origin), insert_r("insert R", origin),
+        eliminate("eliminate FPs", origin), serialize("serialize", origin), verify("verify", origin);
+
+    // submits fn(begin, end) for each chunk of [0, n) as part of stage
+    auto submit_chunks = [&](task_pool::task_group &group, stage_clock &stage, const size_t n,
+                             std::function<void(size_t, size_t)> fn) {
+        for (size_t begin = 0; begin < n; begin += chunk_size)
+        {
+            const size_t end = std::min(n, begin + chunk_size);
+            pool.submit(group, [&stage, fn, begin, end] { stage.run([&] { fn(begin, end); }); });
+        }
+    };
+
+    r.resize(nr);
+    s.resize(ns);
+    task_pool::task_group r_ready, s_ready;
+    submit_chunks(r_ready, generate_r, nr, [&](size_t begin, size_t end) {
+        gen_r(begin / chunk_size, &r[begin], end - begin);
+    });
+    submit_chunks(s_ready, generate_s, ns, [&](size_t begin, size_t end) {
+        gen_s(begin / chunk_size, &s[begin], end - begin);
+    });
+
+    // R's chunks were queued first, so they finish while most of S remains
+    pool.wait(r_ready);
+    task_pool::task_group inserted;
+    pool.submit(inserted, [&] { insert_r.run([&] { table.bulk_build(r.data(), nr); }); });
+    pool.wait(inserted);
+    pool.wait(s_ready);
+
+    // the pool is idle here, and eliminate_false_positives runs its own threads
+    eliminate.run_exclusive([&] { table.eliminate_false_positives(s.data(), ns, pool.num_threads()); });
+
+    Filter filter(table.packed_partials(), table.get_seeds(), table.size());
+    filter.Exclude(table.spilled().data(), table.spilled().size());
+    pipeline_report report;
+    std::atomic<size_t> false_negatives(0), false_positives(0);
+    task_pool::task_group tail;
+    pool.submit(tail, [&] {
+        serialize.run([&] {
+            const std::streampos begin = out.tellp();
+            if (filter.Serialize(out) != cuckoofilter::Ok)
+                throw std::runtime_error("cannot serialize the filter");
+            report.serialized_bytes = out.tellp() - begin;
+        });
+    });
+    submit_chunks(tail, verify, nr, [&](size_t begin, size_t end) {
+        size_t missing = 0;
+        for (size_t i = begin; i < end; ++i)
+            missing += filter.Contain(r[i]) != cuckoofilter::Ok;
+        false_negatives += missing;
+    });
+    submit_chunks(tail, verify, ns, [&](size_t begin, size_t end) {
+        size_t found = 0;
+        for (size_t i = begin; i < end; ++i)
+            found += filter.Contain(s[i]) == cuckoofilter::Ok;
+        false_positives += found;
+    });
+    pool.wait(tail);
+
+    timespec cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    report.wall = std::chrono::duration<double>(clock::now() - origin).count();
+    report.cpu = (cpu_end.tv_sec - cpu_origin.tv_sec) + (cpu_end.tv_nsec - cpu_origin.tv_nsec) * 1e-9;
+    for (const stage_clock *stage : {&generate_r, &generate_s, &insert_r, &eliminate, &serialize, &verify})
+        report.stages.push_back(stage->time());
+    report.false_negatives = false_negatives;
+    report.false_positives = false_positives;
+    return report;
+}
+
+#endif // BUILD_PIPELINE_HH
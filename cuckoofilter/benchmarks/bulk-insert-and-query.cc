@@ -7,6 +7,20 @@
 // filters with varying rates of expected success. For instance, at 75%, three out of
 // every four values passed to Contain() were earlier Add()ed.
 //
+// An optional second argument (scalar, sse4.2, avx2 or avx512) caps the SIMD kernels
+// used, see simddispatch.h; by default the best the CPU supports is used.
+//
+// The BinaryFuse rows are static filters, built once from all of the items, so their
+// "adds/sec" is the build rate. So is that of the Cuckoo and SemiSort rows, whose items
+// are placed by a cuckoo_hashtable and copied in with CopyInsert (see their FilterAPI).
+// Every row must find all of its items in the 100% column.
+//
+// Where perf_event_open is allowed (see timing.h), eight more columns give the
+// instructions, last-level cache misses, dTLB misses and branch mispredictions per add
+// and per find, the latter over all of the Find columns. A "-" marks an event the CPU
+// does not count; without counters at all the columns are left out. Counting user-space
+// events needs perf_event_paranoid at 2 or below.
+//
 // Example output:
 //
 // $ for num in 55 75 85; do echo $num:; /usr/bin/time -f 'time: %e seconds' ./bulk-insert-and-query.exe ${num}00000; echo; done
@@ -47,17 +61,25 @@
 // time: 19.43 seconds
 //
 
+#include <cerrno>
 #include <climits>
+#include <cstring>
 #include <iomanip>
 #include <map>
 #include <stdexcept>
 #include <vector>
 
+#include "binaryfusefilter.h"
 #include "cuckoofilter.h"
 #include "random.h"
+#include "simd-block-512.h"
 #include "simd-block.h"
+#include "simddispatch.h"
 #include "timing.h"
 
+#include "cuckoohashtable/city_hasher.hh"
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
+
 using namespace std;
 
 using namespace cuckoofilter;
@@ -72,14 +94,16 @@ struct Statistics {
                                    // to be positive
   double false_positive_probabilty;
   double bits_per_item;
+  // Hardware events per Add() and per Contain(), if counted
+  PerfCounts add_counts, find_counts;
 };
 
 // Output for the first row of the table of results. type_width is the maximum number of
 // characters of the description of any table type, and find_percent_count is the number
 // of different lookup statistics gathered for each table. This function assumes the
 // lookup expected positive probabiilties are evenly distributed, with the first being 0%
-// and the last 100%.
-string StatisticsTableHeader(int type_width, int find_percent_count) {
+// and the last 100%. counters adds the columns of the per-operation hardware events.
+string StatisticsTableHeader(int type_width, int find_percent_count, bool counters) {
   ostringstream os;
 
   os << string(type_width, ' ');
@@ -88,7 +112,13 @@ string StatisticsTableHeader(int type_width, int find_percent_count) {
     os << setw(8) << "Find";
   }
   os << setw(8) << "" << setw(11) << "" << setw(11)
-     << "optimal" << setw(8) << "wasted" << endl;
+     << "optimal" << setw(8) << "wasted";
+  if (counters) {
+    for (const char* op : {"add", "find"}) {
+      for (int i = 0; i < kNumPerfEvents; ++i) os << setw(8) << op;
+    }
+  }
+  os << endl;
 
   os << string(type_width, ' ');
   os << setw(12) << right << "adds/sec";
@@ -98,6 +128,12 @@ string StatisticsTableHeader(int type_width, int find_percent_count) {
   }
   os << setw(9) << "ε" << setw(11) << "bits/item" << setw(11)
      << "bits/item" << setw(8) << "space";
+  if (counters) {
+    for (int i = 0; i < 2; ++i) {
+      os << setw(8) << "instr" << setw(8) << "LLC" << setw(8) << "dTLB" << setw(8)
+         << "brmiss";
+    }
+  }
   return os.str();
 }
 
@@ -115,6 +151,17 @@ basic_ostream<CharT, Traits>& operator<<(
   os << setw(7) << setprecision(3) << stats.false_positive_probabilty * 100 << '%'
      << setw(11) << setprecision(2) << stats.bits_per_item << setw(11) << minbits
      << setw(7) << setprecision(1) << 100 * (stats.bits_per_item / minbits - 1) << '%';
+  if (stats.add_counts.Any() || stats.find_counts.Any()) {
+    for (const PerfCounts* counts : {&stats.add_counts, &stats.find_counts}) {
+      for (int i = 0; i < kNumPerfEvents; ++i) {
+        if (counts->count[i] < 0) {
+          os << setw(8) << "-";
+        } else {
+          os << setw(8) << setprecision(i == kInstructions ? 1 : 3) << counts->count[i];
+        }
+      }
+    }
+  }
 
   return os;
 }
@@ -122,13 +169,62 @@ basic_ostream<CharT, Traits>& operator<<(
 template<typename Table>
 struct FilterAPI {};
 
-template <typename ItemType, size_t bits_per_item, template <size_t> class TableType>
-struct FilterAPI<CuckooFilter<ItemType, bits_per_item, TableType>> {
-  using Table = CuckooFilter<ItemType, bits_per_item, TableType>;
+// Adds and looks up one key at a time through API::Add and API::Contain.
+template <typename API>
+struct OneAtATime {
+  template <typename Table>
+  static void AddAll(const uint64_t* keys, size_t n, Table* table) {
+    for (size_t i = 0; i < n; ++i) {
+      API::Add(keys[i], table);
+    }
+  }
+  template <typename Table>
+  static size_t ContainCount(const uint64_t* keys, size_t n, const Table* table) {
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i) {
+      found += API::Contain(keys[i], table);
+    }
+    return found;
+  }
+};
+
+// Benchmarks Filter through its AddBatch() and FindBatch() instead.
+template <typename Filter>
+struct Batched {};
+
+// CuckooFilter::Add derives a kicked tag's other bucket from the tag, but the index
+// policies derive both buckets from the item, so once buckets fill Add misplaces tags and
+// soon gives up. AddAll fills the filter the way seeded filters are built instead: a
+// cuckoo_hashtable with the filter's buckets, hash and (zero) seeds places the items, and
+// its tags are copied in with CopyInsert. The hash must give the same value in every
+// instance, as CityHasher does and TwoIndependentMultiplyShift does not.
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+struct FilterAPI<
+    CuckooFilter<ItemType, bits_per_item, HashFamily, TableType, IndexPolicy>>
+    : OneAtATime<FilterAPI<CuckooFilter<ItemType, bits_per_item, HashFamily,
+                                        TableType, IndexPolicy>>> {
+  static_assert(is_same<IndexPolicy, RawIndex>::value,
+                "the placement table uses the raw index policy");
+  using Table =
+      CuckooFilter<ItemType, bits_per_item, HashFamily, TableType, IndexPolicy>;
+  using Placement = cuckoohashtable::cuckoo_hashtable<ItemType, bits_per_item, HashFamily>;
   static Table ConstructFromAddCount(size_t add_count) { return Table(add_count); }
-  static void Add(uint64_t key, Table * table) {
-    if (0 != table->Add(key)) {
-      throw logic_error("The filter is too small to hold all of the elements");
+  static void AddAll(const uint64_t* keys, size_t n, Table* table) {
+    Placement placement(table->NumBuckets() * Placement::slot_per_bucket());
+    for (size_t i = 0; i < n; ++i) {
+      if (!placement.try_insert(keys[i])) {
+        throw logic_error("The filter is too small to hold all of the elements");
+      }
+    }
+    vector<vector<uint32_t>> tags;
+    placement.export_table(tags);
+    for (size_t i = 0; i < tags.size(); ++i) {
+      for (size_t j = 0; j < tags[i].size(); ++j) {
+        if (tags[i][j] != 0 && Ok != table->CopyInsert(tags[i][j], i, j)) {
+          throw logic_error("A tag could not be copied into the filter");
+        }
+      }
     }
   }
   static bool Contain(uint64_t key, const Table * table) {
@@ -137,7 +233,7 @@ struct FilterAPI<CuckooFilter<ItemType, bits_per_item, TableType>> {
 };
 
 template <>
-struct FilterAPI<SimdBlockFilter<>> {
+struct FilterAPI<SimdBlockFilter<>> : OneAtATime<FilterAPI<SimdBlockFilter<>>> {
   using Table = SimdBlockFilter<>;
   static Table ConstructFromAddCount(size_t add_count) {
     Table ans(ceil(log2(add_count * 8.0 / CHAR_BIT)));
@@ -151,9 +247,51 @@ struct FilterAPI<SimdBlockFilter<>> {
   }
 };
 
+template <>
+struct FilterAPI<SimdBlockFilter512<>> : OneAtATime<FilterAPI<SimdBlockFilter512<>>> {
+  using Table = SimdBlockFilter512<>;
+  static Table ConstructFromAddCount(size_t add_count) {
+    Table ans(ceil(log2(add_count * 8.0 / CHAR_BIT)));
+    return ans;
+  }
+  static void Add(uint64_t key, Table* table) {
+    table->Add(key);
+  }
+  static bool Contain(uint64_t key, const Table * table) {
+    return table->Find(key);
+  }
+};
+
+// A static filter: AddAll builds it from all of the keys at once.
+template <typename FingerprintType>
+struct FilterAPI<BinaryFuseFilter<uint64_t, FingerprintType>>
+    : OneAtATime<FilterAPI<BinaryFuseFilter<uint64_t, FingerprintType>>> {
+  using Table = BinaryFuseFilter<uint64_t, FingerprintType>;
+  static Table ConstructFromAddCount(size_t add_count) { return Table(add_count); }
+  static void AddAll(const uint64_t* keys, size_t n, Table* table) {
+    if (Ok != table->Build(keys, n)) {
+      throw logic_error("The binary fuse filter could not be built");
+    }
+  }
+  static bool Contain(uint64_t key, const Table * table) {
+    return (0 == table->Contain(key));
+  }
+};
+
+template <typename Filter>
+struct FilterAPI<Batched<Filter>> : FilterAPI<Filter> {
+  using Table = typename FilterAPI<Filter>::Table;
+  static void AddAll(const uint64_t* keys, size_t n, Table* table) {
+    table->AddBatch(keys, n);
+  }
+  static size_t ContainCount(const uint64_t* keys, size_t n, const Table* table) {
+    return table->FindBatch(keys, n);
+  }
+};
+
 template <typename Table>
-Statistics FilterBenchmark(
-    size_t add_count, const vector<uint64_t>& to_add, const vector<uint64_t>& to_lookup) {
+Statistics FilterBenchmark(size_t add_count, const vector<uint64_t>& to_add,
+                           const vector<uint64_t>& to_lookup, PerfCounters* counters) {
   if (add_count > to_add.size()) {
     throw out_of_range("to_add must contain at least add_count values");
   }
@@ -162,26 +300,33 @@ Statistics FilterBenchmark(
     throw out_of_range("to_lookup must contain at least SAMPLE_SIZE values");
   }
 
-  Table filter = FilterAPI<Table>::ConstructFromAddCount(add_count);
+  typename FilterAPI<Table>::Table filter =
+      FilterAPI<Table>::ConstructFromAddCount(add_count);
   Statistics result;
 
   // Add values until failure or until we run out of values to add:
+  counters->Start();
   auto start_time = NowNanos();
-  for (size_t added = 0; added < add_count; ++added) {
-    FilterAPI<Table>::Add(to_add[added], &filter);
-  }
+  FilterAPI<Table>::AddAll(&to_add[0], add_count, &filter);
   result.adds_per_nano = add_count / static_cast<double>(NowNanos() - start_time);
+  result.add_counts = counters->Stop().PerOp(add_count);
   result.bits_per_item = static_cast<double>(CHAR_BIT * filter.SizeInBytes()) / add_count;
 
   size_t found_count = 0;
+  PerfCounts find_counts;
   for (const double found_probability : {0.0, 0.25, 0.50, 0.75, 1.00}) {
     const auto to_lookup_mixed = MixIn(&to_lookup[0], &to_lookup[SAMPLE_SIZE], &to_add[0],
         &to_add[add_count], found_probability);
+    counters->Start();
     const auto start_time = NowNanos();
-    for (const auto v : to_lookup_mixed) {
-      found_count += FilterAPI<Table>::Contain(v, &filter);
-    }
+    const size_t found = FilterAPI<Table>::ContainCount(
+        &to_lookup_mixed[0], to_lookup_mixed.size(), &filter);
     const auto lookup_time = NowNanos() - start_time;
+    find_counts += counters->Stop();
+    found_count += found;
+    if (1.00 == found_probability && found != to_lookup_mixed.size()) {
+      throw logic_error("The filter missed an added element");
+    }
     result.finds_per_nano[100 * found_probability] =
         SAMPLE_SIZE / static_cast<double>(lookup_time);
     if (0.0 == found_probability) {
@@ -189,12 +334,13 @@ Statistics FilterBenchmark(
           found_count / static_cast<double>(to_lookup_mixed.size());
     }
   }
+  result.find_counts = find_counts.PerOp(5.0 * SAMPLE_SIZE);
   return result;
 }
 
 int main(int argc, char * argv[]) {
-  if (argc != 2) {
-    cerr << "Usage: " << argv[0] << " $NUMBER" << endl;
+  if (argc != 2 && argc != 3) {
+    cerr << "Usage: " << argv[0] << " $NUMBER [scalar|sse4.2|avx2|avx512]" << endl;
     return 1;
   }
   stringstream input_string(argv[1]);
@@ -204,52 +350,92 @@ int main(int argc, char * argv[]) {
     cerr << "Invalid number: " << argv[1];
     return 2;
   }
+  if (argc == 3) {
+    SimdLevel level;
+    if (!ParseSimdLevel(argv[2], &level)) {
+      cerr << "Invalid SIMD level: " << argv[2];
+      return 2;
+    }
+    LimitSimdLevel(level);
+  }
+  cerr << "SIMD level: " << SimdLevelName(ActiveSimdLevel()) << endl;
 
   const vector<uint64_t> to_add = GenerateRandom64(add_count);
   const vector<uint64_t> to_lookup = GenerateRandom64(SAMPLE_SIZE);
 
+  PerfCounters counters;
+  if (!counters.Available()) {
+    cerr << "Hardware counters unavailable: " << strerror(errno) << endl;
+  }
+
   constexpr int NAME_WIDTH = 13;
 
-  cout << StatisticsTableHeader(NAME_WIDTH, 5) << endl;
+  cout << StatisticsTableHeader(NAME_WIDTH, 5, counters.Available()) << endl;
 
   auto cf = FilterBenchmark<
-      CuckooFilter<uint64_t, 12 /* bits per item */, SingleTable /* not semi-sorted*/>>(
-      add_count, to_add, to_lookup);
+      CuckooFilter<uint64_t, 12 /* bits per item */, CityHasher<uint64_t>,
+                   SingleTable /* not semi-sorted*/>>(
+      add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "Cuckoo12" << cf << endl;
 
   cf = FilterBenchmark<
-      CuckooFilter<uint64_t, 13 /* bits per item */, PackedTable /* semi-sorted*/>>(
-      add_count, to_add, to_lookup);
+      CuckooFilter<uint64_t, 13 /* bits per item */, CityHasher<uint64_t>,
+                   PackedTable /* semi-sorted*/>>(
+      add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "SemiSort13" << cf << endl;
 
   cf = FilterBenchmark<
-      CuckooFilter<uint64_t, 8 /* bits per item */, SingleTable /* not semi-sorted*/>>(
-      add_count, to_add, to_lookup);
+      CuckooFilter<uint64_t, 8 /* bits per item */, CityHasher<uint64_t>,
+                   SingleTable /* not semi-sorted*/>>(
+      add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "Cuckoo8" << cf << endl;
 
   cf = FilterBenchmark<
-      CuckooFilter<uint64_t, 9 /* bits per item */, PackedTable /* semi-sorted*/>>(
-      add_count, to_add, to_lookup);
+      CuckooFilter<uint64_t, 9 /* bits per item */, CityHasher<uint64_t>,
+                   PackedTable /* semi-sorted*/>>(
+      add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "SemiSort9" << cf << endl;
 
   cf = FilterBenchmark<
-      CuckooFilter<uint64_t, 16 /* bits per item */, SingleTable /* not semi-sorted*/>>(
-      add_count, to_add, to_lookup);
+      CuckooFilter<uint64_t, 16 /* bits per item */, CityHasher<uint64_t>,
+                   SingleTable /* not semi-sorted*/>>(
+      add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "Cuckoo16" << cf << endl;
 
   cf = FilterBenchmark<
-      CuckooFilter<uint64_t, 17 /* bits per item */, PackedTable /* semi-sorted*/>>(
-      add_count, to_add, to_lookup);
+      CuckooFilter<uint64_t, 17 /* bits per item */, CityHasher<uint64_t>,
+                   PackedTable /* semi-sorted*/>>(
+      add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "SemiSort17" << cf << endl;
 
-  cf = FilterBenchmark<SimdBlockFilter<>>(add_count, to_add, to_lookup);
+  cf = FilterBenchmark<SimdBlockFilter<>>(add_count, to_add, to_lookup, &counters);
 
   cout << setw(NAME_WIDTH) << "SimdBlock8" << cf << endl;
 
+  cf = FilterBenchmark<Batched<SimdBlockFilter<>>>(add_count, to_add, to_lookup, &counters);
+
+  cout << setw(NAME_WIDTH) << "SimdBatch8" << cf << endl;
+
+  cf = FilterBenchmark<SimdBlockFilter512<>>(add_count, to_add, to_lookup, &counters);
+
+  cout << setw(NAME_WIDTH) << "Simd512Blk8" << cf << endl;
+
+  cf = FilterBenchmark<Batched<SimdBlockFilter512<>>>(add_count, to_add, to_lookup, &counters);
+
+  cout << setw(NAME_WIDTH) << "Simd512Bat8" << cf << endl;
+
+  cf = FilterBenchmark<BinaryFuseFilter<uint64_t, uint8_t>>(add_count, to_add, to_lookup, &counters);
+
+  cout << setw(NAME_WIDTH) << "BinaryFuse8" << cf << endl;
+
+  cf = FilterBenchmark<BinaryFuseFilter<uint64_t, uint16_t>>(add_count, to_add, to_lookup, &counters);
+
+  cout << setw(NAME_WIDTH) << "BinaryFuse16" << cf << endl;
+
 }
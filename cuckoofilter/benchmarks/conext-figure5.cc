@@ -65,10 +65,12 @@ int main() {
 
   // Calculate metrics:
   const auto cf = CuckooBenchmark<
-      CuckooFilter<uint64_t, 12 /* bits per item */, SingleTable /* not semi-sorted*/>>(
+      CuckooFilter<uint64_t, 12 /* bits per item */, TwoIndependentMultiplyShift,
+                   SingleTable /* not semi-sorted*/>>(
       add_count, to_add, to_lookup);
   const auto sscf = CuckooBenchmark<
-      CuckooFilter<uint64_t, 13 /* bits per item */, PackedTable /* semi-sorted*/>>(
+      CuckooFilter<uint64_t, 13 /* bits per item */, TwoIndependentMultiplyShift,
+                   PackedTable /* semi-sorted*/>>(
       add_count, to_add, to_lookup);
 
   cout << "fraction of queries on existing items/lookup throughput (million OPS) "
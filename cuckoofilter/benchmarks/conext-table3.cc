@@ -72,10 +72,12 @@ int main() {
 
   // Calculate metrics:
   const auto cf = CuckooBenchmark<
-      CuckooFilter<uint64_t, 12 /* bits per item */, SingleTable /* not semi-sorted*/>>(
+      CuckooFilter<uint64_t, 12 /* bits per item */, TwoIndependentMultiplyShift,
+                   SingleTable /* not semi-sorted*/>>(
       add_count, input);
   const auto sscf = CuckooBenchmark<
-      CuckooFilter<uint64_t, 13 /* bits per item */, PackedTable /* semi-sorted*/>>(
+      CuckooFilter<uint64_t, 13 /* bits per item */, TwoIndependentMultiplyShift,
+                   PackedTable /* semi-sorted*/>>(
       add_count, input);
 
   cout << setw(35) << left << "metrics " << setw(10) << right << "CF" << setw(10)
@@ -9,22 +9,29 @@
 #include <stdexcept>
 #include <vector>
 
+#include "keygen.hh"
 
-::std::vector<::std::uint64_t> GenerateRandom64(::std::size_t count) {
+// count keys of stream of seed, generated on every hardware thread. The keys depend only
+// on seed and stream, so runs with the same ones see the same keys.
+::std::vector<::std::uint64_t> GenerateSeeded64(::std::size_t count, ::std::uint64_t seed,
+                                                ::std::uint64_t stream = 0) {
   ::std::vector<::std::uint64_t> result(count);
-  ::std::random_device random;
-  // To generate random keys to lookup, this uses ::std::random_device which is slower but
-  // stronger than some other pseudo-random alternatives. The reason is that some of these
-  // alternatives (like libstdc++'s ::std::default_random, which is a linear congruential
-  // generator) behave non-randomly under some hash families like Dietzfelbinger's
-  // multiply-shift.
-  auto genrand = [&random]() {
-    return random() + (static_cast<::std::uint64_t>(random()) << 32);
-  };
-  ::std::generate(result.begin(), result.end(), ::std::ref(genrand));
+  random_keys(seed, stream, result.data(), count);
   return result;
 }
 
+::std::vector<::std::uint64_t> GenerateRandom64(::std::size_t count) {
+  ::std::random_device random;
+  // To generate random keys to lookup, this seeds SplitMix64 streams (see keygen.hh)
+  // from ::std::random_device, which is slow but strong. Stronger than some other
+  // pseudo-random alternatives is needed: some of these alternatives (like libstdc++'s
+  // ::std::default_random, which is a linear congruential generator) behave non-randomly
+  // under some hash families like Dietzfelbinger's multiply-shift. SplitMix64 output
+  // passes BigCrush, and is a counter hash, so it is generated in parallel.
+  const ::std::uint64_t seed = random() + (static_cast<::std::uint64_t>(random()) << 32);
+  return GenerateSeeded64(count, seed);
+}
+
 // Using two pointer ranges for sequences x and y, create a vector clone of x but for
 // y_probability y's mixed in.
 template <typename T>
@@ -0,0 +1,176 @@
+// This benchmark shows what the index policy recovers on certificate-like
+// serial numbers. It is invoked as:
+//
+//     ./skewed-serials.exe 1000000
+//
+// The count is rounded up to the table's capacity (a power of two times four
+// slots). Each key set of that size is inserted into a cuckoo_hashtable, one
+// key at a time, until the table reports it is full, so the load column is
+// the maximum load factor reached. The table is then copied into a
+// CuckooFilter using the matching index policy, and every inserted key is
+// looked up in the filter to check the two agree on bucket placement.
+//
+// Key sets:
+//   uniform     - random 64-bit keys
+//   sequential  - a few CAs, each issuing consecutive serials from a random
+//                 start
+//   prefixed    - a few CAs, each fixing the high 24 bits and drawing the rest
+//                 at random
+//
+// Columns: keys inserted before the first failure, the load factor reached,
+// insert throughput, and filter false negatives (always 0 unless the policies
+// disagree).
+//
+// Example output (table-full messages omitted):
+//
+// keys        policy      inserted       load  Minserts/s   false neg
+// uniform     raw          1008936     96.22%        5.87           0
+// uniform     mixed        1010675     96.39%        4.44           0
+// sequential  raw               82      0.01%        1.29           0
+// sequential  mixed        1012425     96.55%        4.96           0
+// prefixed    raw           425812     40.61%        8.91           0
+// prefixed    mixed        1009284     96.25%        5.25           0
+
+#include <climits>
+#include <iomanip>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "random.h"
+#include "timing.h"
+
+#include "cuckoohashtable/city_hasher.hh"
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+// The number of certificate authorities issuing serials in the skewed sets
+const size_t NUM_ISSUERS = 16;
+
+struct Metrics {
+  size_t inserted;
+  double load_factor;
+  double speed;  // million inserts/sec
+  size_t false_negatives;
+};
+
+vector<uint64_t> GenerateSequential(size_t count, mt19937_64 &rd) {
+  vector<uint64_t> result;
+  result.reserve(count);
+  for (size_t issuer = 0; issuer < NUM_ISSUERS; ++issuer) {
+    const uint64_t start = rd();
+    const size_t n = count / NUM_ISSUERS + (issuer < count % NUM_ISSUERS);
+    for (size_t i = 0; i < n; ++i) {
+      result.push_back(start + i);
+    }
+  }
+  shuffle(result.begin(), result.end(), rd);
+  return result;
+}
+
+vector<uint64_t> GeneratePrefixed(size_t count, mt19937_64 &rd) {
+  vector<uint64_t> prefixes(NUM_ISSUERS);
+  for (auto &p : prefixes) {
+    p = rd() & 0xffffff0000000000ULL;
+  }
+  vector<uint64_t> result(count);
+  for (size_t i = 0; i < count; ++i) {
+    result[i] = prefixes[i % NUM_ISSUERS] | (rd() & 0x000000ffffffffffULL);
+  }
+  return result;
+}
+
+template <typename TablePolicy, typename FilterPolicy>
+Metrics SkewBenchmark(const vector<uint64_t> &keys) {
+  typedef cuckoohashtable::cuckoo_hashtable<
+      uint64_t, 12, CityHasher<uint64_t>, std::equal_to<uint64_t>,
+      std::allocator<uint64_t>, 4, cuckoohashtable::identity_key_source,
+      TablePolicy>
+      Table;
+  typedef CuckooFilter<uint64_t, 12, CityHasher<uint64_t>, SingleTable,
+                       FilterPolicy>
+      Filter;
+
+  Table table(keys.size());
+  Metrics result;
+  result.inserted = 0;
+
+  auto start_time = NowNanos();
+  try {
+    for (const auto k : keys) {
+      table.insert(k);
+      result.inserted++;
+    }
+  } catch (const out_of_range &) {
+    // table full
+  }
+  result.speed =
+      result.inserted * 1000.0 / static_cast<double>(NowNanos() - start_time);
+  result.load_factor = table.load_factor();
+
+  vector<vector<uint64_t>> fp_table;
+  table.export_table(fp_table);
+  Filter filter(keys.size(), table.get_seeds());
+  for (size_t i = 0; i < fp_table.size(); ++i) {
+    for (size_t j = 0; j < fp_table[i].size(); ++j) {
+      if (fp_table[i][j] != 0) {
+        filter.CopyInsert(fp_table[i][j], i, j);
+      }
+    }
+  }
+  result.false_negatives = 0;
+  for (size_t i = 0; i < result.inserted; ++i) {
+    result.false_negatives += filter.Contain(keys[i]) != Ok;
+  }
+  return result;
+}
+
+void PrintRow(const string &keys, const string &policy, const Metrics &m) {
+  cout << setw(12) << left << keys << setw(8) << policy << right << setw(12)
+       << m.inserted << fixed << setprecision(2) << setw(10)
+       << 100.0 * m.load_factor << '%' << setw(12) << m.speed << setw(12)
+       << m.false_negatives << endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " $NUMBER" << endl;
+    return 1;
+  }
+  stringstream input_string(argv[1]);
+  size_t add_count;
+  input_string >> add_count;
+  if (input_string.fail()) {
+    cerr << "Invalid number: " << argv[1];
+    return 2;
+  }
+
+  size_t capacity = 4;
+  while (capacity < add_count) {
+    capacity <<= 1;
+  }
+  add_count = capacity;
+
+  mt19937_64 rd(1);
+  const vector<pair<string, vector<uint64_t>>> sets = {
+      {"uniform", GenerateRandom64(add_count)},
+      {"sequential", GenerateSequential(add_count, rd)},
+      {"prefixed", GeneratePrefixed(add_count, rd)},
+  };
+
+  cout << setw(12) << left << "keys" << setw(8) << "policy" << right
+       << setw(12) << "inserted" << setw(11) << "load" << setw(12)
+       << "Minserts/s" << setw(12) << "false neg" << endl;
+  for (const auto &set : sets) {
+    PrintRow(set.first, "raw",
+             SkewBenchmark<cuckoohashtable::raw_index_policy, RawIndex>(
+                 set.second));
+    PrintRow(set.first, "mixed",
+             SkewBenchmark<cuckoohashtable::mixed_index_policy, MixedIndex>(
+                 set.second));
+  }
+}
@@ -0,0 +1,238 @@
+// This benchmark reports the latency distribution of concurrent revocation queries
+// against a seeded CuckooFilter. It is invoked as:
+//
+//     ./tail-latency.exe 1000000 [$MAX_THREADS] [reload]
+//
+// A cuckoo_hashtable is filled with that many random keys (the count is rounded up to a
+// power of two times four slots, and the table filled to 90% of it), its false
+// positives against as many absent keys are eliminated, and the resulting filter is
+// serialized as a snapshot. For 1, 2, 4, ... reader threads up to $MAX_THREADS (by
+// default the number of hardware threads), each reader looks up SAMPLE_SIZE keys one at
+// a time, for each of the 0/25/50/75/100% hit mixes of bulk-insert-and-query.exe, and
+// records the latency of every lookup. The rows give the aggregate rate over all
+// readers and percentiles of the merged histograms in nanoseconds.
+//
+// With "reload", a writer thread deserializes the snapshot into a new filter and
+// publishes it as readers run, every RELOAD_INTERVAL, as a server does when a new
+// revocation snapshot lands, only far more often. Readers pick up the current filter
+// once every BATCH_SIZE lookups either way, between timed lookups, so the rows differ
+// only by the reloads.
+//
+// Latencies include one steady_clock read per lookup (about 20ns), and with more
+// readers than cores, the time a reader is descheduled mid-lookup.
+//
+// Example output (2^20 buckets, 90% load, reload, one core; on one core the reloader
+// and any second reader share it, which the max column shows):
+//
+// threads  find    Mq/s     p50     p90     p99   p99.9  p99.99       max
+//       1    0%    6.23     131     199     319     495    1727   1995304
+//       1   25%    6.58     131     187     319     487    2015   1017740
+//       1   50%    6.02     139     195     327     503    4351   3923653
+//       1   75%    6.54     131     187     303     455    2175    890896
+//       1  100%    6.91     125     151     311     575    2111   1083300
+// reloads: 68 (87.0/s)
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "random.h"
+#include "timing.h"
+
+#include "cuckoohashtable/city_hasher.hh"
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
+
+using namespace std;
+
+using namespace cuckoofilter;
+
+// The number of lookups each reader times per hit mix
+const size_t SAMPLE_SIZE = 1000 * 1000;
+
+// The lookups a reader makes with one loaded filter
+const size_t BATCH_SIZE = 256;
+
+// The pause between snapshot reloads
+const chrono::milliseconds RELOAD_INTERVAL(10);
+
+typedef cuckoohashtable::cuckoo_hashtable<uint64_t, 12, CityHasher<uint64_t>> Table;
+typedef CuckooFilter<uint64_t, 12, CityHasher<uint64_t>> Filter;
+
+// The filter readers query, replaced whole by the reloader. Readers load it with
+// atomic_load, so a filter is freed only after the last reader holding it is done.
+struct Published {
+  shared_ptr<const Filter> filter;
+
+  shared_ptr<const Filter> Load() const { return atomic_load(&filter); }
+  void Store(shared_ptr<const Filter> next) { atomic_store(&filter, move(next)); }
+};
+
+shared_ptr<const Filter> LoadSnapshot(const string &snapshot) {
+  shared_ptr<Filter> filter(new Filter(1));
+  istringstream in(snapshot);
+  if (filter->Deserialize(in) != Ok) {
+    throw logic_error("The snapshot could not be read");
+  }
+  return filter;
+}
+
+// Times every lookup of keys[begin, begin + n), wrapping around keys. The filter is
+// loaded, and released, once per batch outside the timed lookups, so the atomic_load and
+// reference count of the shared_ptr are not charged to any one of them.
+void Reader(const Published &published, const vector<uint64_t> &keys, size_t begin,
+            size_t n, LatencyHistogram *histogram, size_t *found) {
+  size_t hits = 0;
+  for (size_t batch = 0; batch < n; batch += BATCH_SIZE) {
+    const shared_ptr<const Filter> filter = published.Load();
+    const size_t end = min(n, batch + BATCH_SIZE);
+    uint64_t last = NowNanos();
+    for (size_t i = batch; i < end; ++i) {
+      const uint64_t key = keys[(begin + i) % keys.size()];
+      hits += filter->Contain(key) == Ok;
+      const uint64_t now = NowNanos();
+      histogram->Record(now - last);
+      last = now;
+    }
+  }
+  *found = hits;
+}
+
+// Runs threads readers over each hit mix, printing a row per mix.
+void LatencyBenchmark(const vector<vector<uint64_t>> &mixes, size_t threads,
+                      Published *published) {
+  for (size_t m = 0; m < mixes.size(); ++m) {
+    vector<LatencyHistogram> histograms(threads);
+    vector<size_t> found(threads);
+    vector<thread> readers;
+    const auto start_time = NowNanos();
+    for (size_t t = 0; t < threads; ++t) {
+      readers.emplace_back(Reader, cref(*published), cref(mixes[m]),
+                           t * mixes[m].size() / threads, SAMPLE_SIZE, &histograms[t],
+                           &found[t]);
+    }
+    for (auto &r : readers) r.join();
+    const double nanos = static_cast<double>(NowNanos() - start_time);
+
+    LatencyHistogram merged;
+    size_t total_found = 0;
+    for (size_t t = 0; t < threads; ++t) {
+      merged.Merge(histograms[t]);
+      total_found += found[t];
+    }
+    if (m == mixes.size() - 1 && total_found != merged.Count()) {
+      throw logic_error("The filter missed a stored key");
+    }
+    cout << setw(7) << threads << setw(5) << 100 * m / (mixes.size() - 1) << '%' << fixed
+         << setprecision(2) << setw(8) << merged.Count() * 1000.0 / nanos;
+    for (const double q : {0.50, 0.90, 0.99, 0.999, 0.9999}) {
+      cout << setw(8) << merged.Percentile(q);
+    }
+    cout << setw(10) << merged.Max() << endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 4) {
+    cerr << "Usage: " << argv[0] << " $NUMBER [$MAX_THREADS] [reload]" << endl;
+    return 1;
+  }
+  stringstream input_string(argv[1]);
+  size_t add_count;
+  input_string >> add_count;
+  if (input_string.fail()) {
+    cerr << "Invalid number: " << argv[1];
+    return 2;
+  }
+  size_t max_threads = max(1u, thread::hardware_concurrency());
+  bool reload = false;
+  for (int i = 2; i < argc; ++i) {
+    if (string(argv[i]) == "reload") {
+      reload = true;
+    } else {
+      stringstream threads_string(argv[i]);
+      threads_string >> max_threads;
+      if (threads_string.fail() || max_threads == 0) {
+        cerr << "Invalid thread count: " << argv[i];
+        return 2;
+      }
+    }
+  }
+
+  size_t capacity = 4;
+  while (capacity < add_count) {
+    capacity <<= 1;
+  }
+  const size_t count = capacity / 10 * 9;
+  const vector<uint64_t> present = GenerateRandom64(count);
+  const vector<uint64_t> absent = GenerateRandom64(count);
+  const vector<uint64_t> to_lookup = GenerateRandom64(SAMPLE_SIZE);
+
+  Table table(capacity);
+  vector<uint64_t> stored;
+  for (const auto k : present) {
+    try {
+      table.insert(k);
+      stored.push_back(k);
+    } catch (const out_of_range &) {
+      // table full
+    }
+  }
+  table.eliminate_false_positives(absent.data(), absent.size());
+  string snapshot;
+  {
+    const Filter view(table.packed_partials(), table.get_seeds(), table.size());
+    ostringstream out;
+    if (view.Serialize(out) != Ok) {
+      throw logic_error("The filter could not be serialized");
+    }
+    snapshot = out.str();
+  }
+
+  vector<vector<uint64_t>> mixes;
+  for (const double found_probability : {0.0, 0.25, 0.50, 0.75, 1.00}) {
+    mixes.push_back(MixIn(&to_lookup[0], &to_lookup[SAMPLE_SIZE], &stored[0],
+                          &stored[0] + stored.size(), found_probability));
+  }
+
+  Published published;
+  published.Store(LoadSnapshot(snapshot));
+  atomic<bool> stop(false);
+  size_t reloads = 0;
+  thread reloader;
+  const auto start_time = NowNanos();
+  if (reload) {
+    reloader = thread([&]() {
+      while (!stop.load(memory_order_relaxed)) {
+        published.Store(LoadSnapshot(snapshot));
+        reloads++;
+        this_thread::sleep_for(RELOAD_INTERVAL);
+      }
+    });
+  }
+
+  cout << setw(7) << "threads" << setw(6) << "find" << setw(8) << "Mq/s";
+  for (const char *p : {"p50", "p90", "p99", "p99.9", "p99.99"}) {
+    cout << setw(8) << p;
+  }
+  cout << setw(10) << "max" << endl;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    LatencyBenchmark(mixes, threads, &published);
+    if (threads < max_threads && threads * 2 > max_threads) {
+      LatencyBenchmark(mixes, max_threads, &published);
+    }
+  }
+
+  if (reload) {
+    stop = true;
+    reloader.join();
+    const double seconds = (NowNanos() - start_time) / 1e9;
+    cout << "reloads: " << reloads << " (" << setprecision(1) << reloads / seconds
+         << "/s)" << endl;
+  }
+}
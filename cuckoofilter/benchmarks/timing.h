@@ -1,12 +1,202 @@
-// Timers for use in benchmarking.
+// Timers, latency histograms and hardware event counters for use in benchmarking.
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <chrono>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 ::std::uint64_t NowNanos() {
   return ::std::chrono::duration_cast<::std::chrono::nanoseconds>(
              ::std::chrono::steady_clock::now().time_since_epoch())
       .count();
 }
+
+// A log-linear histogram of latencies in nanoseconds. Values below 2^kSubBits are kept
+// exactly; each power of two above is split into 2^kSubBits equal buckets, so a recorded
+// value is off by less than 1/2^kSubBits of itself (3% here) and the histogram takes a
+// fixed 15KB whatever the range.
+class LatencyHistogram {
+ public:
+  static const int kSubBits = 5;
+
+  LatencyHistogram() : counts_((65 - kSubBits) << kSubBits, 0), total_(0), max_(0) {}
+
+  void Record(uint64_t nanos) {
+    counts_[Index(nanos)]++;
+    total_++;
+    max_ = ::std::max(max_, nanos);
+  }
+
+  void Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+    total_ += other.total_;
+    max_ = ::std::max(max_, other.max_);
+  }
+
+  uint64_t Count() const { return total_; }
+  uint64_t Max() const { return max_; }
+
+  // The value at or below which a fraction q of the recorded values lie, rounded up to
+  // the top of its bucket.
+  uint64_t Percentile(double q) const {
+    const uint64_t rank = ::std::max<uint64_t>(1, ::std::ceil(q * total_));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank) return ::std::min(max_, Top(i));
+    }
+    return max_;
+  }
+
+ private:
+  static size_t Index(uint64_t v) {
+    if (v < (1u << kSubBits)) return v;
+    const int e = 63 - __builtin_clzll(v);
+    const size_t sub = (v >> (e - kSubBits)) & ((1u << kSubBits) - 1);
+    return (static_cast<size_t>(e - kSubBits + 1) << kSubBits) + sub;
+  }
+
+  static uint64_t Top(size_t i) {
+    if (i < (1u << kSubBits)) return i;
+    const int shift = (i >> kSubBits) - 1;
+    const uint64_t low = ((1ull << kSubBits) + (i & ((1u << kSubBits) - 1))) << shift;
+    return low + ((1ull << shift) - 1);
+  }
+
+  ::std::vector<uint64_t> counts_;
+  uint64_t total_;
+  uint64_t max_;
+};
+
+// The hardware events PerfCounters counts.
+enum PerfEvent {
+  kInstructions = 0,
+  kLlcMisses,
+  kDtlbMisses,
+  kBranchMisses,
+  kNumPerfEvents
+};
+
+// Counts of each PerfEvent over some span of a benchmark. A count is negative when its
+// counter could not be opened.
+struct PerfCounts {
+  double count[kNumPerfEvents];
+
+  PerfCounts() {
+    for (int i = 0; i < kNumPerfEvents; ++i) count[i] = -1;
+  }
+
+  bool Any() const {
+    for (int i = 0; i < kNumPerfEvents; ++i) {
+      if (count[i] >= 0) return true;
+    }
+    return false;
+  }
+
+  // The counts per operation, over ops operations.
+  PerfCounts PerOp(double ops) const {
+    PerfCounts result;
+    for (int i = 0; i < kNumPerfEvents; ++i) {
+      result.count[i] = count[i] < 0 ? count[i] : count[i] / ops;
+    }
+    return result;
+  }
+
+  PerfCounts& operator+=(const PerfCounts& other) {
+    for (int i = 0; i < kNumPerfEvents; ++i) {
+      if (other.count[i] >= 0) count[i] = (count[i] < 0 ? 0 : count[i]) + other.count[i];
+    }
+    return *this;
+  }
+};
+
+// A perf_event_open group counting user-space instructions, last-level cache read
+// misses, dTLB read misses and branch mispredictions of the calling thread between
+// Start() and Stop(). Events the CPU, the kernel or perf_event_paranoid do not allow are
+// left out, and off Linux none are counted, so Available() should be checked before
+// reporting counts.
+class PerfCounters {
+ public:
+  PerfCounters() {
+    for (int i = 0; i < kNumPerfEvents; ++i) fd_[i] = -1;
+#ifdef __linux__
+    const uint32_t types[kNumPerfEvents] = {PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                            PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+    const uint64_t configs[kNumPerfEvents] = {
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < kNumPerfEvents; ++i) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = (leader_ < 0);
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // The group may be multiplexed with other users of the PMU, so the counts are
+      // scaled by how long they actually ran.
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fd_[i] >= 0 && leader_ < 0) leader_ = fd_[i];
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int i = 0; i < kNumPerfEvents; ++i) {
+      if (fd_[i] >= 0) close(fd_[i]);
+    }
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool Available() const { return leader_ >= 0; }
+
+  void Start() {
+#ifdef __linux__
+    if (leader_ < 0) return;
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  // The counts since Start(), negative for the events not counted.
+  PerfCounts Stop() {
+    PerfCounts result;
+#ifdef __linux__
+    if (leader_ < 0) return result;
+    ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (int i = 0; i < kNumPerfEvents; ++i) {
+      uint64_t values[3];  // value, time enabled, time running
+      if (fd_[i] < 0 || read(fd_[i], values, sizeof(values)) != sizeof(values)) continue;
+      result.count[i] = values[2] == 0 ? 0
+                                       : static_cast<double>(values[0]) *
+                                             static_cast<double>(values[1]) / values[2];
+    }
+#endif
+    return result;
+  }
+
+ private:
+  int fd_[kNumPerfEvents];
+  int leader_ = -1;
+};
@@ -0,0 +1,449 @@
+#ifndef CUCKOO_FILTER_BINARY_FUSE_FILTER_H_
+#define CUCKOO_FILTER_BINARY_FUSE_FILTER_H_
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "hashutil.h"
+
+namespace cuckoofilter {
+
+// A static 3-wise binary fuse filter (Graf and Lemire, "Binary Fuse Filters:
+// Fast and Smaller Than Xor Filters"). It is built once from a complete key
+// set and cannot be changed afterwards, which suits immutable snapshots: an
+// item hashes to one slot in each of three consecutive segments of an array
+// of fingerprints, and the filter holds the item iff the three slots xor to
+// its fingerprint. This takes about 1.13 slots per key for large sets, e.g.
+// 9 bits per key at a 1/256 false positive rate with 8-bit fingerprints, and
+// a lookup reads three slots that are usually a few KB apart.
+//
+// The build peels the hypergraph of keys and slots: a slot touched by one key
+// alone is assigned last, so keys are removed in that order until none are
+// left, and fingerprints are then set in reverse. It fails (rarely, for
+// large sets) when no slot is left alone; Build() then retries with the next
+// seed.
+//
+// Template parameters:
+//   ItemType: the type of the keys
+//   FingerprintType: uint8_t, uint16_t or uint32_t; the false positive rate is
+// 2^-bits
+//   HashFamily: the seeded hash, called as hasher(item, seed) as for the
+// tag hash of CuckooFilter
+template <typename ItemType, typename FingerprintType = uint8_t,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class BinaryFuseFilter {
+  static const uint32_t kArity = 3;
+  static const uint32_t kMaxSegmentLength = 1 << 18;
+  // seeds tried by Build() before it gives up
+  static const uint32_t kMaxAttempts = 64;
+
+  size_t max_num_keys_;
+  size_t num_items_;
+  uint32_t seed_;
+  uint32_t segment_length_;
+  uint32_t segment_length_mask_;
+  uint32_t segment_count_length_;
+  std::vector<FingerprintType> fingerprints_;
+  HashFamily hasher_;
+
+  // hashes are remixed as HashFamily may leave structure in the low bits
+  inline uint64_t Hash(const ItemType &item, const uint32_t seed) const {
+    uint64_t h = hasher_(item, seed);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static inline FingerprintType Fingerprint(const uint64_t hash) {
+    return static_cast<FingerprintType>(hash ^ (hash >> 32));
+  }
+
+  // the slots of a hash, one in each of three consecutive segments
+  inline void Slots(const uint64_t hash, uint32_t slots[kArity]) const {
+    const uint64_t h0 = static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(hash) * segment_count_length_) >> 64);
+    slots[0] = static_cast<uint32_t>(h0);
+    slots[1] = slots[0] + segment_length_;
+    slots[2] = slots[1] + segment_length_;
+    slots[1] ^= static_cast<uint32_t>(hash >> 18) & segment_length_mask_;
+    slots[2] ^= static_cast<uint32_t>(hash) & segment_length_mask_;
+  }
+
+  // As cuckoo_hashtable::run_parallel: calls fn(thread, begin, end) for
+  // num_threads contiguous ranges of [0, n).
+  template <typename F>
+  static void RunParallel(const size_t num_threads, const size_t n, F fn) {
+    if (num_threads <= 1 || n < num_threads) {
+      fn(0, 0, n);
+      return;
+    }
+    std::vector<std::thread> workers;
+    const size_t chunk = (n + num_threads - 1) / num_threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      const size_t begin = std::min(n, t * chunk);
+      const size_t end = std::min(n, begin + chunk);
+      workers.emplace_back(fn, t, begin, end);
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+
+  // sorted, distinct hashes of items under seed
+  void SortedHashes(const ItemType *items, const size_t n, const uint32_t seed,
+                    const size_t num_threads,
+                    std::vector<uint64_t> *hashes) const;
+
+  // Peels the sorted hashes and sets fingerprints_. Returns false if some
+  // keys could not be peeled.
+  bool Peel(const std::vector<uint64_t> &hashes, const size_t num_threads);
+
+ public:
+  // Sizes the filter for up to max_num_keys distinct keys. Levels of a
+  // BinaryFuseCascade pass distinct first seeds.
+  explicit BinaryFuseFilter(const size_t max_num_keys,
+                            const uint32_t first_seed = 0,
+                            const HashFamily &hasher = HashFamily());
+
+  // Builds the filter from n keys, replacing its contents. Duplicate keys are
+  // allowed. Hashing, sorting and counting the slot degrees are split across
+  // num_threads threads (0 for hardware concurrency); the peel itself is
+  // sequential. The result does not depend on num_threads. Returns
+  // NotEnoughSpace if n is over max_num_keys or no seed peels.
+  Status Build(const ItemType *items, const size_t n,
+               const size_t num_threads = 0);
+
+  // Report if the item is in the filter
+  Status Contain(const ItemType &item) const {
+    const uint64_t hash = Hash(item, seed_);
+    uint32_t slots[kArity];
+    Slots(hash, slots);
+    const FingerprintType f = Fingerprint(hash) ^ fingerprints_[slots[0]] ^
+                              fingerprints_[slots[1]] ^ fingerprints_[slots[2]];
+    return f == 0 ? Ok : NotFound;
+  }
+
+  /* methods for providing stats  */
+  // summary infomation
+  std::string Info() const;
+
+  // number of distinct items the filter was built from
+  size_t Size() const { return num_items_; }
+
+  // size of the filter in bytes.
+  size_t SizeInBytes() const {
+    return fingerprints_.size() * sizeof(FingerprintType);
+  }
+
+  // seed the last Build() succeeded with
+  uint32_t Seed() const { return seed_; }
+};
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+BinaryFuseFilter<ItemType, FingerprintType, HashFamily>::BinaryFuseFilter(
+    const size_t max_num_keys, const uint32_t first_seed,
+    const HashFamily &hasher)
+    : max_num_keys_(max_num_keys),
+      num_items_(0),
+      seed_(first_seed),
+      hasher_(hasher) {
+  // Segment length and size factor as recommended in the paper for 3-wise
+  // filters. Unsigned wraparound below is intended for max_num_keys <= 1.
+  const size_t n = max_num_keys;
+  segment_length_ =
+      n == 0 ? 4 : 1U << static_cast<int>(floor(log(n) / log(3.33) + 2.25));
+  if (segment_length_ > kMaxSegmentLength) {
+    segment_length_ = kMaxSegmentLength;
+  }
+  segment_length_mask_ = segment_length_ - 1;
+  const double size_factor =
+      n <= 1 ? 0 : std::max(1.125, 0.875 + 0.25 * log(1000000.0) / log(n));
+  const uint32_t capacity =
+      n <= 1 ? 0 : static_cast<uint32_t>(round(n * size_factor));
+  const uint32_t init_segment_count =
+      (capacity + segment_length_ - 1) / segment_length_ - (kArity - 1);
+  uint32_t array_length = (init_segment_count + kArity - 1) * segment_length_;
+  uint32_t segment_count =
+      (array_length + segment_length_ - 1) / segment_length_;
+  segment_count =
+      segment_count <= kArity - 1 ? 1 : segment_count - (kArity - 1);
+  array_length = (segment_count + kArity - 1) * segment_length_;
+  segment_count_length_ = segment_count * segment_length_;
+  fingerprints_.assign(array_length, 0);
+}
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+void BinaryFuseFilter<ItemType, FingerprintType, HashFamily>::SortedHashes(
+    const ItemType *items, const size_t n, const uint32_t seed,
+    const size_t num_threads, std::vector<uint64_t> *hashes) const {
+  hashes->resize(n);
+  uint64_t *out = hashes->data();
+  // Sorting by hash also sorts by first slot, so the counting and peeling
+  // passes walk the array in order.
+  RunParallel(num_threads, n, [&](size_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      out[i] = Hash(items[i], seed);
+    }
+    std::sort(out + begin, out + end);
+  });
+  const size_t chunk =
+      num_threads <= 1 || n < num_threads
+          ? n
+          : (n + num_threads - 1) / num_threads;
+  for (size_t width = std::max<size_t>(chunk, 1); width < n; width *= 2) {
+    for (size_t begin = 0; begin + width < n; begin += 2 * width) {
+      std::inplace_merge(out + begin, out + begin + width,
+                         out + std::min(n, begin + 2 * width));
+    }
+  }
+  hashes->erase(std::unique(hashes->begin(), hashes->end()), hashes->end());
+}
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+bool BinaryFuseFilter<ItemType, FingerprintType, HashFamily>::Peel(
+    const std::vector<uint64_t> &hashes, const size_t num_threads) {
+  const uint32_t array_length = fingerprints_.size();
+  // xor of the hashes of the keys touching each slot, and their number
+  std::vector<uint64_t> slot_hash(array_length, 0);
+  std::vector<uint8_t> degree(array_length, 0);
+
+  // Each thread counts the slots of a range of whole segments. Slots of a key
+  // lie in the segment of its first slot and the two after, and keys are
+  // sorted by first slot, so a thread only visits the keys starting up to two
+  // segments before its range.
+  const uint32_t segment_count = array_length / segment_length_;
+  std::vector<char> overflow(std::max<size_t>(num_threads, 1), 0);
+  RunParallel(num_threads, segment_count, [&](size_t t, size_t begin,
+                                              size_t end) {
+    const uint32_t lo = begin * segment_length_;
+    const uint32_t hi = end * segment_length_;
+    const uint32_t first = begin < kArity - 1
+                               ? 0
+                               : (begin - (kArity - 1)) * segment_length_;
+    uint32_t slots[kArity];
+    auto key = std::lower_bound(
+        hashes.begin(), hashes.end(), first, [&](uint64_t h, uint32_t s) {
+          uint32_t k[kArity];
+          Slots(h, k);
+          return k[0] < s;
+        });
+    for (; key != hashes.end(); ++key) {
+      Slots(*key, slots);
+      if (slots[0] >= hi) {
+        break;
+      }
+      for (uint32_t k = 0; k < kArity; k++) {
+        if (slots[k] >= lo && slots[k] < hi) {
+          slot_hash[slots[k]] ^= *key;
+          overflow[t] |= ++degree[slots[k]] == 0;
+        }
+      }
+    }
+  });
+  if (std::find(overflow.begin(), overflow.end(), 1) != overflow.end()) {
+    return false;
+  }
+
+  std::vector<uint32_t> alone;
+  for (uint32_t i = 0; i < array_length; i++) {
+    if (degree[i] == 1) {
+      alone.push_back(i);
+    }
+  }
+  // keys in peeling order, with the slot each was peeled from
+  std::vector<uint64_t> order;
+  std::vector<uint8_t> order_slot;
+  order.reserve(hashes.size());
+  order_slot.reserve(hashes.size());
+  while (!alone.empty()) {
+    const uint32_t i = alone.back();
+    alone.pop_back();
+    if (degree[i] != 1) {
+      continue;
+    }
+    const uint64_t hash = slot_hash[i];
+    uint32_t slots[kArity];
+    Slots(hash, slots);
+    for (uint32_t k = 0; k < kArity; k++) {
+      if (slots[k] == i) {
+        order_slot.push_back(k);
+        continue;
+      }
+      slot_hash[slots[k]] ^= hash;
+      if (--degree[slots[k]] == 1) {
+        alone.push_back(slots[k]);
+      }
+    }
+    degree[i] = 0;
+    order.push_back(hash);
+  }
+  if (order.size() != hashes.size()) {
+    return false;
+  }
+
+  std::fill(fingerprints_.begin(), fingerprints_.end(), 0);
+  for (size_t n = order.size(); n-- > 0;) {
+    uint32_t slots[kArity];
+    Slots(order[n], slots);
+    const uint32_t k = order_slot[n];
+    fingerprints_[slots[k]] = Fingerprint(order[n]) ^
+                              fingerprints_[slots[(k + 1) % kArity]] ^
+                              fingerprints_[slots[(k + 2) % kArity]];
+  }
+  return true;
+}
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+Status BinaryFuseFilter<ItemType, FingerprintType, HashFamily>::Build(
+    const ItemType *items, const size_t n, size_t num_threads) {
+  if (n > max_num_keys_) {
+    return NotEnoughSpace;
+  }
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<uint64_t> hashes;
+  const uint32_t first_seed = seed_;
+  for (uint32_t attempt = 0; attempt < kMaxAttempts; attempt++) {
+    const uint32_t seed = first_seed + attempt;
+    SortedHashes(items, n, seed, num_threads, &hashes);
+    seed_ = seed;
+    if (Peel(hashes, num_threads)) {
+      num_items_ = hashes.size();
+      return Ok;
+    }
+  }
+  seed_ = first_seed;
+  return NotEnoughSpace;
+}
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+std::string BinaryFuseFilter<ItemType, FingerprintType, HashFamily>::Info()
+    const {
+  std::stringstream ss;
+  ss << "BinaryFuseFilter Status:\n"
+     << "\t\tFingerprint size: " << sizeof(FingerprintType) * 8 << " bits\n"
+     << "\t\tSegment length: " << segment_length_ << "\n"
+     << "\t\tTotal # of slots: " << fingerprints_.size() << "\n"
+     << "\t\tKeys stored: " << Size() << "\n"
+     << "\t\tSeed: " << seed_ << "\n"
+     << "\t\tFilter size: " << SizeInBytes() / 1024 << " KB\n";
+  if (Size() > 0) {
+    ss << "\t\tbit/key:   " << SizeInBytes() * 8.0 / Size() << "\n";
+  } else {
+    ss << "\t\tbit/key:   N/A\n";
+  }
+  return ss.str();
+}
+
+// A cascade of binary fuse filters answering membership in R exactly for
+// every key of R and S, as CRLite's Bloom filter cascade does: level 0 holds
+// R, level 1 the keys of S that level 0 accepts, level 2 the keys of R that
+// level 1 accepts, and so on until a level accepts no key of the other set.
+// Each level is 2^-bits the size of the one before it. A key's set is decided
+// by the first level that rejects it, or by the last level if none does.
+//
+// This replaces the seed rounds of the seeded cuckoo filter for frozen
+// snapshots; keys outside R and S get the false positive rate of level 0.
+template <typename ItemType, typename FingerprintType = uint8_t,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class BinaryFuseCascade {
+  typedef BinaryFuseFilter<ItemType, FingerprintType, HashFamily> Level;
+
+  // Keys in both R and S never separate; give up after this many levels.
+  static const size_t kMaxLevels = 32;
+  // spacing of the first seeds of consecutive levels
+  static const uint32_t kLevelSeedStride = 1 << 16;
+
+  std::vector<std::unique_ptr<Level>> levels_;
+
+ public:
+  // Builds the cascade, replacing its contents. R and S must be disjoint;
+  // NotEnoughSpace is returned otherwise. See BinaryFuseFilter::Build for
+  // num_threads.
+  Status Build(const ItemType *r, const size_t nr, const ItemType *s,
+               const size_t ns, const size_t num_threads = 0);
+
+  // Ok if the item is in R; exact for keys of R and S.
+  Status Contain(const ItemType &item) const {
+    for (size_t l = 0; l < levels_.size(); l++) {
+      if (levels_[l]->Contain(item) != Ok) {
+        return l % 2 == 1 ? Ok : NotFound;
+      }
+    }
+    return levels_.size() % 2 == 1 ? Ok : NotFound;
+  }
+
+  size_t NumLevels() const { return levels_.size(); }
+
+  size_t SizeInBytes() const {
+    size_t bytes = 0;
+    for (const auto &level : levels_) {
+      bytes += level->SizeInBytes();
+    }
+    return bytes;
+  }
+
+  std::string Info() const;
+};
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+Status BinaryFuseCascade<ItemType, FingerprintType, HashFamily>::Build(
+    const ItemType *r, const size_t nr, const ItemType *s, const size_t ns,
+    const size_t num_threads) {
+  levels_.clear();
+  // keys of the current level and of the other set that reach it
+  std::vector<ItemType> include(r, r + nr), exclude(s, s + ns), next;
+  while (levels_.size() < kMaxLevels) {
+    std::unique_ptr<Level> level(new Level(
+        include.size(), levels_.size() * kLevelSeedStride, HashFamily()));
+    const Status status =
+        level->Build(include.data(), include.size(), num_threads);
+    if (status != Ok) {
+      levels_.clear();
+      return status;
+    }
+    next.clear();
+    for (const auto &key : exclude) {
+      if (level->Contain(key) == Ok) {
+        next.push_back(key);
+      }
+    }
+    levels_.push_back(std::move(level));
+    if (next.empty()) {
+      return Ok;
+    }
+    exclude.swap(include);
+    include.swap(next);
+  }
+  levels_.clear();
+  return NotEnoughSpace;
+}
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+std::string BinaryFuseCascade<ItemType, FingerprintType, HashFamily>::Info()
+    const {
+  std::stringstream ss;
+  ss << "BinaryFuseCascade Status:\n"
+     << "\t\tFingerprint size: " << sizeof(FingerprintType) * 8 << " bits\n"
+     << "\t\tLevels: " << levels_.size() << "\n";
+  for (size_t l = 0; l < levels_.size(); l++) {
+    ss << "\t\tLevel " << l << ": " << levels_[l]->Size() << " keys, "
+       << levels_[l]->SizeInBytes() << " bytes\n";
+  }
+  ss << "\t\tCascade size: " << SizeInBytes() / 1024 << " KB\n";
+  return ss.str();
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_BINARY_FUSE_FILTER_H_
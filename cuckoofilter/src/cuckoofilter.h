@@ -3,9 +3,18 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "debug.h"
+#include "filterstats.h"
 #include "hashutil.h"
+#include "indexpolicy.h"
+#include "mortontable.h"
 #include "packedtable.h"
 #include "printutil.h"
 #include "singletable.h"
@@ -22,20 +31,62 @@ enum Status {
 // maximum number of cuckoo kicks before claiming failure
 const size_t kMaxCuckooCount = 500;
 
+// first word of a serialized filter, "CKF2". Version 2 appends the
+// exclusion set.
+const uint32_t kSerializedMagic = 0x32464b43;
+
+// seed of the hash that orders the exclusion set, above the uint16_t bucket
+// seeds so it is independent of every tag
+const uint32_t kExclusionSeed = 0x10000;
+
+// the most buckets Deserialize accepts: the hashtable a filter mirrors
+// addresses buckets with int32_t
+const uint64_t kMaxSerializedBuckets = uint64_t(1) << 31;
+
+// exclusions Deserialize allocates at a time, so a corrupt count fails on
+// the missing data rather than on one huge allocation
+const uint64_t kExclusionReadChunk = uint64_t(1) << 16;
+
+// The bytes left in a seekable stream, or the largest uint64_t if it cannot
+// seek.
+inline uint64_t StreamBytesLeft(std::istream &in) {
+  const std::istream::pos_type here = in.tellg();
+  if (here == std::istream::pos_type(-1)) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  if (!in.seekg(0, std::ios::end)) {
+    in.clear();
+    return std::numeric_limits<uint64_t>::max();
+  }
+  const std::istream::pos_type end = in.tellg();
+  in.seekg(here);
+  return end > here ? uint64_t(end - here) : 0;
+}
+
 // A cuckoo filter class exposes a Bloomier filter interface,
-// providing methods of Add, Delete, Contain. It takes three
+// providing methods of Add, Delete, Contain. It takes five
 // template parameters:
 //   ItemType:  the type of item you want to insert
 //   bits_per_item: how many bits each item is hashed into
+//   HashFamily: the seeded tag hash
 //   TableType: the storage of table, SingleTable by default, and
-// PackedTable to enable semi-sorting
+// PackedTable to enable semi-sorting, MortonTable to store only occupied
+// slots in cache-line blocks
+//   IndexPolicy: maps an item to the value its buckets are derived from,
+// RawIndex by default, MixedIndex for non-uniform items, and LocalIndex to
+// keep both buckets of an item close together (see indexpolicy.h)
 template <typename ItemType, size_t bits_per_item,
           typename HashFamily = TwoIndependentMultiplyShift,
-          template <size_t> class TableType = SingleTable>
-class CuckooFilter {
+          template <size_t> class TableType = SingleTable,
+          typename IndexPolicy = RawIndex>
+class CuckooFilter : private StatsRecorder<CUCKOO_STATS> {
   // Storage of items
   TableType<bits_per_item> *table_;
 
+  // whether table_ views storage the filter does not own (see the view
+  // constructor), which every method that writes tags refuses
+  bool view_ = false;
+
   // Number of items stored
   size_t num_items_;
 
@@ -49,8 +100,17 @@ class CuckooFilter {
 
   HashFamily hasher_;
 
+  IndexPolicy index_;
+
   std::vector<uint16_t> seeds_;
 
+  // second-level exclusion set: items known not to be in the set that match
+  // a tag, with their kExclusionSeed hash, sorted by hash
+  std::vector<std::pair<uint64_t, ItemType>> exclusions_;
+
+  // internal counters, see filterstats.h
+  const StatsRecorder<CUCKOO_STATS> &Recorder() const { return *this; }
+
   template <typename K>
   inline uint64_t Hash(const K &key, uint32_t seed = 0) const {
     return hasher_(key, seed);
@@ -60,7 +120,7 @@ class CuckooFilter {
     // table_->num_buckets is always a power of two, so modulo can be replaced
     // with
     // bitwise-and:
-    const uint32_t hash = item >> 32;
+    const uint32_t hash = index_(item) >> 32;
     return hash & (table_->NumBuckets() - 1);
   }
 
@@ -102,20 +162,16 @@ class CuckooFilter {
     return IndexHash((uint32_t)(index ^ (tag * 0x5bd1e995)));
   }
   */
+  // the index policy decides where the alternate may lie, see indexpolicy.h
   inline size_t AltIndex(const size_t index, const ItemType &item) const {
-    // NOTE(binfan): originally we use:
-    // index ^ HashUtil::BobHash((const void*) (&tag), 4)) & table_->INDEXMASK;
-    // now doing a quick-n-dirty way:
-    // 0x5bd1e995 is the hash constant from MurmurHash2
     const size_t hp = log2(table_->NumBuckets());
-    const size_t fp = (item >> hp) + 1;
-    const size_t hashmask = table_->NumBuckets() - 1;
-    // return IndexHash((uint32_t)(index ^ (item * 0x5bd1e995)));
-    return (index ^ (fp * 0xc6a4a7935bd1e995)) & hashmask;
+    return IndexPolicy::AltIndex(hp, index_(item), index);
   }
 
   Status AddImpl(const size_t i, const uint32_t tag);
 
+  bool Excluded(const ItemType &item) const;
+
   // load factor is the fraction of occupancy
   double LoadFactor() const { return 1.0 * Size() / table_->SizeInTags(); }
 
@@ -132,6 +188,7 @@ class CuckooFilter {
       num_buckets <<= 1;
     }
     victim_.used = false;
+    seeds_.assign(num_buckets, 0);
     table_ = new TableType<bits_per_item>(num_buckets);
   }
 
@@ -156,6 +213,20 @@ class CuckooFilter {
     table_ = new TableType<bits_per_item>(num_buckets);
   }
 
+  // A read-only view of a table kept elsewhere in TableType's layout, such as
+  // cuckoo_hashtable::packed_partials() of a table with the same bits, seeds
+  // and index policy. The storage is not copied and must outlive the filter;
+  // Add, Delete, CopyInsert, PairedInsert, PairedDelete and Compact return
+  // NotSupported, and Deserialize replaces the view with an owned table.
+  CuckooFilter(const char *table, const std::vector<uint16_t> &seeds,
+               const size_t num_items)
+      : num_items_(num_items), victim_(), hasher_() {
+    view_ = true;
+    victim_.used = false;
+    seeds_ = seeds;
+    table_ = new TableType<bits_per_item>(seeds.size(), table);
+  }
+
   ~CuckooFilter() { delete table_; }
 
   // Add an item to the filter.
@@ -164,12 +235,62 @@ class CuckooFilter {
   // Insert item to the filter at given bucket index and slot.
   Status CopyInsert(const uint32_t fp, size_t index, size_t slot);
 
+  // Replays an insert of item into the hashtable this filter mirrors, as
+  // recorded by cuckoo_hashtable::paired_insert in path: the moved tags are
+  // moved in order, then the item's tag is stored where the table put it.
+  // The filter must have been built from the table's current seeds. Returns
+  // NotSupported, with the moves so far applied, if the filter and table
+  // have diverged.
+  template <typename Path>
+  Status PairedInsert(const ItemType &item, const Path &path);
+
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
-  // Delete an key from the filter
+  // The buckets and tags Contain checks for an item. Prefetch computes them
+  // and starts loading both buckets, so a caller querying several filters
+  // can have every bucket in flight before it tests any.
+  struct Probe {
+    size_t i1, i2;
+    uint32_t tag1, tag2;
+  };
+
+  void Prefetch(const ItemType &item, Probe *probe) const;
+
+  // Contain, with the buckets and tags Prefetch computed for item.
+  Status Contain(const ItemType &item, const Probe &probe) const;
+
+  // Adds items known not to be in the set to the exclusion set, which
+  // Contain checks only after a tag matches. It holds the false positives a
+  // build could not eliminate within its seed cap (see
+  // cuckoo_hashtable::spilled()), so it is small.
+  Status Exclude(const ItemType *items, const size_t n);
+
+  // Delete an key from the filter: the item's tag under the seed of
+  // whichever of its buckets holds it.
   Status Delete(const ItemType &item);
 
+  // Replays cuckoo_hashtable::erase on a filter mirroring the table: deletes
+  // the item's tag from the bucket and slot the table erased it from, so
+  // later PairedInserts still find every moved tag where the table has it.
+  Status PairedDelete(const ItemType &item, size_t index, size_t slot);
+
+  // Resets the seed of every bucket without tags to 0, as
+  // cuckoo_hashtable::compact does, and drops the excluded items that no
+  // longer match a tag, storing their number in num_dropped if given.
+  Status Compact(size_t *num_dropped = nullptr);
+
+  // Writes a header, the seeds, the table's bytes and the exclusion set to
+  // out; a view's table bytes are written straight from the viewed storage.
+  // Requires a table with Data(), i.e. SingleTable, and a filter without a
+  // victim (NotSupported).
+  Status Serialize(std::ostream &out) const;
+
+  // Replaces the filter with one written by Serialize. Returns NotSupported,
+  // leaving the filter as it was, if the data is truncated, was written with
+  // other bits per item, or has a bucket count no filter could have.
+  Status Deserialize(std::istream &in);
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -177,17 +298,33 @@ class CuckooFilter {
   // number of current inserted items;
   size_t Size() const { return num_items_; }
 
+  // number of buckets, each with its own seed
+  size_t NumBuckets() const { return seeds_.size(); }
+
   // size of the filter in bytes. TODO: modify to include seeds if used.
   size_t SizeInBytes() const { return table_->SizeInBytes(); }
+
+  // internal counters (recorded only with CUCKOO_STATS=1) and the seed
+  // distribution
+  FilterStats Stats() const {
+    FilterStats s = Recorder().Snapshot();
+    for (size_t i = 0; i < seeds_.size(); i++) {
+      s.seeds[seeds_[i]]++;
+    }
+    return s;
+  }
 };
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Add(
-    const ItemType &item) {
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Add(const ItemType &item) {
   size_t i;
   uint32_t tag;
 
+  if (view_) {
+    return NotSupported;
+  }
   if (victim_.used) {
     return NotEnoughSpace;
   }
@@ -197,9 +334,9 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Add(
 }
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::AddImpl(
-    const size_t i, const uint32_t tag) {
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::AddImpl(const size_t i, const uint32_t tag) {
   size_t curindex = i;
   uint32_t curtag = tag;
   uint32_t oldtag;
@@ -209,6 +346,7 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::AddImpl(
     oldtag = 0;
     if (table_->InsertTagToBucket(curindex, curtag, kickout, oldtag)) {
       num_items_++;
+      Recorder().OnAdd(count, false);
       return Ok;
     }
     if (kickout) {
@@ -220,15 +358,22 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::AddImpl(
   victim_.index = curindex;
   victim_.tag = curtag;
   victim_.used = true;
+  Recorder().OnAdd(kMaxCuckooCount, true);
   return Ok;
 }
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
-    const uint32_t fp, const size_t index, const size_t slot) {
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::CopyInsert(const uint32_t fp,
+                                             const size_t index,
+                                             const size_t slot) {
+  if (view_) {
+    return NotSupported;
+  }
   if (table_->CopyTagToBucket(index, slot, fp)) {
     num_items_++;
+    Recorder().OnCopyInsert();
     // std::cout << "copied " << fp << " to " << index << "\n";
     return Ok;
   }
@@ -236,9 +381,36 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
 }
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
-    const ItemType &key) const {
+          template <size_t> class TableType, typename IndexPolicy>
+template <typename Path>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::PairedInsert(const ItemType &item,
+                                               const Path &path) {
+  if (view_) {
+    return NotSupported;
+  }
+  for (size_t k = 0; k < path.num_moves; k++) {
+    const auto &move = path.moves[k];
+    if (!table_->DeleteTagFromSlot(move.from_bucket, move.from_slot,
+                                   move.from_partial) ||
+        !table_->CopyTagToBucket(move.to_bucket, move.to_slot,
+                                 move.to_partial)) {
+      return NotSupported;
+    }
+  }
+  const uint32_t tag = TagHash(hasher_(item, seeds_.at(path.index)));
+  if (!table_->CopyTagToBucket(path.index, path.slot, tag)) {
+    return NotSupported;
+  }
+  num_items_++;
+  Recorder().OnCopyInsert();
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Contain(const ItemType &key) const {
   bool found = false;
   size_t i1, i2;
   uint32_t tag1, tag2;
@@ -253,6 +425,13 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
   //         (i1 == victim_.index || i2 == victim_.index);
 
   if (table_->FindTagInBuckets(i1, i2, tag1, tag2)) {  // found ||
+    if (!exclusions_.empty() && Excluded(key)) {
+      Recorder().OnContain(2, false);
+      return NotFound;
+    }
+    if (CUCKOO_STATS) {
+      Recorder().OnContain(table_->FindTagInBucket(i1, tag1) ? 1 : 2, true);
+    }
     return Ok;
   } else { // WARNING: only use for checking false negative's (if not, get spammed D:)
    
@@ -268,6 +447,7 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
     // std::cout << "\tseed: " << seeds_.at(i1) << "\n";
     // table_->PrintBucket(i2);
     // std::cout << "\tseed: " << seeds_.at(i2) << "\n";
+    Recorder().OnContain(2, false);
     return NotFound;
   }
    // std::cout << "HV's : [";
@@ -279,23 +459,89 @@ Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
 }
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Delete(
-    const ItemType &key) {
+          template <size_t> class TableType, typename IndexPolicy>
+void CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                  IndexPolicy>::Prefetch(const ItemType &item,
+                                         Probe *probe) const {
+  GenerateTagHashes(item, &probe->i1, &probe->i2, &probe->tag1, &probe->tag2);
+  table_->PrefetchBucket(probe->i1);
+  table_->PrefetchBucket(probe->i2);
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Contain(const ItemType &item,
+                                          const Probe &probe) const {
+  if (!table_->FindTagInBuckets(probe.i1, probe.i2, probe.tag1, probe.tag2) ||
+      (!exclusions_.empty() && Excluded(item))) {
+    Recorder().OnContain(2, false);
+    return NotFound;
+  }
+  if (CUCKOO_STATS) {
+    Recorder().OnContain(table_->FindTagInBucket(probe.i1, probe.tag1) ? 1 : 2,
+                     true);
+  }
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+bool CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                  IndexPolicy>::Excluded(const ItemType &item) const {
+  const uint64_t hash = hasher_(item, kExclusionSeed);
+  auto it = std::lower_bound(
+      exclusions_.begin(), exclusions_.end(), hash,
+      [](const std::pair<uint64_t, ItemType> &e, uint64_t h) {
+        return e.first < h;
+      });
+  for (; it != exclusions_.end() && it->first == hash; ++it) {
+    if (it->second == item) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Exclude(const ItemType *items,
+                                          const size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    exclusions_.emplace_back(hasher_(items[i], kExclusionSeed), items[i]);
+  }
+  std::stable_sort(exclusions_.begin(), exclusions_.end(),
+                   [](const std::pair<uint64_t, ItemType> &a,
+                      const std::pair<uint64_t, ItemType> &b) {
+                     return a.first < b.first;
+                   });
+  exclusions_.erase(std::unique(exclusions_.begin(), exclusions_.end()),
+                    exclusions_.end());
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Delete(const ItemType &key) {
   size_t i1, i2;
-  uint32_t tag;
+  uint32_t tag1, tag2;
 
-  GenerateIndexTagHash(key, &i1, &tag);
-  i2 = AltIndex(i1, tag);
+  if (view_) {
+    return NotSupported;
+  }
+  GenerateTagHashes(key, &i1, &i2, &tag1, &tag2);
 
-  if (table_->DeleteTagFromBucket(i1, tag)) {
+  if (table_->DeleteTagFromBucket(i1, tag1)) {
     num_items_--;
     goto TryEliminateVictim;
-  } else if (table_->DeleteTagFromBucket(i2, tag)) {
+  } else if (table_->DeleteTagFromBucket(i2, tag2)) {
     num_items_--;
     goto TryEliminateVictim;
-  } else if (victim_.used && tag == victim_.tag &&
-             (i1 == victim_.index || i2 == victim_.index)) {
+  } else if (victim_.used &&
+             ((i1 == victim_.index && tag1 == victim_.tag) ||
+              (i2 == victim_.index && tag2 == victim_.tag))) {
     // num_items_--;
     victim_.used = false;
     return Ok;
@@ -313,9 +559,54 @@ TryEliminateVictim:
 }
 
 template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-std::string CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Info()
-    const {
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::PairedDelete(const ItemType &item,
+                                               size_t index, size_t slot) {
+  if (view_) {
+    return NotSupported;
+  }
+  const uint32_t tag = TagHash(hasher_(item, seeds_.at(index)));
+  if (!table_->DeleteTagFromSlot(index, slot, tag)) {
+    return NotFound;
+  }
+  num_items_--;
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Compact(size_t *num_dropped) {
+  if (view_) {
+    return NotSupported;
+  }
+  for (size_t i = 0; i < seeds_.size(); i++) {
+    if (table_->NumTagsInBucket(i) == 0 &&
+        !(victim_.used && victim_.index == i)) {
+      seeds_[i] = 0;
+    }
+  }
+  const size_t before = exclusions_.size();
+  exclusions_.erase(
+      std::remove_if(exclusions_.begin(), exclusions_.end(),
+                     [this](const std::pair<uint64_t, ItemType> &e) {
+                       size_t i1, i2;
+                       uint32_t tag1, tag2;
+                       GenerateTagHashes(e.second, &i1, &i2, &tag1, &tag2);
+                       return !table_->FindTagInBuckets(i1, i2, tag1, tag2);
+                     }),
+      exclusions_.end());
+  if (num_dropped != nullptr) {
+    *num_dropped = before - exclusions_.size();
+  }
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+std::string CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                         IndexPolicy>::Info() const {
   std::stringstream ss;
   ss << "CuckooFilter Status:\n"
      << "\t\t" << table_->Info()
@@ -325,6 +616,9 @@ std::string CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Info()
      << "\t\tKeys stored: " << Size() << "\n"
      << "\t\tLoad factor: " << LoadFactor() << "\n"
      << "\t\tHashtable size: " << (table_->SizeInBytes() >> 10) << " KB\n";
+  if (!exclusions_.empty()) {
+    ss << "\t\tExcluded items: " << exclusions_.size() << "\n";
+  }
   if (Size() > 0) {
     ss << "\t\tbit/key:   " << BitsPerItem() << "\n";
   } else {
@@ -332,5 +626,87 @@ std::string CuckooFilter<ItemType, bits_per_item, HashFamily, TableType>::Info()
   }
   return ss.str();
 }
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Serialize(std::ostream &out) const {
+  if (victim_.used) {
+    return NotSupported;
+  }
+  const uint32_t header[2] = {kSerializedMagic, bits_per_item};
+  const uint64_t counts[2] = {seeds_.size(), num_items_};
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(counts), sizeof(counts));
+  out.write(reinterpret_cast<const char *>(seeds_.data()),
+            seeds_.size() * sizeof(uint16_t));
+  static_assert(std::is_trivially_copyable<ItemType>::value,
+                "the exclusion set is written as bytes");
+  const TableType<bits_per_item> &table = *table_;
+  out.write(table.Data(), table.SizeInBytes());
+  const uint64_t num_exclusions = exclusions_.size();
+  out.write(reinterpret_cast<const char *>(&num_exclusions),
+            sizeof(num_exclusions));
+  for (const auto &e : exclusions_) {
+    out.write(reinterpret_cast<const char *>(&e.second), sizeof(ItemType));
+  }
+  return out ? Ok : NotSupported;
+}
+
+template <typename ItemType, size_t bits_per_item, typename HashFamily,
+          template <size_t> class TableType, typename IndexPolicy>
+Status CuckooFilter<ItemType, bits_per_item, HashFamily, TableType,
+                    IndexPolicy>::Deserialize(std::istream &in) {
+  uint32_t header[2];
+  uint64_t counts[2];
+  in.read(reinterpret_cast<char *>(header), sizeof(header));
+  in.read(reinterpret_cast<char *>(counts), sizeof(counts));
+  if (!in || header[0] != kSerializedMagic || header[1] != bits_per_item) {
+    return NotSupported;
+  }
+  // the bucket count sizes every allocation below, so it must be one a
+  // filter could have, with its seeds present in the stream
+  const uint64_t num_buckets = counts[0];
+  if (num_buckets == 0 || num_buckets > kMaxSerializedBuckets ||
+      (num_buckets & (num_buckets - 1)) != 0 ||
+      num_buckets > StreamBytesLeft(in) / sizeof(uint16_t)) {
+    return NotSupported;
+  }
+  std::vector<uint16_t> seeds(num_buckets);
+  in.read(reinterpret_cast<char *>(seeds.data()),
+          seeds.size() * sizeof(uint16_t));
+  if (!in) {
+    return NotSupported;
+  }
+  TableType<bits_per_item> *table = new TableType<bits_per_item>(num_buckets);
+  in.read(table->Data(), table->SizeInBytes());
+  uint64_t num_exclusions = 0;
+  in.read(reinterpret_cast<char *>(&num_exclusions), sizeof(num_exclusions));
+  if (in && num_exclusions > StreamBytesLeft(in) / sizeof(ItemType)) {
+    in.setstate(std::ios::failbit);
+  }
+  std::vector<ItemType> excluded;
+  for (uint64_t read = 0; in && read < num_exclusions;) {
+    const uint64_t chunk =
+        std::min(num_exclusions - read, kExclusionReadChunk);
+    excluded.resize(read + chunk);
+    in.read(reinterpret_cast<char *>(excluded.data() + read),
+            chunk * sizeof(ItemType));
+    read += chunk;
+  }
+  if (!in) {
+    delete table;
+    return NotSupported;
+  }
+  delete table_;
+  table_ = table;
+  view_ = false;
+  seeds_.swap(seeds);
+  exclusions_.clear();
+  Exclude(excluded.data(), excluded.size());
+  num_items_ = counts[1];
+  victim_.used = false;
+  return Ok;
+}
+
 }  // namespace cuckoofilter
 #endif  // CUCKOO_FILTER_CUCKOO_FILTER_H_
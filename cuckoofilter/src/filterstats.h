@@ -0,0 +1,146 @@
+#ifndef CUCKOO_FILTER_FILTER_STATS_H_
+#define CUCKOO_FILTER_FILTER_STATS_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+// Build with -DCUCKOO_STATS=1 to record internal counters. When left at 0 the
+// recorder is an empty class and every hook compiles away.
+#ifndef CUCKOO_STATS
+#define CUCKOO_STATS 0
+#endif
+
+namespace cuckoofilter {
+
+// Snapshot of the counters of a CuckooFilter, returned by CuckooFilter::Stats.
+struct FilterStats {
+  // kicks per Add, bucketed by log2: [0], [1], [2,3], [4,7], ... [256,511]
+  static const size_t kKickHistogramSize = 10;
+
+  bool enabled;
+
+  uint64_t adds;
+  uint64_t add_failures;  // adds that left an item in the victim cache
+  uint64_t copy_inserts;
+  uint64_t kicks;
+  std::array<uint64_t, kKickHistogramSize> kick_histogram;
+
+  uint64_t contains;
+  uint64_t contain_hits;
+  uint64_t probes;  // buckets read by Contain
+
+  // seed value -> number of buckets using it
+  std::map<uint16_t, uint64_t> seeds;
+
+  FilterStats()
+      : enabled(false),
+        adds(0),
+        add_failures(0),
+        copy_inserts(0),
+        kicks(0),
+        kick_histogram(),
+        contains(0),
+        contain_hits(0),
+        probes(0) {}
+
+  std::string ToJson() const {
+    std::stringstream ss;
+    ss << "{\"enabled\": " << (enabled ? "true" : "false")
+       << ", \"adds\": " << adds << ", \"add_failures\": " << add_failures
+       << ", \"copy_inserts\": " << copy_inserts << ", \"kicks\": " << kicks
+       << ", \"kick_histogram\": [";
+    for (size_t i = 0; i < kKickHistogramSize; i++) {
+      ss << (i ? ", " : "") << kick_histogram[i];
+    }
+    ss << "], \"contains\": " << contains
+       << ", \"contain_hits\": " << contain_hits << ", \"probes\": " << probes
+       << ", \"seeds\": {";
+    bool first = true;
+    for (const auto &k : seeds) {
+      ss << (first ? "" : ", ") << "\"" << k.first << "\": " << k.second;
+      first = false;
+    }
+    ss << "}}";
+    return ss.str();
+  }
+};
+
+// Hooks called by CuckooFilter. The disabled recorder holds no state, and
+// the filter derives from its recorder so that it takes no space. The hooks
+// are const so Contain can record.
+template <bool enabled>
+class StatsRecorder {
+ public:
+  void OnAdd(size_t /* kicks */, bool /* failed */) const {}
+  void OnCopyInsert() const {}
+  void OnContain(size_t /* probes */, bool /* hit */) const {}
+  FilterStats Snapshot() const { return FilterStats(); }
+};
+static_assert(std::is_empty<StatsRecorder<false>>::value,
+              "the disabled recorder must take no space");
+
+// The enabled recorder keeps its counters in relaxed atomics, since Contain
+// records from every thread querying the filter at once.
+template <>
+class StatsRecorder<true> {
+  typedef std::atomic<uint64_t> Counter;
+
+  mutable Counter adds_{0}, add_failures_{0}, copy_inserts_{0}, kicks_{0};
+  mutable std::array<Counter, FilterStats::kKickHistogramSize> kick_histogram_{};
+  mutable Counter contains_{0}, contain_hits_{0}, probes_{0};
+
+  static void Add(Counter &c, uint64_t n) {
+    c.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static uint64_t Load(const Counter &c) {
+    return c.load(std::memory_order_relaxed);
+  }
+
+ public:
+  void OnAdd(size_t kicks, bool failed) const {
+    Add(adds_, 1);
+    Add(add_failures_, failed);
+    Add(kicks_, kicks);
+    size_t bucket = 0;
+    while (kicks > 0 && bucket < FilterStats::kKickHistogramSize - 1) {
+      kicks >>= 1;
+      bucket++;
+    }
+    Add(kick_histogram_[bucket], 1);
+  }
+
+  void OnCopyInsert() const { Add(copy_inserts_, 1); }
+
+  void OnContain(size_t probes, bool hit) const {
+    Add(contains_, 1);
+    Add(contain_hits_, hit);
+    Add(probes_, probes);
+  }
+
+  FilterStats Snapshot() const {
+    FilterStats s;
+    s.enabled = true;
+    s.adds = Load(adds_);
+    s.add_failures = Load(add_failures_);
+    s.copy_inserts = Load(copy_inserts_);
+    s.kicks = Load(kicks_);
+    for (size_t i = 0; i < FilterStats::kKickHistogramSize; i++) {
+      s.kick_histogram[i] = Load(kick_histogram_[i]);
+    }
+    s.contains = Load(contains_);
+    s.contain_hits = Load(contain_hits_);
+    s.probes = Load(probes_);
+    return s;
+  }
+};
+
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_FILTER_STATS_H_
@@ -1,6 +1,17 @@
 // Pulled from lookup3.c by Bob Jenkins
 #include "hashutil.h"
 
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "simddispatch.h"
+
 #define rot(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
 #define mix(a,b,c)                              \
     {                                           \
@@ -763,4 +774,384 @@ std::string HashUtil::SHA1Hash(const char *inbuf, size_t in_length) {
 
   return std::string((char *)md_value, (size_t)md_len);
 }
+
+std::string HashUtil::CertKey(const std::string &issuer_spki_hash,
+                              const std::string &serial) {
+  std::string key;
+  key.reserve(issuer_spki_hash.size() + 1 + serial.size());
+  key.append(issuer_spki_hash);
+  key.push_back(static_cast<char>(serial.size()));
+  key.append(serial);
+  return key;
+}
+
+void HashUtil::Digest128Batch(const std::string *keys, size_t n,
+                              Digest128 *out) {
+  EVP_MD_CTX *mdctx;
+  unsigned char md_value[EVP_MAX_MD_SIZE];
+  unsigned int md_len;
+
+  mdctx = EVP_MD_CTX_new();
+  for (size_t i = 0; i < n; i++) {
+    EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL);
+    EVP_DigestUpdate(mdctx, (const void *)keys[i].data(), keys[i].size());
+    EVP_DigestFinal_ex(mdctx, md_value, &md_len);
+    memcpy(&out[i].hi, md_value, sizeof(uint64_t));
+    memcpy(&out[i].lo, md_value + sizeof(uint64_t), sizeof(uint64_t));
+  }
+  EVP_MD_CTX_free(mdctx);
+}
+
+// SHA-256 batch hashing. The scalar engine is portable; the SHA-NI and AVX2
+// engines are compiled with target attributes so this file needs no special
+// flags, and are only called after a CPUID check.
+namespace {
+
+const uint32_t kSHA256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t kSHA256Init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                 0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                 0x1f83d9ab, 0x5be0cd19};
+
+const size_t kSHA256BlockSize = 64;
+const size_t kSHA256DigestSize = 32;
+
+inline uint32_t LoadBE32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline void StoreBE32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+inline uint32_t Rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+// Builds the padded final block(s) of a message of len bytes into tail and
+// returns how many there are (1 or 2).
+size_t SHA256Tail(const uint8_t *msg, size_t len, uint8_t tail[128]) {
+  const size_t rem = len % kSHA256BlockSize;
+  const size_t blocks = rem < 56 ? 1 : 2;
+  memcpy(tail, msg + len - rem, rem);
+  tail[rem] = 0x80;
+  memset(tail + rem + 1, 0, blocks * kSHA256BlockSize - rem - 1);
+  const uint64_t bits = static_cast<uint64_t>(len) * 8;
+  for (int i = 0; i < 8; i++) {
+    tail[blocks * kSHA256BlockSize - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+  return blocks;
+}
+
+void SHA256CompressScalar(uint32_t state[8], const uint8_t *data,
+                          size_t nblocks) {
+  uint32_t w[64];
+  for (; nblocks > 0; nblocks--, data += kSHA256BlockSize) {
+    for (int t = 0; t < 16; t++) {
+      w[t] = LoadBE32(data + 4 * t);
+    }
+    for (int t = 16; t < 64; t++) {
+      const uint32_t s0 =
+          Rotr32(w[t - 15], 7) ^ Rotr32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+      const uint32_t s1 =
+          Rotr32(w[t - 2], 17) ^ Rotr32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+      w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int t = 0; t < 64; t++) {
+      const uint32_t t1 = h + (Rotr32(e, 6) ^ Rotr32(e, 11) ^ Rotr32(e, 25)) +
+                          ((e & f) ^ (~e & g)) + kSHA256K[t] + w[t];
+      const uint32_t t2 = (Rotr32(a, 2) ^ Rotr32(a, 13) ^ Rotr32(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+bool CpuidLeaf7(uint32_t *ebx) {
+  uint32_t eax, ecx, edx;
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, eax, *ebx, ecx, edx);
+  return true;
+}
+
+bool CpuHasShaNi() {
+  uint32_t eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  const bool ssse3 = ecx & (1u << 9), sse41 = ecx & (1u << 19);
+  return ssse3 && sse41 && CpuidLeaf7(&ebx) && (ebx & (1u << 29));
+}
+
+bool CpuHasAvx2() {
+  uint32_t eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 27))) {
+    return false;  // no OSXSAVE
+  }
+  uint32_t xcr0, xcr0_hi;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+  if ((xcr0 & 6) != 6) {
+    return false;  // OS does not save YMM state
+  }
+  return CpuidLeaf7(&ebx) && (ebx & (1u << 5));
+}
+
+__attribute__((target("sha,sse4.1"))) void SHA256CompressShaNi(
+    uint32_t state[8], const uint8_t *data, size_t nblocks) {
+  const __m128i kMask =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // state is kept as ABEF and CDGH, the layout sha256rnds2 expects
+  __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0]));
+  __m128i state1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4]));
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);          // CDAB
+  state1 = _mm_shuffle_epi32(state1, 0x1B);    // EFGH
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+
+  for (; nblocks > 0; nblocks--, data += kSHA256BlockSize) {
+    const __m128i abef = state0, cdgh = state1;
+    __m128i w[4];
+#pragma GCC unroll 16
+    for (int g = 0; g < 16; g++) {
+      if (g < 4) {
+        w[g] = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * g)),
+            kMask);
+      } else {
+        // W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16], four at a time
+        __m128i x = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+        x = _mm_add_epi32(x, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+        w[g & 3] = _mm_sha256msg2_epu32(x, w[(g + 3) & 3]);
+      }
+      __m128i msg = _mm_add_epi32(
+          w[g & 3],
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(&kSHA256K[4 * g])));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      msg = _mm_shuffle_epi32(msg, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);           // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xB1);        // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);     // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);        // ABEF
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+}
+
+#define SHA256_ROTR8(x, n) \
+  _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+// Hashes eight messages of len bytes each, one per 32-bit lane.
+__attribute__((target("avx2"))) void SHA256Batch8Avx2(
+    const uint8_t *const msgs[8], size_t len, uint8_t *const digests[8]) {
+  const size_t full = len / kSHA256BlockSize;
+  uint8_t tails[8][128];
+  size_t tail_blocks = 0;
+  for (int l = 0; l < 8; l++) {
+    tail_blocks = SHA256Tail(msgs[l], len, tails[l]);
+  }
+
+  __m256i state[8];
+  for (int i = 0; i < 8; i++) {
+    state[i] = _mm256_set1_epi32(kSHA256Init[i]);
+  }
+
+  alignas(32) uint32_t lanes[16][8];
+  __m256i w[64];
+  for (size_t block = 0; block < full + tail_blocks; block++) {
+    for (int l = 0; l < 8; l++) {
+      const uint8_t *p = block < full
+                             ? msgs[l] + block * kSHA256BlockSize
+                             : tails[l] + (block - full) * kSHA256BlockSize;
+      for (int t = 0; t < 16; t++) {
+        lanes[t][l] = LoadBE32(p + 4 * t);
+      }
+    }
+    for (int t = 0; t < 16; t++) {
+      w[t] = _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes[t]));
+    }
+    for (int t = 16; t < 64; t++) {
+      const __m256i s0 = _mm256_xor_si256(
+          _mm256_xor_si256(SHA256_ROTR8(w[t - 15], 7), SHA256_ROTR8(w[t - 15], 18)),
+          _mm256_srli_epi32(w[t - 15], 3));
+      const __m256i s1 = _mm256_xor_si256(
+          _mm256_xor_si256(SHA256_ROTR8(w[t - 2], 17), SHA256_ROTR8(w[t - 2], 19)),
+          _mm256_srli_epi32(w[t - 2], 10));
+      w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0),
+                              _mm256_add_epi32(w[t - 7], s1));
+    }
+
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int t = 0; t < 64; t++) {
+      const __m256i ch =
+          _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+      const __m256i big_s1 = _mm256_xor_si256(
+          _mm256_xor_si256(SHA256_ROTR8(e, 6), SHA256_ROTR8(e, 11)),
+          SHA256_ROTR8(e, 25));
+      const __m256i t1 = _mm256_add_epi32(
+          _mm256_add_epi32(_mm256_add_epi32(h, big_s1), ch),
+          _mm256_add_epi32(_mm256_set1_epi32(kSHA256K[t]), w[t]));
+      const __m256i maj = _mm256_xor_si256(
+          _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+          _mm256_and_si256(b, c));
+      const __m256i big_s0 = _mm256_xor_si256(
+          _mm256_xor_si256(SHA256_ROTR8(a, 2), SHA256_ROTR8(a, 13)),
+          SHA256_ROTR8(a, 22));
+      h = g;
+      g = f;
+      f = e;
+      e = _mm256_add_epi32(d, t1);
+      d = c;
+      c = b;
+      b = a;
+      a = _mm256_add_epi32(t1, _mm256_add_epi32(big_s0, maj));
+    }
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+    state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g);
+    state[7] = _mm256_add_epi32(state[7], h);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[i]), state[i]);
+  }
+  for (int l = 0; l < 8; l++) {
+    if (digests[l] == NULL) {
+      continue;
+    }
+    for (int i = 0; i < 8; i++) {
+      StoreBE32(digests[l] + 4 * i, lanes[i][l]);
+    }
+  }
+}
+
+#undef SHA256_ROTR8
+
+#else
+
+bool CpuHasShaNi() { return false; }
+bool CpuHasAvx2() { return false; }
+
+#endif  // x86
+
+// Hashes each input on its own with a single-buffer compression function.
+template <void (*Compress)(uint32_t *, const uint8_t *, size_t)>
+void SHA256Each(const uint8_t *in, size_t in_length, size_t n, uint8_t *out) {
+  uint8_t tail[128];
+  for (size_t i = 0; i < n; i++, in += in_length, out += kSHA256DigestSize) {
+    uint32_t state[8];
+    memcpy(state, kSHA256Init, sizeof(state));
+    Compress(state, in, in_length / kSHA256BlockSize);
+    Compress(state, tail, SHA256Tail(in, in_length, tail));
+    for (int j = 0; j < 8; j++) {
+      StoreBE32(out + 4 * j, state[j]);
+    }
+  }
+}
+
+}  // namespace
+
+bool HashUtil::SHA256EngineSupported(SHA256Engine engine) {
+  switch (engine) {
+    case kSHA256Auto:
+    case kSHA256Scalar:
+      return true;
+    case kSHA256ShaNi:
+      return CpuHasShaNi();
+    case kSHA256Avx2:
+      return CpuHasAvx2();
+  }
+  return false;
+}
+
+bool HashUtil::SHA256Batch(const void *in, size_t in_length, size_t n,
+                           uint8_t *out, SHA256Engine engine) {
+  static const bool has_sha_ni = CpuHasShaNi();
+  static const bool has_avx2 = CpuHasAvx2();
+  if (engine == kSHA256Auto) {
+    // SHA-NI is a 128-bit extension, so it counts as the SSE4.2 tier.
+    const SimdLevel level = ActiveSimdLevel();
+    engine = has_sha_ni && level >= kSimdSse42 ? kSHA256ShaNi
+             : has_avx2 && level >= kSimdAvx2  ? kSHA256Avx2
+                                               : kSHA256Scalar;
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(in);
+  switch (engine) {
+    case kSHA256Scalar:
+      SHA256Each<SHA256CompressScalar>(bytes, in_length, n, out);
+      return true;
+#if defined(__x86_64__) || defined(__i386__)
+    case kSHA256ShaNi:
+      if (!has_sha_ni) {
+        return false;
+      }
+      SHA256Each<SHA256CompressShaNi>(bytes, in_length, n, out);
+      return true;
+    case kSHA256Avx2:
+      if (!has_avx2) {
+        return false;
+      }
+      for (size_t i = 0; i < n; i += 8) {
+        // short final group: repeat the last input and drop its digests
+        const uint8_t *msgs[8];
+        uint8_t *digests[8];
+        for (size_t l = 0; l < 8; l++) {
+          const size_t j = std::min(i + l, n - 1);
+          msgs[l] = bytes + j * in_length;
+          digests[l] = i + l < n ? out + j * kSHA256DigestSize : NULL;
+        }
+        SHA256Batch8Avx2(msgs, in_length, digests);
+      }
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
 }  // namespace cuckoofilter
@@ -12,6 +12,38 @@
 
 namespace cuckoofilter {
 
+// Fixed-size digest that a variable-length key (e.g. issuer SPKI hash plus
+// DER serial) is reduced to once at ingest. Tables and filters store, index
+// and rehash the digest, never the original bytes.
+struct Digest128 {
+  uint64_t hi;
+  uint64_t lo;
+
+  bool operator==(const Digest128 &other) const {
+    return hi == other.hi && lo == other.lo;
+  }
+  bool operator!=(const Digest128 &other) const { return !(*this == other); }
+};
+
+// Bits an index policy derives buckets from (see indexpolicy.h). Found by
+// argument-dependent lookup from both the filter and the hashtable.
+inline uint64_t index_bits(const Digest128 &d) { return d.hi; }
+
+// Seeded hash of a Digest128 for tags and fingerprints. The digest is
+// already uniform, so the low half is only remixed with the seed; the high
+// half is left to indexing.
+struct Digest128Hash {
+  uint64_t operator()(const Digest128 &d, uint32_t seed = 0) const {
+    uint64_t k = d.lo ^ (static_cast<uint64_t>(seed) * 0x9e3779b97f4a7c15ULL);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+};
+
 class HashUtil {
  public:
   // Bob Jenkins Hash
@@ -40,6 +72,37 @@ class HashUtil {
   static std::string MD5Hash(const char *inbuf, size_t in_length);
   static std::string SHA1Hash(const char *inbuf, size_t in_length);
 
+  // Concatenates an issuer SPKI hash and a DER serial into one key. The
+  // serial is prefixed with its length so distinct pairs never collide; DER
+  // serials are at most 20 octets (RFC 5280), so one length byte suffices.
+  static std::string CertKey(const std::string &issuer_spki_hash,
+                             const std::string &serial);
+
+  // Reduces n variable-length keys to Digest128s (SHA-256 truncated to 128
+  // bits). One digest context is reused for the whole batch.
+  static void Digest128Batch(const std::string *keys, size_t n,
+                             Digest128 *out);
+
+  // Implementations of SHA256Batch. kSHA256Auto picks the fastest one the
+  // CPU supports within ActiveSimdLevel() (simddispatch.h): SHA-NI, then
+  // 8-lane AVX2 multi-buffer, then scalar.
+  enum SHA256Engine {
+    kSHA256Auto = 0,
+    kSHA256Scalar = 1,
+    kSHA256ShaNi = 2,
+    kSHA256Avx2 = 3,
+  };
+
+  // Whether the CPU (and OS) can run the given engine.
+  static bool SHA256EngineSupported(SHA256Engine engine);
+
+  // Hashes n inputs of in_length bytes each, stored back to back in in, and
+  // writes the n 32-byte SHA-256 digests back to back to out. Nothing is
+  // allocated per input. Returns false, leaving out untouched, if the engine
+  // is not supported.
+  static bool SHA256Batch(const void *in, size_t in_length, size_t n,
+                          uint8_t *out, SHA256Engine engine = kSHA256Auto);
+
  private:
   HashUtil();
 };
@@ -64,6 +127,11 @@ class TwoIndependentMultiplyShift {
   uint64_t operator()(uint64_t key) const {
     return (add_ + multiply_ * static_cast<decltype(multiply_)>(key)) >> 64;
   }
+
+  // Seeded hash for per-bucket rehashing. Seed 0 is the unseeded hash.
+  uint64_t operator()(uint64_t key, uint32_t seed) const {
+    return (*this)(key ^ (static_cast<uint64_t>(seed) * 0x9e3779b97f4a7c15ULL));
+  }
 };
 
 // See Patrascu and Thorup's "The Power of Simple Tabulation Hashing"
@@ -87,6 +155,11 @@ class SimpleTabulation {
     }
     return result;
   }
+
+  // Seeded hash for per-bucket rehashing. Seed 0 is the unseeded hash.
+  uint64_t operator()(uint64_t key, uint32_t seed) const {
+    return (*this)(key ^ (static_cast<uint64_t>(seed) * 0x9e3779b97f4a7c15ULL));
+  }
 };
 }
 
@@ -0,0 +1,73 @@
+#ifndef CUCKOO_FILTER_INDEX_POLICY_H_
+#define CUCKOO_FILTER_INDEX_POLICY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cuckoofilter {
+
+// An index policy maps an item to the 64-bit value its buckets are derived
+// from: IndexHash takes the high 32 bits, and the policy's static
+// AltIndex(hp, bits, index) gives the alternate bucket (an involution for
+// fixed bits). A filter filled from a cuckoohashtable by CopyInsert must use
+// the policy matching the table's (cuckoohashtable/hashtable/indexpolicy.hh).
+//
+// Policies read an item through index_bits(item), which is the item itself
+// for integers. Other item types (e.g. Digest128 in hashutil.h) provide an
+// overload found by argument-dependent lookup.
+
+inline uint64_t index_bits(uint64_t item) { return item; }
+
+// The alternate may be anywhere in the table: the index xor a multiple of the
+// bits above the hashpower.
+struct WholeTableAlternate {
+  static uint64_t AltIndex(size_t hp, uint64_t bits, uint64_t index) {
+    // 0xc6a4a7935bd1e995 is the hash constant from 64-bit MurmurHash2
+    const uint64_t fp = (bits >> hp) + 1;
+    return (index ^ (fp * 0xc6a4a7935bd1e995ULL)) & ((1ULL << hp) - 1);
+  }
+};
+
+// Uses the item as is. Only balanced for uniformly random 64-bit items.
+struct RawIndex : WholeTableAlternate {
+  template <typename ItemType>
+  uint64_t operator()(const ItemType &item) const {
+    return index_bits(item);
+  }
+};
+
+// Mixes the item with the MurmurHash3 64-bit finalizer so that sequential
+// items, or items sharing their high bits, still spread over all buckets.
+struct MixedIndex : WholeTableAlternate {
+  template <typename ItemType>
+  uint64_t operator()(const ItemType &item) const {
+    uint64_t k = index_bits(item);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+};
+
+// Takes the first bucket from Base but keeps the alternate in the same aligned
+// chunk of 2^alt_range_bits buckets, so a lookup touches one small region
+// rather than two random ones. Same as the hashtable's local_index_policy.
+template <typename Base = MixedIndex, size_t alt_range_bits = 8>
+struct LocalIndex : Base {
+  static uint64_t AltIndex(size_t hp, uint64_t bits, uint64_t index) {
+    const size_t range = hp < alt_range_bits ? hp : alt_range_bits;
+    if (range == 0) {
+      return index;
+    }
+    // from the low 32 bits, which IndexHash never uses; never zero
+    const uint64_t offset =
+        (static_cast<uint32_t>(bits) * 0xc6a4a7935bd1e995ULL) >> (64 - range);
+    return index ^ (offset + (offset == 0));
+  }
+};
+
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_INDEX_POLICY_H_
@@ -0,0 +1,321 @@
+#ifndef CUCKOO_FILTER_MORTON_TABLE_H_
+#define CUCKOO_FILTER_MORTON_TABLE_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <unordered_map>
+
+#include "debug.h"
+#include "printutil.h"
+
+namespace cuckoofilter {
+
+// A block table in the spirit of Morton filters (Breslow and Jayasena,
+// "Morton Filters: Faster, Space-Efficient Cuckoo Filters via Biasing,
+// Compression, and Decoupled Logical Sparsity"). Buckets still hold up to 4
+// tags, but only occupied slots take space: each 64-byte block serves
+// kBucketsPerBlock buckets and stores
+//
+//   - a fullness counter array: a 3-bit tag count per bucket,
+//   - an overflow bit, set once a tag of the block had to be spilled,
+//   - a fingerprint storage array: the tags of all its buckets back to back,
+//     bucket by bucket, so a bucket's tags start after the counts of the
+//     buckets before it.
+//
+// A block has room for about 3 tags per bucket, so blocks are ~25% smaller
+// than SingleTable's buckets at the same tag size. A tag that finds its block
+// full while its bucket has fewer than 4 tags is spilled to a side table and
+// the block's overflow bit is set. Lookups in a block without it touch only
+// that cache line per bucket.
+//
+// Bucket placement comes from the hashtable the filter is copied from, so
+// tags cannot be moved to a less loaded bucket as Morton filters do, and
+// spills grow quickly past ~70% load. With 12-bit tags the table is smaller
+// than SingleTable up to ~76% load (14.5 vs 17.1 bits/key at 70%) and larger
+// above it. The power-of-two bucket count leaves many shipped filters there.
+// LocalIndex with a small alt_range_bits keeps both buckets of most keys in
+// one block, so most negative lookups read a single cache line.
+//
+// Slot positions within a bucket are not kept: CopyTagToBucket ignores the
+// slot, as PackedTable does.
+template <size_t bits_per_tag>
+class MortonTable {
+  static const size_t kTagsPerBucket = 4;
+  static const size_t kBlockBytes = 64;
+  static const size_t kCounterBits = 3;
+  static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
+  // 3 tag slots and a counter per bucket, with counters and overflow bit in
+  // the first 64 bits
+  static const size_t kBucketsPerBlock =
+      (kBlockBytes * 8 - 1) / (kCounterBits + 3 * bits_per_tag) < 21
+          ? (kBlockBytes * 8 - 1) / (kCounterBits + 3 * bits_per_tag)
+          : 21;
+  static const size_t kOverflowBit = kCounterBits * kBucketsPerBlock;
+  static const size_t kHeaderBits = kOverflowBit + 1;
+  static const size_t kSlotsPerBlock =
+      (kBlockBytes * 8 - kHeaderBits) / bits_per_tag;
+  // counted for each spilled tag in SizeInBytes
+  static const size_t kSpillBytes = 8;
+
+  static_assert(bits_per_tag >= 2 && bits_per_tag <= 32,
+                "tags are read with one 64-bit load");
+
+  char *blocks_;
+  size_t num_buckets_;
+  size_t num_blocks_;
+  // tags that did not fit their block, by bucket
+  std::unordered_multimap<size_t, uint32_t> spill_;
+
+  static inline uint64_t Load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline void Store64(char *p, const uint64_t v) {
+    memcpy(p, &v, sizeof(v));
+  }
+
+  inline char *Block(const size_t i) {
+    return blocks_ + (i / kBucketsPerBlock) * kBlockBytes;
+  }
+
+  inline const char *Block(const size_t i) const {
+    return blocks_ + (i / kBucketsPerBlock) * kBlockBytes;
+  }
+
+  static inline size_t Count(const uint64_t header, const size_t b) {
+    return (header >> (kCounterBits * b)) & 7;
+  }
+
+  // number of tags stored for the buckets before b
+  static inline size_t Prefix(const uint64_t header, const size_t b) {
+    const uint64_t ones = 0x1249249249249249ULL;  // bit 0 of each counter
+    const uint64_t x = header & ((1ULL << (kCounterBits * b)) - 1);
+    return __builtin_popcountll(x & ones) +
+           2 * __builtin_popcountll(x & (ones << 1)) +
+           4 * __builtin_popcountll(x & (ones << 2));
+  }
+
+  static inline bool Overflowed(const uint64_t header) {
+    return (header >> kOverflowBit) & 1;
+  }
+
+  static inline uint32_t ReadSlot(const char *block, const size_t k) {
+    const size_t bit = kHeaderBits + k * bits_per_tag;
+    return (Load64(block + bit / 8) >> (bit % 8)) & kTagMask;
+  }
+
+  static inline void WriteSlot(char *block, const size_t k, const uint32_t tag) {
+    const size_t bit = kHeaderBits + k * bits_per_tag;
+    uint64_t v = Load64(block + bit / 8);
+    v &= ~(static_cast<uint64_t>(kTagMask) << (bit % 8));
+    v |= static_cast<uint64_t>(tag & kTagMask) << (bit % 8);
+    Store64(block + bit / 8, v);
+  }
+
+  inline size_t NumSpilledInBucket(const size_t i) const {
+    return Overflowed(Load64(Block(i))) ? spill_.count(i) : 0;
+  }
+
+  // adds tag to bucket i, in its block if there is room
+  void StoreTag(const size_t i, const uint32_t tag) {
+    char *block = Block(i);
+    const size_t b = i % kBucketsPerBlock;
+    uint64_t header = Load64(block);
+    const size_t total = Prefix(header, kBucketsPerBlock);
+    if (total == kSlotsPerBlock) {
+      spill_.emplace(i, tag);
+      Store64(block, Load64(block) | (1ULL << kOverflowBit));
+      return;
+    }
+    // shift the tags of the following buckets up by one slot
+    const size_t pos = Prefix(header, b) + Count(header, b);
+    for (size_t k = total; k > pos; k--) {
+      WriteSlot(block, k, ReadSlot(block, k - 1));
+    }
+    WriteSlot(block, pos, tag);
+    // reload: the header word also holds the first slots
+    header = Load64(block) + (1ULL << (kCounterBits * b));
+    Store64(block, header);
+  }
+
+  // removes the tag at slot k of the block holding bucket i
+  void RemoveSlot(const size_t i, const size_t k) {
+    char *block = Block(i);
+    const size_t b = i % kBucketsPerBlock;
+    const size_t total = Prefix(Load64(block), kBucketsPerBlock);
+    for (size_t m = k; m + 1 < total; m++) {
+      WriteSlot(block, m, ReadSlot(block, m + 1));
+    }
+    WriteSlot(block, total - 1, 0);
+    Store64(block, Load64(block) - (1ULL << (kCounterBits * b)));
+  }
+
+ public:
+  explicit MortonTable(const size_t num) : num_buckets_(num) {
+    num_blocks_ = (num_buckets_ + kBucketsPerBlock - 1) / kBucketsPerBlock;
+    // NOTE: 8 extra bytes as tags are read with a uint64 load
+    const size_t len = num_blocks_ * kBlockBytes + 8;
+    if (posix_memalign(reinterpret_cast<void **>(&blocks_), kBlockBytes, len)) {
+      throw std::bad_alloc();
+    }
+    memset(blocks_, 0, len);
+  }
+
+  ~MortonTable() { free(blocks_); }
+
+  size_t NumBuckets() const { return num_buckets_; }
+
+  size_t SizeInBytes() const {
+    return kBlockBytes * num_blocks_ + kSpillBytes * spill_.size();
+  }
+
+  size_t SizeInTags() const { return kTagsPerBucket * num_buckets_; }
+
+  // number of tags kept outside their block
+  size_t NumSpilled() const { return spill_.size(); }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "MortonTable with tag size: " << bits_per_tag << " bits \n";
+    ss << "\t\tAssociativity: " << kTagsPerBucket << "\n";
+    ss << "\t\tBuckets per " << kBlockBytes << "-byte block: "
+       << kBucketsPerBlock << ", tag slots per block: " << kSlotsPerBlock
+       << "\n";
+    ss << "\t\tTotal # of rows (buckets): " << num_buckets_ << "\n";
+    ss << "\t\tTotal # of blocks: " << num_blocks_ << "\n";
+    ss << "\t\tSpilled tags: " << spill_.size() << "\n";
+    return ss.str();
+  }
+
+  void PrintBucket(const size_t i) const {
+    const char *block = Block(i);
+    const size_t b = i % kBucketsPerBlock;
+    const uint64_t header = Load64(block);
+    const size_t start = Prefix(header, b);
+    std::cout << "Bucket " << i << ": [ ";
+    for (size_t k = start; k < start + Count(header, b); k++) {
+      std::cout << ReadSlot(block, k) << " ";
+    }
+    if (Overflowed(header)) {
+      auto range = spill_.equal_range(i);
+      for (auto it = range.first; it != range.second; ++it) {
+        std::cout << it->second << "* ";
+      }
+    }
+    std::cout << "]\t";
+  }
+
+  // starts loading the block holding bucket i into cache ahead of a
+  // FindTagInBuckets
+  inline void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(Block(i));
+  }
+
+  inline bool FindTagInBuckets(const size_t i1, const size_t i2,
+                               const uint32_t tag1, const uint32_t tag2) const {
+    return FindTagInBucket(i1, tag1) || FindTagInBucket(i2, tag2);
+  }
+
+  inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
+    const char *block = Block(i);
+    const size_t b = i % kBucketsPerBlock;
+    const uint64_t header = Load64(block);
+    const size_t start = Prefix(header, b);
+    const size_t end = start + Count(header, b);
+    for (size_t k = start; k < end; k++) {
+      if (ReadSlot(block, k) == tag) {
+        return true;
+      }
+    }
+    if (Overflowed(header)) {
+      auto range = spill_.equal_range(i);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == tag) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  inline size_t NumTagsInBucket(const size_t i) const {
+    return Count(Load64(Block(i)), i % kBucketsPerBlock) +
+           NumSpilledInBucket(i);
+  }
+
+  // The overflow bit stays set after spilled tags are deleted.
+  bool DeleteTagFromBucket(const size_t i, const uint32_t tag) {
+    const char *block = Block(i);
+    const size_t b = i % kBucketsPerBlock;
+    const uint64_t header = Load64(block);
+    const size_t start = Prefix(header, b);
+    for (size_t k = start; k < start + Count(header, b); k++) {
+      if (ReadSlot(block, k) == tag) {
+        RemoveSlot(i, k);
+        return true;
+      }
+    }
+    if (Overflowed(header)) {
+      auto range = spill_.equal_range(i);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == tag) {
+          spill_.erase(it);
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // slots are not kept, so any copy of tag in bucket i stands for slot j
+  bool DeleteTagFromSlot(const size_t i, const size_t /* j */,
+                         const uint32_t tag) {
+    return DeleteTagFromBucket(i, tag);
+  }
+
+  // copies tag into bucket i; the slot is not kept
+  bool CopyTagToBucket(const size_t i, const size_t /* j */,
+                       const uint32_t tag) {
+    if (NumTagsInBucket(i) == kTagsPerBucket) {
+      return false;
+    }
+    StoreTag(i, tag);
+    return true;
+  }
+
+  bool InsertTagToBucket(const size_t i, const uint32_t tag,
+                         const bool kickout, uint32_t &oldtag) {
+    if (NumTagsInBucket(i) < kTagsPerBucket) {
+      StoreTag(i, tag);
+      return true;
+    }
+    if (kickout) {
+      const char *block = Block(i);
+      const size_t b = i % kBucketsPerBlock;
+      const uint64_t header = Load64(block);
+      const size_t count = Count(header, b);
+      const size_t r = rand() % kTagsPerBucket;
+      if (r < count) {
+        const size_t k = Prefix(header, b) + r;
+        oldtag = ReadSlot(block, k);
+        WriteSlot(Block(i), k, tag);
+      } else {
+        auto it = spill_.equal_range(i).first;
+        std::advance(it, r - count);
+        oldtag = it->second;
+        it->second = tag;
+      }
+    }
+    return false;
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_MORTON_TABLE_H_
@@ -307,12 +307,22 @@ class PackedTable {
     DPRINTF(DEBUG_TABLE, "PackedTable::WriteBucket done\n");
   }
 
-  bool FindTagInBuckets(const size_t i1, const size_t i2,
-                        const uint32_t tag) const {
+  // starts loading bucket i into cache ahead of a FindTagInBuckets
+  void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(buckets_ + kBitsPerBucket * i / 8);
+  }
+
+  bool FindTagInBuckets(const size_t i1, const size_t i2, const uint32_t tag1,
+                        const uint32_t tag2) const {
     //            DPRINTF(DEBUG_TABLE, "PackedTable::FindTagInBucket %zu\n", i);
     uint32_t tags1[4];
     uint32_t tags2[4];
 
+    // the unpacking below is the 13-bit layout of ReadBucket
+    if (bits_per_tag != 13) {
+      return FindTagInBucket(i1, tag1) || FindTagInBucket(i2, tag2);
+    }
+
     // disable for now
     // _mm_prefetch( buckets_ + (i1 * kBitsPerBucket) / 8,  _MM_HINT_NTA);
     // _mm_prefetch( buckets_ + (i2 * kBitsPerBucket) / 8,  _MM_HINT_NTA);
@@ -345,9 +355,9 @@ class PackedTable {
     tags2[1] |= ((v >> 8) & 0x000f);
     tags2[3] |= ((v >> 12) & 0x000f);
 
-    return (tags1[0] == tag) || (tags1[1] == tag) || (tags1[2] == tag) ||
-           (tags1[3] == tag) || (tags2[0] == tag) || (tags2[1] == tag) ||
-           (tags2[2] == tag) || (tags2[3] == tag);
+    return (tags1[0] == tag1) || (tags1[1] == tag1) || (tags1[2] == tag1) ||
+           (tags1[3] == tag1) || (tags2[0] == tag2) || (tags2[1] == tag2) ||
+           (tags2[2] == tag2) || (tags2[3] == tag2);
   }
 
   bool FindTagInBucket(const size_t i, const uint32_t tag) const {
@@ -380,6 +390,28 @@ class PackedTable {
     return false;
   }  // DeleteTagFromBucket
 
+  // Buckets are kept sorted, so any copy of tag in bucket i stands for slot j.
+  bool DeleteTagFromSlot(const size_t i, const size_t /* j */,
+                         const uint32_t tag) {
+    return DeleteTagFromBucket(i, tag);
+  }
+
+  // copies tag into bucket i. Buckets are kept sorted, so the tag lands in
+  // whichever slot its order gives it rather than slot j.
+  bool CopyTagToBucket(const size_t i, const size_t /* j */,
+                       const uint32_t tag) {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    for (size_t j = 0; j < 4; j++) {
+      if (tags[j] == 0) {
+        tags[j] = tag;
+        WriteBucket(i, tags);
+        return true;
+      }
+    }
+    return false;
+  }
+
   bool InsertTagToBucket(const size_t i, const uint32_t tag, const bool kickout,
                          uint32_t &oldtag) {
     DPRINTF(DEBUG_TABLE, "PackedTable::InsertTagToBucket %zu \n", i);
@@ -426,15 +458,11 @@ class PackedTable {
     return false;
   }
 
-  // inline size_t NumTagsInBucket(const size_t i) {
-  //     size_t num = 0;
-  //     for (size_t j = 0; j < tags_per_bucket; j++ ){
-  //         if (ReadTag(i, j) != 0) {
-  //             num ++;
-  //         }
-  //     }
-  //     return num;
-  // } // NumTagsInBucket
+  size_t NumTagsInBucket(const size_t i) const {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    return (tags[0] != 0) + (tags[1] != 0) + (tags[2] != 0) + (tags[3] != 0);
+  }  // NumTagsInBucket
 
 };  // PackedTable
 }  // namespace cuckoofilter
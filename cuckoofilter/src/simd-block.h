@@ -9,6 +9,10 @@
 //
 // 2. The number of bits set per Add() is contant in order to take advantage of SIMD
 // instructions.
+//
+// The AVX2 code is selected at construction from cuckoofilter::ActiveSimdLevel() (see
+// simddispatch.h) and carries a target attribute, so it needs no -mavx2. Without AVX2
+// the same bits are set and tested one lane at a time.
 
 #pragma once
 
@@ -21,6 +25,7 @@
 #include <immintrin.h>
 
 #include "hashutil.h"
+#include "simddispatch.h"
 
 using uint32_t = ::std::uint32_t;
 using uint64_t = ::std::uint64_t;
@@ -49,6 +54,9 @@ class SimdBlockFilter {
 
   HashFamily hasher_;
 
+  // Whether to use the AVX2 code:
+  const bool avx2_;
+
  public:
   // Consumes at most (1 << log_heap_space) bytes on the heap:
   explicit SimdBlockFilter(const int log_heap_space);
@@ -56,17 +64,48 @@ class SimdBlockFilter {
     : log_num_buckets_(that.log_num_buckets_),
       directory_mask_(that.directory_mask_),
       directory_(that.directory_),
-      hasher_(that.hasher_) {}
+      hasher_(that.hasher_),
+      avx2_(that.avx2_) {
+    that.directory_ = nullptr;
+  }
   ~SimdBlockFilter() noexcept;
   void Add(const uint64_t key) noexcept;
   bool Find(const uint64_t key) const noexcept;
+  // Batched Add()/Find(): each group of kBatchSize keys is hashed and its buckets
+  // prefetched before any of them is touched, so the cache misses overlap.
+  // FindBatch() stores each result in found, if not null, and returns how many
+  // keys were found.
+  void AddBatch(const uint64_t* keys, size_t n) noexcept;
+  size_t FindBatch(const uint64_t* keys, size_t n, bool* found = nullptr) const noexcept;
   uint64_t SizeInBytes() const { return sizeof(Bucket) * (1ull << log_num_buckets_); }
 
+  // Keys hashed and prefetched ahead in AddBatch()/FindBatch():
+  static constexpr size_t kBatchSize = 16;
+
  private:
   // A helper function for Insert()/Find(). Turns a 32-bit hash into a 256-bit Bucket
   // with 1 single 1-bit set in each 32-bit lane.
   static __m256i MakeMask(const uint32_t hash) noexcept;
 
+  // Odd contants for hashing:
+  static constexpr uint32_t kRehash[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU,
+      0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+  // Add()/Find() of a key hashed to 'hash', with and without AVX2:
+  void AddHashAvx2(const uint64_t hash) noexcept;
+  bool FindHashAvx2(const uint64_t hash) const noexcept;
+  void AddHashScalar(const uint64_t hash) noexcept;
+  bool FindHashScalar(const uint64_t hash) const noexcept;
+
+  void AddBatchAvx2(const uint64_t* keys, size_t n) noexcept;
+  size_t FindBatchAvx2(const uint64_t* keys, size_t n, bool* found) const noexcept;
+
+  // Hashes count keys into hashes and prefetches their buckets, for writing if
+  // 'rw' is 1:
+  template <int rw>
+  void HashAndPrefetch(const uint64_t* keys, size_t count, uint64_t* hashes) const
+      noexcept;
+
   SimdBlockFilter(const SimdBlockFilter&) = delete;
   void operator=(const SimdBlockFilter&) = delete;
 };
@@ -80,10 +119,8 @@ SimdBlockFilter<HashFamily>::SimdBlockFilter(const int log_heap_space)
     // too large.
     directory_mask_((1ull << ::std::min(63, log_num_buckets_)) - 1),
     directory_(nullptr),
-    hasher_() {
-  if (!__builtin_cpu_supports("avx2")) {
-    throw ::std::runtime_error("SimdBlockFilter does not work without AVX2 instructions");
-  }
+    hasher_(),
+    avx2_(::cuckoofilter::ActiveSimdLevel() >= ::cuckoofilter::kSimdAvx2) {
   const size_t alloc_size = 1ull << (log_num_buckets_ + LOG_BUCKET_BYTE_SIZE);
   const int malloc_failed =
       posix_memalign(reinterpret_cast<void**>(&directory_), 64, alloc_size);
@@ -97,15 +134,17 @@ SimdBlockFilter<HashFamily>::~SimdBlockFilter() noexcept {
   directory_ = nullptr;
 }
 
+template <typename HashFamily>
+constexpr uint32_t SimdBlockFilter<HashFamily>::kRehash[8];
+
 // The SIMD reinterpret_casts technically violate C++'s strict aliasing rules. However, we
 // compile with -fno-strict-aliasing.
 template <typename HashFamily>
-[[gnu::always_inline]] inline __m256i
+[[gnu::always_inline, gnu::target("avx2")]] inline __m256i
 SimdBlockFilter<HashFamily>::MakeMask(const uint32_t hash) noexcept {
   const __m256i ones = _mm256_set1_epi32(1);
-  // Odd contants for hashing:
-  const __m256i rehash = _mm256_setr_epi32(0x47b6137bU, 0x44974d91U, 0x8824ad5bU,
-      0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U);
+  const __m256i rehash =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kRehash));
   // Load hash into a YMM register, repeated eight times
   __m256i hash_data = _mm256_set1_epi32(hash);
   // Multiply-shift hashing ala Dietzfelbinger et al.: multiply 'hash' by eight different
@@ -117,9 +156,8 @@ SimdBlockFilter<HashFamily>::MakeMask(const uint32_t hash) noexcept {
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline void
-SimdBlockFilter<HashFamily>::Add(const uint64_t key) noexcept {
-  const auto hash = hasher_(key);
+[[gnu::target("avx2")]] inline void
+SimdBlockFilter<HashFamily>::AddHashAvx2(const uint64_t hash) noexcept {
   const uint32_t bucket_idx = hash & directory_mask_;
   const __m256i mask = MakeMask(hash >> log_num_buckets_);
   __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[bucket_idx];
@@ -127,9 +165,8 @@ SimdBlockFilter<HashFamily>::Add(const uint64_t key) noexcept {
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline bool
-SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
-  const auto hash = hasher_(key);
+[[gnu::target("avx2")]] inline bool
+SimdBlockFilter<HashFamily>::FindHashAvx2(const uint64_t hash) const noexcept {
   const uint32_t bucket_idx = hash & directory_mask_;
   const __m256i mask = MakeMask(hash >> log_num_buckets_);
   const __m256i bucket = reinterpret_cast<__m256i*>(directory_)[bucket_idx];
@@ -139,3 +176,114 @@ SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
   // 'mask' is one. testc returns 1 if the result is 0 everywhere and returns 0 otherwise.
   return _mm256_testc_si256(bucket, mask);
 }
+
+// The scalar versions compute MakeMask() one 32-bit lane at a time.
+template <typename HashFamily>
+inline void SimdBlockFilter<HashFamily>::AddHashScalar(const uint64_t hash) noexcept {
+  uint32_t* const bucket = directory_[hash & directory_mask_];
+  const uint32_t h = hash >> log_num_buckets_;
+  for (int i = 0; i < 8; ++i) {
+    bucket[i] |= 1U << ((kRehash[i] * h) >> 27);
+  }
+}
+
+template <typename HashFamily>
+inline bool SimdBlockFilter<HashFamily>::FindHashScalar(const uint64_t hash) const
+    noexcept {
+  const uint32_t* const bucket = directory_[hash & directory_mask_];
+  const uint32_t h = hash >> log_num_buckets_;
+  for (int i = 0; i < 8; ++i) {
+    if (!(bucket[i] & (1U << ((kRehash[i] * h) >> 27)))) return false;
+  }
+  return true;
+}
+
+template <typename HashFamily>
+inline void SimdBlockFilter<HashFamily>::Add(const uint64_t key) noexcept {
+  const auto hash = hasher_(key);
+  if (avx2_) {
+    AddHashAvx2(hash);
+  } else {
+    AddHashScalar(hash);
+  }
+}
+
+template <typename HashFamily>
+inline bool SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
+  const auto hash = hasher_(key);
+  return avx2_ ? FindHashAvx2(hash) : FindHashScalar(hash);
+}
+
+template <typename HashFamily>
+template <int rw>
+[[gnu::always_inline]] inline void SimdBlockFilter<HashFamily>::HashAndPrefetch(
+    const uint64_t* keys, size_t count, uint64_t* hashes) const noexcept {
+  for (size_t i = 0; i < count; ++i) {
+    hashes[i] = hasher_(keys[i]);
+    __builtin_prefetch(&directory_[hashes[i] & directory_mask_], rw);
+  }
+}
+
+template <typename HashFamily>
+[[gnu::target("avx2")]] void SimdBlockFilter<HashFamily>::AddBatchAvx2(
+    const uint64_t* keys, size_t n) noexcept {
+  uint64_t hashes[kBatchSize];
+  for (size_t begin = 0; begin < n; begin += kBatchSize) {
+    const size_t count = ::std::min(kBatchSize, n - begin);
+    HashAndPrefetch<1>(keys + begin, count, hashes);
+    for (size_t i = 0; i < count; ++i) {
+      AddHashAvx2(hashes[i]);
+    }
+  }
+}
+
+template <typename HashFamily>
+[[gnu::target("avx2")]] size_t SimdBlockFilter<HashFamily>::FindBatchAvx2(
+    const uint64_t* keys, size_t n, bool* found) const noexcept {
+  uint64_t hashes[kBatchSize];
+  size_t hits = 0;
+  for (size_t begin = 0; begin < n; begin += kBatchSize) {
+    const size_t count = ::std::min(kBatchSize, n - begin);
+    HashAndPrefetch<0>(keys + begin, count, hashes);
+    for (size_t i = 0; i < count; ++i) {
+      const bool hit = FindHashAvx2(hashes[i]);
+      hits += hit;
+      if (found) found[begin + i] = hit;
+    }
+  }
+  return hits;
+}
+
+template <typename HashFamily>
+void SimdBlockFilter<HashFamily>::AddBatch(const uint64_t* keys, size_t n) noexcept {
+  if (avx2_) {
+    AddBatchAvx2(keys, n);
+    return;
+  }
+  uint64_t hashes[kBatchSize];
+  for (size_t begin = 0; begin < n; begin += kBatchSize) {
+    const size_t count = ::std::min(kBatchSize, n - begin);
+    HashAndPrefetch<1>(keys + begin, count, hashes);
+    for (size_t i = 0; i < count; ++i) {
+      AddHashScalar(hashes[i]);
+    }
+  }
+}
+
+template <typename HashFamily>
+size_t SimdBlockFilter<HashFamily>::FindBatch(
+    const uint64_t* keys, size_t n, bool* found) const noexcept {
+  if (avx2_) return FindBatchAvx2(keys, n, found);
+  uint64_t hashes[kBatchSize];
+  size_t hits = 0;
+  for (size_t begin = 0; begin < n; begin += kBatchSize) {
+    const size_t count = ::std::min(kBatchSize, n - begin);
+    HashAndPrefetch<0>(keys + begin, count, hashes);
+    for (size_t i = 0; i < count; ++i) {
+      const bool hit = FindHashScalar(hashes[i]);
+      hits += hit;
+      if (found) found[begin + i] = hit;
+    }
+  }
+  return hits;
+}
@@ -0,0 +1,84 @@
+#ifndef CUCKOO_FILTER_SIMD_DISPATCH_H_
+#define CUCKOO_FILTER_SIMD_DISPATCH_H_
+
+#include <string.h>
+
+namespace cuckoofilter {
+
+// Instruction set tiers with a SIMD kernel somewhere in the library. Each
+// tier implies the ones before it.
+//
+// Nothing is compiled with -m flags for these: kernels that need a tier carry
+// a target attribute, and callers pick one at run time from ActiveSimdLevel(),
+// so one build runs on any x86-64 host. Every tier computes the same result as
+// the scalar code, so filters built on one host answer identically on another.
+//
+// Current kernels:
+//   kSimdSse42   SingleTable::FindTagInBuckets for 8, 12 and 16-bit tags
+//                and the hashtable's bucket_container::match_partials
+//   kSimdAvx2    SimdBlockFilter, and the 8-way SHA-256 of HashUtil::SHA256Batch
+//   kSimdAvx512  SimdBlockFilter512
+enum SimdLevel {
+  kSimdScalar = 0,
+  kSimdSse42,
+  kSimdAvx2,
+  kSimdAvx512,
+};
+
+inline const char *SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case kSimdSse42:
+      return "sse4.2";
+    case kSimdAvx2:
+      return "avx2";
+    case kSimdAvx512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
+
+// Parses a SimdLevelName(). Returns false for anything else.
+inline bool ParseSimdLevel(const char *name, SimdLevel *level) {
+  for (int l = kSimdScalar; l <= kSimdAvx512; l++) {
+    if (strcmp(name, SimdLevelName(static_cast<SimdLevel>(l))) == 0) {
+      *level = static_cast<SimdLevel>(l);
+      return true;
+    }
+  }
+  return false;
+}
+
+// The highest tier this CPU supports.
+inline SimdLevel DetectSimdLevel() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return kSimdAvx512;
+  if (__builtin_cpu_supports("avx2")) return kSimdAvx2;
+  if (__builtin_cpu_supports("sse4.2")) return kSimdSse42;
+#endif
+  return kSimdScalar;
+}
+
+namespace internal {
+inline SimdLevel &SimdLevelSetting() {
+  static SimdLevel level = DetectSimdLevel();
+  return level;
+}
+}  // namespace internal
+
+// The tier kernels should use: DetectSimdLevel() unless lowered by
+// LimitSimdLevel().
+inline SimdLevel ActiveSimdLevel() { return internal::SimdLevelSetting(); }
+
+// Lowers the active tier to at most level, e.g. to compare tiers on one host.
+// Tables and filters read the tier when they are constructed, so call this
+// before creating them. Not thread-safe.
+inline void LimitSimdLevel(SimdLevel level) {
+  SimdLevel &active = internal::SimdLevelSetting();
+  if (level < active) active = level;
+}
+
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_SIMD_DISPATCH_H_
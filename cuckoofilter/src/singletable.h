@@ -5,9 +5,14 @@
 
 #include <sstream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "bitsutil.h"
 #include "debug.h"
 #include "printutil.h"
+#include "simddispatch.h"
 
 namespace cuckoofilter {
 
@@ -30,19 +35,51 @@ class SingleTable {
   // using a pointer adds one more indirection
   Bucket *buckets_;
   size_t num_buckets_;
+  // false for a view of buckets stored elsewhere, which is never written
+  bool owns_buckets_;
+
+  // whether FindTagInBuckets uses FindTagInBucketsSse42, see simddispatch.h
+  bool sse42_probe_;
 
  public:
-  explicit SingleTable(const size_t num) : num_buckets_(num) {
+  explicit SingleTable(const size_t num)
+      : num_buckets_(num), owns_buckets_(true) {
+    sse42_probe_ = ActiveSimdLevel() >= kSimdSse42 && kTagsPerBucket == 4 &&
+                   (bits_per_tag == 8 || bits_per_tag == 12 ||
+                    bits_per_tag == 16);
     buckets_ = new Bucket[num_buckets_ + kPaddingBuckets];
     memset(buckets_, 0, kBytesPerBucket * (num_buckets_ + kPaddingBuckets));
   }
 
-  ~SingleTable() { delete[] buckets_; }
+  // A read-only view of num buckets in this layout at data, which must stay
+  // valid and be followed by at least 7 readable bytes. The const is cast
+  // away only to share buckets_; CuckooFilter refuses every write to a view.
+  SingleTable(const size_t num, const char *data)
+      : num_buckets_(num), owns_buckets_(false) {
+    sse42_probe_ = ActiveSimdLevel() >= kSimdSse42 && kTagsPerBucket == 4 &&
+                   (bits_per_tag == 8 || bits_per_tag == 12 ||
+                    bits_per_tag == 16);
+    buckets_ = reinterpret_cast<Bucket *>(const_cast<char *>(data));
+  }
+
+  ~SingleTable() {
+    if (owns_buckets_) {
+      delete[] buckets_;
+    }
+  }
 
   size_t NumBuckets() const { return num_buckets_; }
 
   size_t SizeInBytes() const { return kBytesPerBucket * num_buckets_; }
 
+  // the SizeInBytes() bytes of all buckets
+  const char *Data() const { return buckets_[0].bits_; }
+
+  char *Data() {
+    assert(owns_buckets_);
+    return buckets_[0].bits_;
+  }
+
   size_t SizeInTags() const { return kTagsPerBucket * num_buckets_; }
 
   std::string Info() const {
@@ -95,6 +132,7 @@ class SingleTable {
 
   // write tag to pos(i,j)
   inline void WriteTag(const size_t i, const size_t j, const uint32_t t) {
+    assert(owns_buckets_);
     char *p = buckets_[i].bits_;
     uint32_t tag = t & kTagMask;
     /* following code only works for little-endian */
@@ -127,8 +165,18 @@ class SingleTable {
     }
   }
 
+  // starts loading bucket i into cache ahead of a FindTagInBuckets
+  inline void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(&buckets_[i]);
+  }
+
   inline bool FindTagInBuckets(const size_t i1, const size_t i2,
                                const uint32_t tag1, const uint32_t tag2) const {
+#if defined(__x86_64__) || defined(__i386__)
+    if (sse42_probe_) {
+      return FindTagInBucketsSse42(i1, i2, tag1, tag2);
+    }
+#endif
     return FindTagInBucket(i1, tag1) || FindTagInBucket(i2, tag2);
 
     // const char *p1 = buckets_[i1].bits_;
@@ -156,6 +204,34 @@ class SingleTable {
     // }
   }
 
+#if defined(__x86_64__) || defined(__i386__)
+  // Both buckets are loaded into one register and spread out to one tag per
+  // 16-bit lane, so all eight slots are compared at once. Only for 8, 12 and
+  // 16-bit tags; the 8-byte loads rely on the padding buckets.
+  __attribute__((target("sse4.2"))) bool FindTagInBucketsSse42(
+      const size_t i1, const size_t i2, const uint32_t tag1,
+      const uint32_t tag2) const {
+    const __m128i v = _mm_unpacklo_epi64(
+        _mm_loadl_epi64((const __m128i *)buckets_[i1].bits_),
+        _mm_loadl_epi64((const __m128i *)buckets_[i2].bits_));
+    __m128i lanes = v;
+    if (bits_per_tag == 8) {
+      lanes = _mm_shuffle_epi8(v, _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 8,
+                                                -1, 9, -1, 10, -1, 11, -1));
+    } else if (bits_per_tag == 12) {
+      // slot j starts at bit 12 * j: even slots are the low 12 bits of the
+      // 16 bits at byte 3j/2, odd slots the high 12 bits
+      lanes = _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 8, 9,
+                                                9, 10, 11, 12, 12, 13));
+      lanes = _mm_blend_epi16(_mm_and_si128(lanes, _mm_set1_epi16(0x0fff)),
+                              _mm_srli_epi16(lanes, 4), 0xaa);
+    }
+    const __m128i tags = _mm_unpacklo_epi64(_mm_set1_epi16(tag1),
+                                            _mm_set1_epi16(tag2));
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(lanes, tags)) != 0;
+  }
+#endif
+
   inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
     // caution: unaligned access & assuming little endian
     if (bits_per_tag == 4 && kTagsPerBucket == 4) {
@@ -195,6 +271,17 @@ class SingleTable {
     return false;
   }
 
+  // deletes tag only if it is in slot j, so a bucket holding the same tag
+  // twice keeps the copy in the other slot
+  inline bool DeleteTagFromSlot(const size_t i, const size_t j,
+                                const uint32_t tag) {
+    if (ReadTag(i, j) == tag) {
+      WriteTag(i, j, 0);
+      return true;
+    }
+    return false;
+  }
+
   inline bool PairedInsertTagToBucket(const size_t i, const size_t j,
                                       const uint32_t tag,
                                       const bool kickout = false,
@@ -1,3 +1,6 @@
+#ifndef CITY_HASHER_HH
+#define CITY_HASHER_HH
+
 #include "city.cc"
 #include <string>
 
@@ -22,3 +25,5 @@ public:
     }
 };
  *  std::string. */
+
+#endif // CITY_HASHER_HH
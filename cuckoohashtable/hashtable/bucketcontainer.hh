@@ -5,10 +5,19 @@
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "../../cuckoofilter/src/simddispatch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace cuckoohashtable
 {
@@ -20,11 +29,21 @@ namespace cuckoohashtable
      * @tparam Allocaator - type of key allocator
      * @tparam Partial - type of fingerprint/partial keys
      * @tparam SLOT_PER_BUCKET - number of slots for each bucket in the table
+     * @tparam BITS_PER_PARTIAL - bits kept of each partial key
+     *
+     * Partial keys are not kept in the buckets but in one bit-packed array,
+     * BITS_PER_PARTIAL bits per slot and a whole number of bytes per bucket,
+     * the layout of cuckoofilter::SingleTable. The array is therefore
+     * already a filter: see packed_partials().
      */
 
-    template <class Key, class Allocator, class Partial, std::size_t SLOT_PER_BUCKET>
+    template <class Key, class Allocator, class Partial, std::size_t SLOT_PER_BUCKET,
+              std::size_t BITS_PER_PARTIAL>
     class bucket_container
     {
+        static_assert(BITS_PER_PARTIAL >= 1 && BITS_PER_PARTIAL <= 8 * sizeof(Partial) && BITS_PER_PARTIAL <= 32,
+                      "partials must fit in Partial and in 32 bits");
+
     public:
         using key_type = Key;
 
@@ -60,9 +79,6 @@ namespace cuckoohashtable
                 return *static_cast<key_type *>(static_cast<void *>(&keys_[ind]));
             }
 
-            partial_t partial(size_type ind) const { return partials_[ind]; }
-            partial_t &partial(size_type ind) { return partials_[ind]; }
-
             bool occupied(size_type ind) const { return occupied_[ind]; }
             bool &occupied(size_type ind) { return occupied_[ind]; }
 
@@ -86,12 +102,13 @@ namespace cuckoohashtable
                                                      alignof(storage_key_type)>::type,
                        SLOT_PER_BUCKET>
                 keys_;
-            std::array<partial_t, SLOT_PER_BUCKET> partials_;
             std::array<bool, SLOT_PER_BUCKET> occupied_;
         };
 
         bucket_container(size_type hp, const allocator_type &allocator) : allocator_(allocator), bucket_allocator_(allocator),
-                                                                          hashpower_(hp), buckets_(bucket_allocator_.allocate(size()))
+                                                                          hashpower_(hp), buckets_(bucket_allocator_.allocate(size())),
+                                                                          partials_(size() * PARTIAL_BYTES_PER_BUCKET + PARTIAL_PADDING_BYTES),
+                                                                          sse42_match_(detect_sse42_match())
         {
             // The bucket default constructor is nothrow, so we don't have to
             // worry about dealing with exceptions when constructing all the
@@ -124,6 +141,50 @@ namespace cuckoohashtable
         bucket &operator[](size_type i) { return buckets_[i]; }
         const bucket &operator[](size_type i) const { return buckets_[i]; }
 
+        // the partial key in a slot, 0 if the slot is empty
+        partial_t partial(size_type ind, size_type slot) const
+        {
+            const size_type bit = slot * BITS_PER_PARTIAL;
+            uint64_t v;
+            std::memcpy(&v, &partials_[ind * PARTIAL_BYTES_PER_BUCKET + bit / 8], sizeof(v));
+            return static_cast<partial_t>((v >> (bit % 8)) & PARTIAL_MASK);
+        }
+
+        /**
+         * match_partials compares the partials of two buckets at once: bit k of
+         * the result is set if slot k of bucket i1 holds p1, and bit
+         * SLOT_PER_BUCKET + k if slot k of bucket i2 holds p2. Empty slots hold
+         * 0, so they never match a partial key.
+         *
+         * With 4 slots and 8, 12 or 16-bit partials, and SSE4.2 within
+         * cuckoofilter::ActiveSimdLevel() when the container is constructed,
+         * both buckets are spread into one register and compared in one
+         * instruction.
+         */
+        unsigned match_partials(size_type i1, size_type i2, partial_t p1, partial_t p2) const
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            if (sse42_match_)
+                return match_partials_sse42(i1, i2, p1, p2);
+#endif
+            unsigned mask = 0;
+            for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
+            {
+                mask |= unsigned(partial(i1, j) == p1) << j;
+                mask |= unsigned(partial(i2, j) == p2) << (SLOT_PER_BUCKET + j);
+            }
+            return mask;
+        }
+
+        // The packed partials of all buckets: packed_partials_bytes() bytes,
+        // followed by padding so the last bucket can be read with a 64-bit load.
+        // Each bucket's partials are hashed with its own seed, so the seeds are
+        // needed to query it.
+        const char *packed_partials() const { return partials_.data(); }
+        char *packed_partials() { return partials_.data(); }
+
+        size_type packed_partials_bytes() const { return size() * PARTIAL_BYTES_PER_BUCKET; }
+
         void info() const
         {
             // std::cout << "BucketContainer status:\n"
@@ -151,7 +212,7 @@ namespace cuckoohashtable
             for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
             {
                 if (b.occupied(j))
-                    std::cout << b.partial(j);
+                    std::cout << partial(i, j);
                 else
                     std::cout << " ";
 
@@ -187,7 +248,7 @@ namespace cuckoohashtable
                     if (b.occupied(j))
                     {
                         if (arg == "fp")
-                            std::cout << b.partial(j);
+                            std::cout << partial(i, j);
                         else
                             std::cout << b.key(j);
                     }
@@ -210,7 +271,7 @@ namespace cuckoohashtable
         {
             bucket &b = buckets_[ind];
             assert(!b.occupied(slot));
-            b.partial(slot) = p;
+            set_partial(ind, slot, p);
             traits_::construct(allocator_, std::addressof(b.storage_key(slot)), std::forward<K>(k));
             // This must occur last, to enforce a strong exception guarantee
             b.occupied(slot) = true;
@@ -223,6 +284,7 @@ namespace cuckoohashtable
             bucket &b = buckets_[ind];
             assert(b.occupied(slot));
             b.occupied(slot) = false;
+            set_partial(ind, slot, 0);
             traits_::destroy(allocator_, std::addressof(b.storage_key(slot)));
         }
 
@@ -230,7 +292,7 @@ namespace cuckoohashtable
         void setFP(size_type ind, size_type slot, partial_t p)
         {
             bucket &b = buckets_[ind];
-            b.partial(slot) = p;
+            set_partial(ind, slot, p);
             b.occupied(slot) = true;
             // std::cout << "finished adding rehashed " << p << " to bucket in slot " << slot << " & index " << ind << "\n";
         }
@@ -262,10 +324,82 @@ namespace cuckoohashtable
             destroy_buckets();
         }
 
+        // Exchanges the buckets, partials and hashpower of two containers,
+        // without touching any key. Like the rest of the container, not safe
+        // against concurrent access.
+        void swap(bucket_container &other) noexcept
+        {
+            using std::swap;
+            swap(allocator_, other.allocator_);
+            swap(bucket_allocator_, other.bucket_allocator_);
+            const size_type hp = hashpower();
+            hashpower(other.hashpower());
+            other.hashpower(hp);
+            swap(buckets_, other.buckets_);
+            partials_.swap(other.partials_);
+            swap(sse42_match_, other.sse42_match_);
+        }
+
     private:
         using bucket_traits_ = typename traits_::template rebind_traits<bucket>;
         using bucket_pointer = typename bucket_traits_::pointer;
 
+        static constexpr size_type PARTIAL_BYTES_PER_BUCKET = (BITS_PER_PARTIAL * SLOT_PER_BUCKET + 7) / 8;
+        static constexpr size_type PARTIAL_PADDING_BYTES = 7;
+        static constexpr uint64_t PARTIAL_MASK = (uint64_t(1) << BITS_PER_PARTIAL) - 1;
+
+        // Writes only the bytes the slot spans, which lie inside its bucket, so
+        // threads may set partials of different buckets at once.
+        void set_partial(size_type ind, size_type slot, partial_t p)
+        {
+            const size_type bit = slot * BITS_PER_PARTIAL;
+            char *const bytes = &partials_[ind * PARTIAL_BYTES_PER_BUCKET + bit / 8];
+            const size_type span = (bit % 8 + BITS_PER_PARTIAL + 7) / 8;
+            uint64_t v = 0;
+            std::memcpy(&v, bytes, span);
+            v &= ~(PARTIAL_MASK << (bit % 8));
+            v |= (uint64_t(p) & PARTIAL_MASK) << (bit % 8);
+            std::memcpy(bytes, &v, span);
+        }
+
+        static bool detect_sse42_match()
+        {
+            if (SLOT_PER_BUCKET != 4 || (BITS_PER_PARTIAL != 8 && BITS_PER_PARTIAL != 12 && BITS_PER_PARTIAL != 16))
+                return false;
+            // the tier the filter's SingleTable uses, so LimitSimdLevel lowers both
+            return cuckoofilter::ActiveSimdLevel() >= cuckoofilter::kSimdSse42;
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        // The same spread as cuckoofilter::SingleTable::FindTagInBucketsSse42:
+        // one partial per 16-bit lane, bucket i1 in the low half. The 8-byte
+        // loads rely on the padding after the last bucket.
+        __attribute__((target("sse4.2"))) unsigned match_partials_sse42(size_type i1, size_type i2,
+                                                                       partial_t p1, partial_t p2) const
+        {
+            const __m128i v = _mm_unpacklo_epi64(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&partials_[i1 * PARTIAL_BYTES_PER_BUCKET])),
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&partials_[i2 * PARTIAL_BYTES_PER_BUCKET])));
+            __m128i lanes = v;
+            if (BITS_PER_PARTIAL == 8)
+            {
+                lanes = _mm_shuffle_epi8(v, _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 8, -1, 9, -1, 10, -1, 11, -1));
+            }
+            else if (BITS_PER_PARTIAL == 12)
+            {
+                // even slots are the low 12 bits of the 16 bits at byte 3j/2, odd
+                // slots the high 12 bits
+                lanes = _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 8, 9, 9, 10, 11, 12, 12, 13));
+                lanes = _mm_blend_epi16(_mm_and_si128(lanes, _mm_set1_epi16(0x0fff)), _mm_srli_epi16(lanes, 4), 0xaa);
+            }
+            const __m128i partials = _mm_unpacklo_epi64(_mm_set1_epi16(static_cast<short>(p1)),
+                                                        _mm_set1_epi16(static_cast<short>(p2)));
+            const __m128i eq = _mm_cmpeq_epi16(lanes, partials);
+            // one byte, and so one mask bit, per slot
+            return static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128())));
+        }
+#endif
+
         void destroy_buckets() noexcept
         {
             if (buckets_ == nullptr)
@@ -301,6 +435,10 @@ namespace cuckoohashtable
         // These buckets are protected by striped locks (external to the
         // BucketContainer), which must be obtained before accessing a bucket.
         bucket_pointer buckets_;
+        // the partial keys of all buckets, see partial()
+        std::vector<char> partials_;
+        // whether match_partials uses match_partials_sse42
+        bool sse42_match_;
     };
 } // namespace cuckoohashtable
 
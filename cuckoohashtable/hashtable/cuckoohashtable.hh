@@ -8,6 +8,7 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <iterator>
@@ -24,22 +25,33 @@
 #include <bits/stdc++.h>
 
 #include "bucketcontainer.hh"
+#include "indexpolicy.hh"
+#include "keysource.hh"
+#include "tablestats.hh"
 
 // #include "../city_hasher.hh"
 
+// find compares partial keys before full keys (see cuckoo_find). Build with
+// -DCUCKOO_PARTIAL_FIRST_FIND=0 to compare the key of every occupied slot
+// instead, which skips hashing the key under the bucket seeds.
+#ifndef CUCKOO_PARTIAL_FIRST_FIND
+#define CUCKOO_PARTIAL_FIRST_FIND 1
+#endif
+
 namespace cuckoohashtable
 {
 
     template <class Key, std::size_t bits_per_key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>,
-              class Allocator = std::allocator<Key>, std::size_t SLOT_PER_BUCKET = 4>
-    class cuckoo_hashtable
+              class Allocator = std::allocator<Key>, std::size_t SLOT_PER_BUCKET = 4,
+              class KeySource = identity_key_source, class IndexPolicy = raw_index_policy>
+    class cuckoo_hashtable : private stats_recorder<CUCKOO_STATS>
     {
 
     private:
         // Type of the fingerprint/partial key. TODO: make it configurable
         using partial_t = uint32_t;
         // Type of the buckets container
-        using buckets_t = bucket_container<Key, Allocator, partial_t, SLOT_PER_BUCKET>;
+        using buckets_t = bucket_container<Key, Allocator, partial_t, SLOT_PER_BUCKET, bits_per_key>;
         size_t num_items_;
 
     public:
@@ -53,9 +65,38 @@ namespace cuckoohashtable
         using const_reference = typename buckets_t::const_reference;
         using pointer = typename buckets_t::pointer;
         using const_pointer = typename buckets_t::const_pointer;
+        using key_source = KeySource;
+        using index_policy = IndexPolicy;
+        // the key that is hashed and compared; key_type is what a slot stores
+        using source_key_type = typename std::decay<decltype(
+            std::declval<const KeySource &>()(std::declval<const key_type &>()))>::type;
 
         static constexpr uint16_t slot_per_bucket() { return SLOT_PER_BUCKET; }
 
+        // The maximum number of items in a cuckoo BFS path. It determines the
+        // maximum number of slots we search when cuckooing.
+        static constexpr uint8_t MAX_BFS_PATH_LEN = 5;
+
+        // cuckoo_move records one key moved along a cuckoo path, with its
+        // partial under the seed of the bucket it left and the one it entered.
+        struct cuckoo_move
+        {
+            size_type from_bucket, from_slot;
+            size_type to_bucket, to_slot;
+            partial_t from_partial, to_partial;
+        };
+
+        // paired_path is filled by paired_insert: the moves made to free a
+        // slot, in the order they were made, and the new key's position. The
+        // caller owns it and reuses it across inserts, so recording a path
+        // allocates nothing.
+        struct paired_path
+        {
+            size_type num_moves;
+            std::array<cuckoo_move, MAX_BFS_PATH_LEN> moves;
+            size_type index, slot;
+        };
+
         /**
      * Creates a new cuckoohashtable instance
      * 
@@ -63,10 +104,13 @@ namespace cuckoohashtable
      * @param hf - hash function instance to use
      * @param equal - equality function instance to use
      * @param alloc ? 
+     * @param ks - maps stored keys to the keys that are hashed, see keysource.hh
      */
         cuckoo_hashtable(size_type n = (1U << 16) * 4, const Hash &hf = Hash(),
-                         const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator()) : num_items_(0), hash_fn_(hf), eq_fn_(equal),
-                                                                                                     buckets_(reserve_calc(n), alloc), seeds_(bucket_count()), num_lookup_rds_(0) {}
+                         const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator(),
+                         const KeySource &ks = KeySource()) : num_items_(0), hash_fn_(hf), eq_fn_(equal), key_source_(ks),
+                                                              buckets_(reserve_calc(n), alloc), seeds_(bucket_count()), num_lookup_rds_(0), num_elimination_passes_(0),
+                                                              rehash_pending_(false), max_seed_(std::numeric_limits<uint16_t>::max()) {}
 
         /**
      * Copy constructor
@@ -87,6 +131,13 @@ namespace cuckoohashtable
      */
         key_equal key_eq() const { return eq_fn_; }
 
+        /**
+     * Returns the function that maps stored keys to the keys that are hashed
+     *
+     * @return the key source
+     */
+        key_source get_key_source() const { return key_source_; }
+
         /**
    * Returns the allocator associated with the map
    *
@@ -162,23 +213,45 @@ namespace cuckoohashtable
             buckets_.info();
         }
 
-        // bucket seeds info
+        // bucket seeds info: adds the number of buckets with each seed to
+        // seed_map
         void seedInfo(std::map<uint16_t, uint16_t> &seed_map) const
         {
             // can use unordered map to track quantity of each rehash count (e.g. lots of 1's, less 2's, etc.)
-            // std::cout << "Bucket Seed Info:\n";
             for (size_t i = 0; i < bucket_count(); i++)
             {
                 // printSeed(i);
                 seed_map[seeds_.at(i)]++;
             }
-            std::cout << "rehashing seed map:\n(key : value) = # rehashes : # buckets\n";
-            for (auto &k : seed_map)
-            {
-                std::cout << "{" << k.first << ", " << k.second << "}"
-                          << "\n";
-            }
-            std::cout << "total buckets: " << bucket_count() << "\nlookup rounds: " << num_lookup_rds_ << "\n";
+        }
+
+        // the number of lookup rounds started over S, see start_lookup. Passes
+        // of eliminate_false_positives are counted by elimination_passes
+        // instead, since a round also caps the seeds lookup may raise.
+        size_type lookup_rounds() const
+        {
+            return num_lookup_rds_;
+        }
+
+        // the detection passes over S run by eliminate_false_positives
+        size_type elimination_passes() const
+        {
+            return num_elimination_passes_;
+        }
+
+        /**
+     * Returns a snapshot of the internal counters. Counters are only recorded
+     * when compiled with CUCKOO_STATS=1; the seed distribution is always
+     * filled in.
+     *
+     * @return the table statistics, printable with table_stats::to_json()
+     */
+        table_stats stats() const
+        {
+            table_stats s = recorder().snapshot();
+            for (size_t i = 0; i < bucket_count(); i++)
+                s.seeds[seeds_.at(i)]++;
+            return s;
         }
 
         void printSeed(const size_t i) const
@@ -195,7 +268,7 @@ namespace cuckoohashtable
             for (size_t j = 0; j < slot_per_bucket(); j++)
             {
                 if (b.occupied(j))
-                    std::cout << hashed_key(b.key(j));
+                    std::cout << hashed_key(resolve(b.key(j)));
                 else
                     std::cout << " ";
 
@@ -223,31 +296,215 @@ namespace cuckoohashtable
         template <typename K>
         std::pair<size_type, size_type> insert(K &&key)
         {
-            // get hashed key
-            size_type hv = hashed_key(key);
-            partial_t fp = partial_key(hv);
-
-            // std::cout << "HT inserting " << key << " hv: " << hv << " fp: " << fp << "\n";
-
             // find position in table
-            auto b = compute_buckets(key);
+            auto b = compute_buckets(resolve(key));
             table_position pos = cuckoo_insert_loop(b, key); // finds insert spot, does not actually insert
             // std::cout << "HT inserting key " << key << ": " << pos.index << ", " << pos.slot << "\n";// status: " << pos.status << "\n";
 
-            // add to bucket
+            // add to bucket, with the partial under that bucket's seed
             if (pos.status == ok)
             {
+                const partial_t fp = partial_key(hashed_key(resolve(key), seeds_[pos.index]));
                 add_to_bucket(pos.index, pos.slot, fp, std::forward<K>(key));
                 num_items_++;
+                recorder().on_insert();
             }
             else
             {
-                std::cout << "status NOT ok: " << pos.status << "\n";
+                recorder().on_duplicate();
                 assert(pos.status == failure_key_duplicated);
             }
             return std::make_pair(pos.index, pos.slot);
         }
 
+        /**
+   * Inserts the key as insert() does, but reports a full table by return
+   * value instead of throwing, for callers to whom a key that does not fit
+   * is expected (see run_partitioned_build's cross-partition keys). The
+   * table is left unchanged when the key does not fit.
+   *
+   * @param key the key to insert
+   * @return false if the table is full, true if the key was inserted or was
+   * already present
+   */
+        template <typename K>
+        bool try_insert(K &&key)
+        {
+            auto b = compute_buckets(resolve(key));
+            table_position pos = cuckoo_insert(b, key);
+            if (pos.status == failure_table_full)
+                return false;
+            if (pos.status == ok)
+            {
+                const partial_t fp = partial_key(hashed_key(resolve(key), seeds_[pos.index]));
+                add_to_bucket(pos.index, pos.slot, fp, std::forward<K>(key));
+                num_items_++;
+                recorder().on_insert();
+            }
+            else
+            {
+                recorder().on_duplicate();
+            }
+            return true;
+        }
+
+        /**
+   * Inserts the key as insert() does, and records in @p path every key the
+   * cuckoo path moved to make room and where the key went, so a filter
+   * mirroring this table can replay the insert (see
+   * CuckooFilter::PairedInsert) instead of being rebuilt from export_table.
+   *
+   * @param key the key to insert
+   * @param path overwritten with the moves made and the key's position
+   * @return true if the key was inserted, false if it was already present;
+   * @p path then holds its position and no moves
+   * @throw std::out_of_range if the table is full
+   */
+        template <typename K>
+        bool paired_insert(K &&key, paired_path &path)
+        {
+            path.num_moves = 0;
+            auto b = compute_buckets(resolve(key));
+            table_position pos = cuckoo_insert_loop(b, key, &path);
+            path.index = pos.index;
+            path.slot = pos.slot;
+            if (pos.status != ok)
+            {
+                recorder().on_duplicate();
+                return false;
+            }
+            const partial_t fp = partial_key(hashed_key(resolve(key), seeds_[pos.index]));
+            add_to_bucket(pos.index, pos.slot, fp, std::forward<K>(key));
+            num_items_++;
+            recorder().on_insert();
+            return true;
+        }
+
+        /**
+   * Builds an empty table from a complete, static key set. Keys are radix
+   * sorted by their first bucket, and each bucket's run is sorted by second
+   * bucket, so a duplicate sits next to the key it repeats and is dropped
+   * there. Keys are then placed, partials and all, as the buckets are
+   * visited in order:
+   *
+   *   greedy    each key goes to whichever of its two buckets has the lower
+   *             expected final load: occupied slots plus keys still pending
+   *             there as first bucket, and half of those pending there as
+   *             second, which steers keys away from buckets still in demand
+   *   matching  each key finding both buckets full is placed along a
+   *             shortest augmenting path of the key-to-bucket matching,
+   *             found by a breadth-first search of unbounded depth, so the
+   *             keys fit whenever any placement of them does
+   *
+   * @param keys array of keys to insert, as stored (indices for an indexed
+   * table)
+   * @param n number of keys in @p keys
+   * @return the number of keys inserted (duplicates are not counted)
+   * @throw std::logic_error if the table is not empty
+   * @throw std::out_of_range if the keys do not fit in the table, which is
+   * left empty
+   */
+        size_type bulk_build(const key_type *keys, const size_type n)
+        {
+            if (!empty())
+                throw std::logic_error("bulk_build requires an empty table");
+
+            // number of keys still to be placed whose first and whose second
+            // bucket is i
+            std::vector<uint32_t> pending(bucket_count());
+            std::vector<uint32_t> pending_alt(bucket_count());
+            const size_type hp = hashpower();
+            std::unique_ptr<bulk_entry[]> entries(new bulk_entry[n]), scratch(new bulk_entry[n]);
+            for (size_type i = 0; i < n; ++i)
+            {
+                const size_type ik = index_key(resolve(keys[i]));
+                const size_type i1 = index_hash(hp, ik);
+                const size_type i2 = alt_index(hp, ik, i1);
+                entries[i] = bulk_entry{static_cast<uint32_t>(i1), static_cast<uint32_t>(i2), keys[i]};
+                pending[i1]++;
+                pending_alt[i2]++;
+            }
+            bulk_entry *const sorted = radix_sort_by_bucket(entries.get(), scratch.get(), n, hp);
+
+            // number of slots filled in bucket i, which are its first ones
+            std::vector<uint8_t> occupied(bucket_count());
+            // keys whose buckets are both full are left for matching
+            std::vector<size_type> unplaced;
+            size_type inserted = 0;
+            for (size_type begin = 0, end; begin < n; begin = end)
+            {
+                const size_type i1 = sorted[begin].i1;
+                for (end = begin + 1; end < n && sorted[end].i1 == i1; ++end)
+                    ;
+                if (end - begin > 1)
+                {
+                    std::sort(&sorted[begin], &sorted[end],
+                              [](const bulk_entry &a, const bulk_entry &b) { return a.i2 < b.i2; });
+                }
+
+                for (size_type e = begin; e < end; ++e)
+                {
+                    if (e + BULK_PREFETCH_DISTANCE < n)
+                    {
+                        const size_type ahead = sorted[e + BULK_PREFETCH_DISTANCE].i2;
+                        __builtin_prefetch(&occupied[ahead]);
+                        __builtin_prefetch(&pending[ahead]);
+                        __builtin_prefetch(&pending_alt[ahead]);
+                        __builtin_prefetch(&buckets_[ahead]);
+                    }
+
+                    const bulk_entry &entry = sorted[e];
+                    const size_type i2 = entry.i2;
+                    pending[i1]--;
+                    pending_alt[i2]--;
+                    // a duplicate has the same two buckets as the key it repeats
+                    bool duplicate = false;
+                    for (size_type d = e; d > begin && sorted[d - 1].i2 == i2 && !duplicate; --d)
+                        duplicate = key_eq()(resolve(sorted[d - 1].key), resolve(entry.key));
+                    if (duplicate)
+                    {
+                        recorder().on_duplicate();
+                        continue;
+                    }
+
+                    const bool free1 = occupied[i1] < slot_per_bucket();
+                    const bool free2 = occupied[i2] < slot_per_bucket();
+                    size_type target;
+                    if (free1 && (!free2 || 2 * (occupied[i1] + pending[i1]) + pending_alt[i1] <=
+                                                2 * (occupied[i2] + pending[i2]) + pending_alt[i2]))
+                        target = i1;
+                    else if (free2)
+                        target = i2;
+                    else
+                    {
+                        unplaced.push_back(e);
+                        continue;
+                    }
+                    add_to_bucket(target, occupied[target]++, partial_key(hashed_key(resolve(entry.key), seeds_[target])),
+                                  key_type(entry.key));
+                    inserted++;
+                }
+            }
+
+            if (!unplaced.empty())
+            {
+                bulk_matcher matcher(*this, occupied);
+                for (const size_type e : unplaced)
+                {
+                    if (!matcher.place(sorted[e]))
+                    {
+                        buckets_.clear();
+                        recorder().on_table_full();
+                        throw std::out_of_range("table full :(");
+                    }
+                    inserted++;
+                }
+            }
+            num_items_ += inserted;
+            recorder().on_insert(inserted);
+            return inserted;
+        }
+
         /** Searches the table for @p key, and returns the associated value it
    * finds. @c mapped_type must be @c CopyConstructible.
    *
@@ -267,6 +524,7 @@ namespace cuckoohashtable
 
             // search in both buckets
             const table_position pos = cuckoo_find(key, b.i1, b.i2);
+            recorder().on_find(pos.status == ok && pos.index == b.i1 ? 1 : 2);
             // return pos.status == ok;
             // return std::make_pair(pos.index, pos.slot);
             if (pos.status == ok)
@@ -282,16 +540,42 @@ namespace cuckoohashtable
             }
         }
 
+        /**
+   * Removes the key from the table. Its slot is emptied and the bucket keeps
+   * its seed, so the remaining fingerprints stay valid and no false positive
+   * can appear; compact() later resets the seeds of buckets left empty.
+   *
+   * @tparam K type of the key
+   * @param key the key to remove
+   * @return the bucket and slot the key was removed from, as find() returns
+   * them, for a mirroring filter's CuckooFilter::PairedDelete, or (-1, -1)
+   * if the key was not in the table
+   */
+        template <typename K>
+        std::pair<int32_t, int32_t> erase(const K &key)
+        {
+            const auto b = compute_buckets(key);
+            const table_position pos = cuckoo_find(key, b.i1, b.i2);
+            if (pos.status != ok)
+                return std::make_pair(-1, -1);
+            buckets_.eraseK(pos.index, pos.slot);
+            num_items_--;
+            recorder().on_erase();
+            return std::make_pair(pos.index, pos.slot);
+        }
+
         void start_lookup() const
         {
             num_lookup_rds_++;
+            rehash_pending_ = true;
+            recorder().on_round_start();
             // std::cout << "starting lookup round " << num_lookup_rds_ << "\n";
         }
 
         size_t num_rehashes()
         {
             // last lookup should result in no fp's, so no rehash
-            return num_lookup_rds_ - 1;
+            return num_lookup_rds_ > 0 ? num_lookup_rds_ - 1 : 0;
         }
 
         template <typename K>
@@ -309,12 +593,14 @@ namespace cuckoohashtable
             // search in both buckets
             const table_position pos1 = cuckoo_find_fp(fp1, b.i1);
             const table_position pos2 = cuckoo_find_fp(fp2, b.i2);
+            recorder().on_lookup(2);
             // return pos.status == ok;
 
             // omg this outer conditional is necessary if false pos. happen to occur in BOTH buckets - pos1 cannot return yet to check pos2 also
             // TODO: modify function to determine if one/both buckets rehashed - perhaps std::pair?? WAIT JK if index is not important, can just return 0 1 or 2 for # buckets HAH
             if (pos1.status == ok || pos2.status == ok)
             {
+                recorder().on_false_positive();
                 if (pos1.status == ok)
                 {
                     // assert(pos1.index == b.i1);
@@ -322,7 +608,7 @@ namespace cuckoohashtable
                         return -1;
 
                     uint16_t &seed = seeds_.at(pos1.index);
-                    if (seed < num_lookup_rds_)
+                    if (seed < num_lookup_rds_ && seed < max_seed_)
                     {
                         seed++;
                         // std::cout << "fp on key: " << key << " hv: " << hv << " fp: " << fp << " at pos " << pos.index << ", " << pos.slot << ", seed to " << seed << "\n";
@@ -342,7 +628,7 @@ namespace cuckoohashtable
                 {
                     assert(pos2.index == b.i2);
                     uint16_t &seed = seeds_.at(pos2.index);
-                    if (seed < num_lookup_rds_)
+                    if (seed < num_lookup_rds_ && seed < max_seed_)
                     {
                         seed++;
                         // std::cout << "fp on key: " << key << " hv: " << hv << " fp: " << fp << " at pos " << pos.index << ", " << pos.slot << ", seed to " << seed << "\n";
@@ -370,11 +656,8 @@ namespace cuckoohashtable
                     for (uint8_t j = 0; j < static_cast<int>(slot_per_bucket()); ++j)
                     {
                         // rehash fp's at bucket index i
-                        const size_type key = b.key(j);
-                        size_type hv = hashed_key(key, seeds_.at(i));
-                        partial_t fp = partial_key(hv);
                         if (b.occupied(j))
-                            fp_to_bucket(i, j, fp);
+                            fp_to_bucket(i, j, partial_key(hashed_key(resolve(b.key(j)), seeds_.at(i))));
                     }
                 }
             }
@@ -382,9 +665,266 @@ namespace cuckoohashtable
             // if (b_count == 1)
             //     cout << "LAST REHASHED BUCKET: " << last_index << "\n";
 
+            rehash_pending_ = false;
+            recorder().on_rehash(b_count);
             return b_count;
         }
 
+        // whether a lookup round has started and its buckets are not rehashed
+        // yet, as after loading a checkpoint taken between the two
+        bool rehash_pending() const
+        {
+            return rehash_pending_;
+        }
+
+        /**
+   * Caps bucket seeds at @p max_seed, which bounds the seed width and, since
+   * a lookup round moves a seed by at most one, the rounds of a build. A
+   * bucket whose false positives are not eliminated within the cap keeps
+   * them, and the keys of S it matches are spilled (see spilled()) for the
+   * filter to exclude on a first-level hit.
+   */
+        void set_max_seed(const uint16_t max_seed)
+        {
+            max_seed_ = max_seed;
+        }
+
+        uint16_t max_seed() const
+        {
+            return max_seed_;
+        }
+
+        // whether another lookup round could move a seed past max_seed()
+        bool lookup_rounds_exhausted() const
+        {
+            return num_lookup_rds_ >= max_seed_;
+        }
+
+        /**
+   * Ends a round-based build that reached the seed cap: spills every key of
+   * @p s that still matches a fingerprint in one of its buckets. Keys stored
+   * in the table match as true positives and are not spilled.
+   *
+   * @param s array of keys known not to be in the table
+   * @param n number of keys in @p s
+   * @return the number of keys spilled
+   * @throw std::logic_error if a lookup round's rehash is pending
+   */
+        size_type spill_false_positives(const source_key_type *s, const size_type n)
+        {
+            if (rehash_pending_)
+                throw std::logic_error("spill_false_positives with a rehash pending");
+            const size_type before = spilled_.size();
+            std::vector<size_type> found;
+            for (size_type i = 0; i < n; ++i)
+            {
+                found.clear();
+                collect_collisions(s[i], found);
+                if (!found.empty() && find(s[i]).first < 0)
+                    spilled_.push_back(s[i]);
+            }
+            return spilled_.size() - before;
+        }
+
+        // the keys of S spilled at the seed cap, for CuckooFilter::Exclude
+        const std::vector<source_key_type> &spilled() const
+        {
+            return spilled_;
+        }
+
+        /**
+   * Eliminates false positives for the negative set S without global lookup
+   * rounds. A detection pass over S marks the buckets where some key of S
+   * matches a fingerprint. A collection pass then gathers, for each marked
+   * bucket, every key of S that maps to it, and each bucket searches forward
+   * from its current seed for one under which none of its resident
+   * fingerprints matches any of those keys. Since a bucket's seed only
+   * affects keys mapping to it, the next detection pass is a verification
+   * pass that finds no false positives, so a build takes three passes over S
+   * instead of one per round.
+   *
+   * A bucket that finds no clean seed up to max_seed() keeps the one matching
+   * the fewest of its keys, which are spilled (see spilled()), and later
+   * detection passes skip it. Keys of @p s stored in the table match under
+   * every seed, as true positives, so both passes skip them.
+   *
+   * Passes over S and the seed search are split across @p num_threads threads.
+   * Each detection pass is counted by elimination_passes() and recorded as a
+   * round in stats(), but not as a lookup round (see lookup_rounds()), and a
+   * bucket's partials are rehashed as soon as its seed moves, so no rehash is
+   * left pending.
+   *
+   * @param s array of keys known not to be in the table
+   * @param n number of keys in @p s
+   * @param num_threads number of worker threads, 0 for hardware concurrency
+   * @return the number of false positives found by each detection pass; the
+   * last entry is always 0
+   * @throw std::logic_error if a lookup round's rehash is pending
+   */
+        std::vector<size_type> eliminate_false_positives(const source_key_type *s, const size_type n,
+                                                         size_type num_threads = 0)
+        {
+            if (rehash_pending_)
+                throw std::logic_error("eliminate_false_positives with a rehash pending");
+            if (num_threads == 0)
+                num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+            std::vector<size_type> fps_per_pass;
+            // buckets that reached the seed cap, whose matches are spilled
+            std::vector<uint8_t> capped(bucket_count());
+            while (true)
+            {
+                // detection
+                num_elimination_passes_++;
+                recorder().on_round_start();
+                std::vector<std::vector<size_type>> found(num_threads);
+                run_parallel(num_threads, n, [&](size_type t, size_type begin, size_type end) {
+                    for (size_type i = begin; i < end; ++i)
+                        collect_collisions(s[i], found[t], capped.data());
+                });
+
+                std::vector<uint8_t> dirty(bucket_count());
+                size_type fps = 0;
+                for (auto &f : found)
+                {
+                    fps += f.size();
+                    for (const size_type i : f)
+                        dirty[i] = 1;
+                }
+                fps_per_pass.push_back(fps);
+                recorder().on_false_positive(fps);
+                if (fps == 0)
+                    break;
+
+                // collection: every key of S mapping to a dirty bucket
+                std::vector<std::vector<std::pair<size_type, source_key_type>>> mapped(num_threads);
+                run_parallel(num_threads, n, [&](size_type t, size_type begin, size_type end) {
+                    for (size_type i = begin; i < end; ++i)
+                    {
+                        const auto b = compute_buckets(s[i]);
+                        if (!dirty[b.i1] && !dirty[b.i2])
+                            continue;
+                        // a key stored in the table matches under every seed
+                        if (cuckoo_find(s[i], b.i1, b.i2).status == ok)
+                            continue;
+                        if (dirty[b.i1])
+                            mapped[t].emplace_back(b.i1, s[i]);
+                        if (dirty[b.i2] && b.i2 != b.i1)
+                            mapped[t].emplace_back(b.i2, s[i]);
+                    }
+                });
+                std::vector<std::pair<size_type, source_key_type>> keys;
+                for (auto &m : mapped)
+                {
+                    keys.insert(keys.end(), m.begin(), m.end());
+                    std::vector<std::pair<size_type, source_key_type>>().swap(m);
+                }
+                std::stable_sort(keys.begin(), keys.end(),
+                                 [](const std::pair<size_type, source_key_type> &a, const std::pair<size_type, source_key_type> &b) {
+                                     return a.first < b.first;
+                                 });
+                // start of each dirty bucket's run in keys
+                std::vector<size_type> runs;
+                for (size_type k = 0; k < keys.size(); ++k)
+                {
+                    if (k == 0 || keys[k].first != keys[k - 1].first)
+                        runs.push_back(k);
+                }
+                runs.push_back(keys.size());
+
+                std::vector<std::vector<source_key_type>> residual(num_threads);
+                run_parallel(num_threads, runs.size() - 1, [&](size_type t, size_type begin, size_type end) {
+                    std::vector<source_key_type> bucket_keys;
+                    for (size_type r = begin; r < end; ++r)
+                    {
+                        bucket_keys.clear();
+                        for (size_type k = runs[r]; k < runs[r + 1]; ++k)
+                            bucket_keys.push_back(keys[k].second);
+                        if (!search_bucket_seed(keys[runs[r]].first, bucket_keys, residual[t]))
+                            capped[keys[runs[r]].first] = 1;
+                    }
+                });
+                for (const auto &res : residual)
+                {
+                    for (const source_key_type &key : res)
+                    {
+                        if (find(key).first < 0)
+                            spilled_.push_back(key);
+                    }
+                }
+                recorder().on_rehash(runs.size() - 1);
+            }
+            return fps_per_pass;
+        }
+
+        /**
+   * Compacts the table after erase() has removed keys. Every empty bucket
+   * goes back to seed 0, which an entropy-coded seed array stores in the
+   * fewest bits, and spilled keys that no longer match a fingerprint are
+   * dropped. Then, if the keys fit in a smaller table at @p max_load, the
+   * table is rebuilt into the smallest hashpower that holds them, halving
+   * its size for every halving of its load, and that table's false
+   * positives for @p s are eliminated (see eliminate_false_positives). A
+   * hashpower whose inserts fail is skipped for the next larger one, and if
+   * none is smaller than the current hashpower the table is left as it is.
+   *
+   * The seeds, and with a rebuild the partials, change, so a filter of the
+   * table must be copied or viewed again (see export_table and
+   * packed_partials()); CuckooFilter::Compact resets the same seeds in a
+   * filter mirroring a table that was not rebuilt.
+   *
+   * @param s array of keys known not to be in the table
+   * @param n number of keys in @p s
+   * @param max_load the largest load factor a rebuilt table may have
+   * @param num_threads number of worker threads, 0 for hardware concurrency
+   * @return true if the table was rebuilt into a smaller hashpower
+   */
+        bool compact(const source_key_type *s, const size_type n, const double max_load = 0.9,
+                     const size_type num_threads = 0)
+        {
+            for (size_type i = 0; i < bucket_count(); ++i)
+            {
+                const bucket &b = buckets_[i];
+                bool empty = true;
+                for (size_type j = 0; j < slot_per_bucket() && empty; ++j)
+                    empty = !b.occupied(j);
+                if (empty)
+                    seeds_[i] = 0;
+            }
+            std::vector<size_type> found;
+            std::vector<source_key_type> kept;
+            for (const source_key_type &key : spilled_)
+            {
+                found.clear();
+                collect_collisions(key, found);
+                if (!found.empty())
+                    kept.push_back(key);
+            }
+            spilled_.swap(kept);
+
+            size_type hp = 0;
+            while (hashsize(hp) * slot_per_bucket() * max_load < size())
+                hp++;
+            for (; hp < hashpower(); ++hp)
+            {
+                cuckoo_hashtable next(hashsize(hp) * slot_per_bucket(), hash_fn_, eq_fn_, get_allocator(),
+                                      key_source_);
+                next.max_seed_ = max_seed_;
+                if (!next.insert_all(*this))
+                    continue;
+                next.eliminate_false_positives(s, n, num_threads);
+
+                buckets_.swap(next.buckets_);
+                seeds_.swap(next.seeds_);
+                spilled_.swap(next.spilled_);
+                num_lookup_rds_ = next.num_lookup_rds_;
+                num_elimination_passes_ += next.num_elimination_passes_;
+                rehash_pending_ = next.rehash_pending_;
+                return true;
+            }
+            return false;
+        }
+
         uint16_t get_seed(const size_t i) const
         {
             return seeds_.at(i);
@@ -399,20 +939,184 @@ namespace cuckoohashtable
             // }
         }
 
+        /**
+         * The partial keys of all slots, bit-packed in the bucket layout of
+         * cuckoofilter::SingleTable<bits_per_key>, 0 for empty slots. Together
+         * with get_seeds() this is a complete filter of the table: CuckooFilter
+         * can be constructed over it as a read-only view, and writing the
+         * packed_partials_bytes() bytes after the seeds serializes it.
+         *
+         * Valid until the table is destroyed or rehashed.
+         */
+        const char *packed_partials() const
+        {
+            return buckets_.packed_partials();
+        }
+
+        size_type packed_partials_bytes() const
+        {
+            return buckets_.packed_partials_bytes();
+        }
+
         template <typename key_type>
-        void export_table(std::vector<std::vector<key_type>> &fp_table)
+        void export_table(std::vector<std::vector<key_type>> &fp_table) const
         {
             for (int i = 0; i < bucket_count(); i++)
             {
                 std::vector<key_type> fp_bucket;
                 for (int j = 0; j < static_cast<int>(slot_per_bucket()); j++)
                 {
-                    fp_bucket.push_back(buckets_[i].partial(j));
+                    fp_bucket.push_back(buckets_[i].occupied(j) ? buckets_.partial(i, j) : 0);
                 }
                 fp_table.push_back(fp_bucket);
             }
         }
 
+        /**
+         * Writes the table's state to @p out, so a build can resume from it
+         * with load_checkpoint instead of inserting and eliminating again. It
+         * is written sequentially in a few large writes:
+         *
+         *   header        magic, version, bits_per_key, slots per bucket, key
+         *                 size, hashpower, number of keys, lookup rounds
+         *   seeds         one uint16_t per bucket
+         *   occupancy     one bit per slot
+         *   keys          the occupied slots' keys, back to back
+         *   partials      packed_partials()
+         *   dirty set     count, then the buckets whose seed the current
+         *                 lookup round raised and which rehash_buckets has
+         *                 not rehashed yet
+         *
+         * Keys are written as bytes, so key_type must be trivially copyable;
+         * for an indexed table the array they index must be rebuilt in the same
+         * order. Integers are written in host byte order.
+         *
+         * @throw std::runtime_error if writing fails
+         */
+        void save_checkpoint(std::ostream &out) const
+        {
+            static_assert(std::is_trivially_copyable<key_type>::value,
+                          "checkpoints write keys as bytes");
+            const uint64_t header[] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, bits_per_key, SLOT_PER_BUCKET,
+                                       sizeof(key_type), hashpower(), num_items_, num_lookup_rds_};
+            out.write(reinterpret_cast<const char *>(header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(seeds_.data()), seeds_.size() * sizeof(uint16_t));
+
+            std::vector<uint8_t> occupancy((capacity() + 7) / 8);
+            for (size_type i = 0; i < bucket_count(); ++i)
+                for (size_type j = 0; j < slot_per_bucket(); ++j)
+                    if (buckets_[i].occupied(j))
+                        occupancy[(i * slot_per_bucket() + j) / 8] |= uint8_t(1) << ((i * slot_per_bucket() + j) % 8);
+            out.write(reinterpret_cast<const char *>(occupancy.data()), occupancy.size());
+
+            // keys go through a buffer so they are written in large blocks too
+            std::vector<char> block;
+            block.reserve(CHECKPOINT_BLOCK_BYTES + sizeof(key_type));
+            for (size_type i = 0; i < bucket_count(); ++i)
+            {
+                for (size_type j = 0; j < slot_per_bucket(); ++j)
+                {
+                    if (!buckets_[i].occupied(j))
+                        continue;
+                    const char *k = reinterpret_cast<const char *>(&buckets_[i].key(j));
+                    block.insert(block.end(), k, k + sizeof(key_type));
+                    if (block.size() >= CHECKPOINT_BLOCK_BYTES)
+                    {
+                        out.write(block.data(), block.size());
+                        block.clear();
+                    }
+                }
+            }
+            out.write(block.data(), block.size());
+
+            out.write(buckets_.packed_partials(), buckets_.packed_partials_bytes());
+
+            std::vector<uint64_t> dirty;
+            if (rehash_pending_)
+            {
+                for (size_type i = 0; i < bucket_count(); ++i)
+                    if (seeds_[i] == num_lookup_rds_)
+                        dirty.push_back(i);
+            }
+            const uint64_t num_dirty = dirty.size();
+            out.write(reinterpret_cast<const char *>(&num_dirty), sizeof(num_dirty));
+            out.write(reinterpret_cast<const char *>(dirty.data()), dirty.size() * sizeof(uint64_t));
+            if (!out)
+                throw std::runtime_error("cannot write checkpoint");
+        }
+
+        /**
+         * Restores the state written by save_checkpoint into this table, which
+         * must be empty and have the same bucket count. If the checkpoint was
+         * taken between a lookup round and rehash_buckets, rehash_pending() is
+         * true afterwards and the build continues with rehash_buckets.
+         *
+         * @throw std::logic_error if the table is not empty
+         * @throw std::runtime_error if the checkpoint is truncated or was written
+         * by a table of another shape
+         */
+        void load_checkpoint(std::istream &in)
+        {
+            static_assert(std::is_trivially_copyable<key_type>::value,
+                          "checkpoints read keys as bytes");
+            if (num_items_ != 0)
+                throw std::logic_error("load_checkpoint requires an empty table");
+            uint64_t header[8];
+            in.read(reinterpret_cast<char *>(header), sizeof(header));
+            if (!in || header[0] != CHECKPOINT_MAGIC || header[1] != CHECKPOINT_VERSION || header[2] != bits_per_key ||
+                header[3] != SLOT_PER_BUCKET || header[4] != sizeof(key_type) || header[5] != hashpower())
+                throw std::runtime_error("checkpoint does not match this table");
+
+            std::vector<uint16_t> seeds(bucket_count());
+            in.read(reinterpret_cast<char *>(seeds.data()), seeds.size() * sizeof(uint16_t));
+            std::vector<uint8_t> occupancy((capacity() + 7) / 8);
+            in.read(reinterpret_cast<char *>(occupancy.data()), occupancy.size());
+            if (!in)
+                throw std::runtime_error("truncated checkpoint");
+
+            size_type loaded = 0;
+            for (size_type i = 0; i < bucket_count() && in; ++i)
+            {
+                for (size_type j = 0; j < slot_per_bucket(); ++j)
+                {
+                    const size_type bit = i * slot_per_bucket() + j;
+                    if (!(occupancy[bit / 8] >> (bit % 8) & 1))
+                        continue;
+                    key_type key;
+                    in.read(reinterpret_cast<char *>(&key), sizeof(key));
+                    buckets_.setK(i, j, 0, std::move(key));
+                    loaded++;
+                }
+            }
+            // the partials are restored as written, including stale ones of
+            // dirty buckets
+            in.read(buckets_.packed_partials(), buckets_.packed_partials_bytes());
+            uint64_t num_dirty = 0;
+            in.read(reinterpret_cast<char *>(&num_dirty), sizeof(num_dirty));
+            std::vector<uint64_t> dirty(in ? num_dirty : 0);
+            in.read(reinterpret_cast<char *>(dirty.data()), dirty.size() * sizeof(uint64_t));
+            num_items_ = loaded;
+            if (!in || loaded != header[6])
+            {
+                buckets_.clear();
+                num_items_ = 0;
+                throw std::runtime_error("truncated checkpoint");
+            }
+            for (const uint64_t i : dirty)
+            {
+                if (i >= bucket_count() || seeds[i] != header[7])
+                {
+                    buckets_.clear();
+                    num_items_ = 0;
+                    throw std::runtime_error("checkpoint dirty set does not match its seeds");
+                }
+            }
+
+            seeds_.swap(seeds);
+            num_lookup_rds_ = header[7];
+            rehash_pending_ = !dirty.empty();
+        }
+
     private:
         template <typename K>
         inline size_type hashed_key(const K &key, uint32_t seed = 0) const
@@ -420,6 +1124,19 @@ namespace cuckoohashtable
             return hash_function()(key, seed);
         }
 
+        // index_key returns the value a key's buckets are derived from, under
+        // the table's index policy
+        inline size_type index_key(const source_key_type &key) const
+        {
+            return index_policy_(key);
+        }
+
+        // resolve returns the key a slot's stored key stands for
+        inline const source_key_type &resolve(const key_type &key) const
+        {
+            return key_source_(key);
+        }
+
         // hashsize returns the number of buckets corresponding to a given
         // hashpower.
         static inline size_type hashsize(const size_type hp)
@@ -447,7 +1164,7 @@ namespace cuckoohashtable
             return fp;
         }
 
-        // index_hash returns the first possible bucket that the given hashed key
+        // index_hash returns the first possible bucket that the given index key
         // could be.
         static inline size_type index_hash(const size_type hp, const size_type key) // hv
         {
@@ -461,21 +1178,13 @@ namespace cuckoohashtable
         // this function will return the first possible bucket if index is the
         // second possible bucket, so alt_index(ti, partial, alt_index(ti, partial,
         // index_hash(ti, hv))) == index_hash(ti, hv).
+        //
+        // The index policy decides where the alternate may lie, see
+        // indexpolicy.hh.
         static inline size_type alt_index(const size_type hp, const size_type key,
                                           const size_type index)
         {
-            // (libcuckoo) ensure fp is nonzero for the multiply. 0xc6a4a7935bd1e995 is the
-            // hash constant from 64-bit MurmurHash2
-            // const size_type nonzero_fp = static_cast<size_type>(partial) + 1;
-            // (DRECHT) ensure fp is nonzero for the multiply
-
-            // >> (right shift)
-            const size_t fp = (key >> hp) + 1;
-            // std::cout << "HT hp: " << hp << ", right shift: " << fp << "key: " << key << "\n";
-
-            // ^ (bitwise XOR), & (bitwise AND)
-            // std::cout << "HT hashmask(hp): " << hashmask(hp) << "\n";
-            return (index ^ (fp * 0xc6a4a7935bd1e995)) & hashmask(hp);
+            return index_policy::alt_index(hp, key, index);
         }
 
         class TwoBuckets
@@ -492,11 +1201,12 @@ namespace cuckoohashtable
         // avoid deadlock. If the two indexes are the same, it just locks one.
         //
         // throws hashpower_changed if it changed after taking the lock.
-        TwoBuckets compute_buckets(const size_type key) const // size_type, size_type i1, size_type i2
+        TwoBuckets compute_buckets(const source_key_type &key) const // size_type, size_type i1, size_type i2
         {
             const size_type hp = hashpower();
-            const size_type i1 = index_hash(hp, key);
-            const size_type i2 = alt_index(hp, key, i1);
+            const size_type ik = index_key(key);
+            const size_type i1 = index_hash(hp, ik);
+            const size_type i2 = alt_index(hp, ik, i1);
             // std::cout << key << ": HT computed buckets " << i1 << " and " << i2 << "\n";
             return TwoBuckets(i1, i2);
         }
@@ -530,9 +1240,36 @@ namespace cuckoohashtable
         // Searching types and functions
         // cuckoo_find searches the table for the given key, returning the position
         // of the element found, or a failure status code if the key wasn't found.
+        //
+        // With CUCKOO_PARTIAL_FIRST_FIND, the key's partials under the seeds of
+        // both buckets are compared with all eight stored partials at once, and
+        // only the slots that match have their keys compared. Otherwise every
+        // occupied slot's key is compared. The first bucket is prefetched while
+        // the partials are checked, as most present keys are found there.
+        // While a rehash is pending, lookup has raised seeds whose buckets
+        // still hold partials under the old ones, so every key is compared.
         template <typename K>
         table_position cuckoo_find(const K &key, const size_type i1, const size_type i2) const
         {
+            if (CUCKOO_PARTIAL_FIRST_FIND && !rehash_pending_)
+            {
+                __builtin_prefetch(&buckets_[i1]);
+                const uint16_t seed1 = seeds_[i1];
+                const uint16_t seed2 = seeds_[i2];
+                const partial_t p1 = partial_key(hashed_key(key, seed1));
+                const partial_t p2 = seed2 == seed1 ? p1 : partial_key(hashed_key(key, seed2));
+                for (unsigned mask = buckets_.match_partials(i1, i2, p1, p2); mask != 0; mask &= mask - 1)
+                {
+                    const unsigned k = __builtin_ctz(mask);
+                    const size_type i = k < SLOT_PER_BUCKET ? i1 : i2;
+                    const size_type slot = k % SLOT_PER_BUCKET;
+                    const bucket &b = buckets_[i];
+                    if (b.occupied(slot) && key_eq()(resolve(b.key(slot)), key))
+                        return table_position{i, slot, ok};
+                }
+                return table_position{0, 0, failure_key_not_found};
+            }
+
             int_least16_t slot;
             slot = try_read_from_bucket(buckets_[i1], key); // check each slot in bucket 1
 
@@ -550,13 +1287,13 @@ namespace cuckoohashtable
         table_position cuckoo_find_fp(const partial_t &fp1, const size_type i1) const
         {
             int slot;
-            slot = try_fp_in_bucket(buckets_[i1], fp1);
+            slot = try_fp_in_bucket(i1, fp1);
 
             if (slot != -1)
                 return table_position{i1, static_cast<size_type>(slot), ok};
             return table_position{0, 0, failure_key_not_found};
 
-            // slot = try_fp_in_bucket(buckets_[i2], fp2);
+            // slot = try_fp_in_bucket(i2, fp2);
 
             // if (slot != -1)
             //     return table_position{i2, static_cast<size_type>(slot), ok};
@@ -570,7 +1307,7 @@ namespace cuckoohashtable
         {
             for (int i = 0; i < static_cast<int>(slot_per_bucket()); ++i)
             {
-                if (key_eq()(b.key(i), key))
+                if (b.occupied(i) && key_eq()(resolve(b.key(i)), key))
                 {
                     return i;
                 }
@@ -580,13 +1317,13 @@ namespace cuckoohashtable
 
         // try_fp_in_bucket will search the bucket for the fingerprint of the given key
         // and return the index of the slot if found, of -1 if not found.
-        int try_fp_in_bucket(const bucket &b, const partial_t &p) const
+        int try_fp_in_bucket(const size_type ind, const partial_t &p) const
         {
             for (int i = 0; i < static_cast<int>(slot_per_bucket()); ++i)
             {
-                if (key_eq()(p, b.partial(i)))
+                if (buckets_.partial(ind, i) == p)
                 {
-                    // std::cout << "found " << p << " == " << b.partial(i) << " at slot " << i << "\n";
+                    // std::cout << "found " << p << " == " << buckets_.partial(ind, i) << " at slot " << i << "\n";
                     return i;
                 }
             }
@@ -602,6 +1339,7 @@ namespace cuckoohashtable
    * @param hv the hash value of the key
    * @param b bucket locks
    * @param key the key to insert
+   * @param path if not null, records the keys moved to make room
    * @return table_position of the location to insert the new element, or the
    * site of the duplicate element with a status code if there was a duplicate.
    * In either case, the locks will still be held after the function ends.
@@ -609,13 +1347,13 @@ namespace cuckoohashtable
    * load factor of the table is below the threshold
    */
         template <typename K>
-        table_position cuckoo_insert_loop(TwoBuckets &b, K &key)
+        table_position cuckoo_insert_loop(TwoBuckets &b, K &key, paired_path *path = nullptr)
         {
             table_position pos;
             while (true)
             {
                 const size_type hp = hashpower();
-                pos = cuckoo_insert(b, key);
+                pos = cuckoo_insert(b, key, path);
                 switch (pos.status)
                 {
                 case ok:
@@ -634,9 +1372,7 @@ namespace cuckoohashtable
                 //     b = snapshot_and_lock_two<TABLE_MODE>(hv);
                 //     break;
                 default:
-                    std::cout << "error on index: " << pos.index << " slot: " << pos.slot << " status: " << pos.status << "\n";
-                    info();
-                    assert(false);
+                    throw std::logic_error("unexpected cuckoo_insert status " + std::to_string(pos.status));
                 }
             }
         }
@@ -660,7 +1396,7 @@ namespace cuckoohashtable
         // failure_table_full -- Failed to find an empty slot for the table. Locks
         // are released. No meaningful position is returned.
         template <typename K>
-        table_position cuckoo_insert(TwoBuckets &b, K &&key)
+        table_position cuckoo_insert(TwoBuckets &b, K &&key, paired_path *path = nullptr)
         {
             int res1, res2; // gets indices
             bucket &b1 = buckets_[b.i1];
@@ -689,16 +1425,16 @@ namespace cuckoohashtable
             // We are unlucky, so let's perform cuckoo hashing ~
             size_type insert_bucket = 0;
             size_type insert_slot = 0;
-            cuckoo_status st = run_cuckoo(b, insert_bucket, insert_slot);
+            cuckoo_status st = run_cuckoo(b, insert_bucket, insert_slot, path);
             if (st == ok)
             {
                 assert(!buckets_[insert_bucket].occupied(insert_slot));
-                assert(insert_bucket == index_hash(hashpower(), key) || insert_bucket == alt_index(hashpower(), key, index_hash(hashpower(), key)));
+                assert(insert_bucket == compute_buckets(resolve(key)).i1 || insert_bucket == compute_buckets(resolve(key)).i2);
 
                 return table_position{insert_bucket, insert_slot, ok};
             }
             assert(st == failure);
-            std::cout << "hashtable is full (hashpower = " << hashpower() << ", hash_items = " << size() << ", load factor = " << load_factor() << "), need to increase hashpower\n";
+            recorder().on_table_full();
             return table_position{0, 0, failure_table_full};
         }
 
@@ -730,7 +1466,7 @@ namespace cuckoohashtable
             {
                 if (b.occupied(i))
                 {
-                    if (key_eq()(b.key(i), key))
+                    if (key_eq()(resolve(b.key(i)), resolve(key)))
                     {
                         slot = i;
                         return false;
@@ -753,13 +1489,9 @@ namespace cuckoohashtable
         {
             size_type bucket;
             size_type slot;
-            size_type key;
+            size_type key; // index_key of the key in the slot
         } CuckooRecord;
 
-        // The maximum number of items in a cuckoo BFS path. It determines the
-        // maximum number of slots we search when cuckooing.
-        static constexpr uint8_t MAX_BFS_PATH_LEN = 5;
-
         // An array of CuckooRecords
         using CuckooRecords = std::array<CuckooRecord, MAX_BFS_PATH_LEN>;
 
@@ -767,7 +1499,9 @@ namespace cuckoohashtable
         // a slot on either of the insert buckets. On success, the bucket and slot
         // that was freed up is stored in insert_bucket and insert_slot. If run_cuckoo
         // returns ok (success), then `b` will be active, otherwise it will not.
-        cuckoo_status run_cuckoo(TwoBuckets &b, size_type &insert_bucket, size_type &insert_slot)
+        // Moves are recorded in path if it is not null.
+        cuckoo_status run_cuckoo(TwoBuckets &b, size_type &insert_bucket, size_type &insert_slot,
+                                 paired_path *path = nullptr)
         {
             // std::cout << "run_cuckoo\n";
             // cuckoo_search and cuckoo_move
@@ -782,9 +1516,11 @@ namespace cuckoohashtable
                 {
                     break;
                 }
+                recorder().on_bfs_path(depth);
 
-                if (cuckoopath_move(hp, cuckoo_path, depth, b))
+                if (cuckoopath_move(hp, cuckoo_path, depth, b, path))
                 {
+                    recorder().on_path_move(depth);
                     // store freed up bucket and slot
                     insert_bucket = cuckoo_path[0].bucket;
                     insert_slot = cuckoo_path[0].slot;
@@ -834,7 +1570,7 @@ namespace cuckoohashtable
                 {
                     return 0;
                 }
-                first.key = b.key(first.slot);
+                first.key = index_key(resolve(b.key(first.slot)));
             }
             for (int i = 1; i <= x.depth; ++i)
             {
@@ -849,14 +1585,17 @@ namespace cuckoohashtable
                     // We can terminate here!
                     return i;
                 }
-                curr.key = b.key(curr.slot);
+                curr.key = index_key(resolve(b.key(curr.slot)));
             }
             return x.depth;
         }
 
         // cuckoopath_move moves keys along the given cuckoo path in order to make
-        // an empty slot in one of the buckets in cuckoo_insert.
-        bool cuckoopath_move(const size_type hp, CuckooRecords &cuckoo_path, size_type depth, TwoBuckets &b)
+        // an empty slot in one of the buckets in cuckoo_insert. A moved key's
+        // partial is recomputed when the two buckets have different seeds.
+        // Each move is appended to path if it is not null.
+        bool cuckoopath_move(const size_type hp, CuckooRecords &cuckoo_path, size_type depth, TwoBuckets &b,
+                             paired_path *path = nullptr)
         {
             // std::cout << "cuckoopath_move\n";
             if (depth == 0)
@@ -865,16 +1604,7 @@ namespace cuckoohashtable
                 // both buckets as full and cuckoopath_search finds one empty? Probably not w/o concurrency
                 const size_type bucket_i = cuckoo_path[0].bucket;
                 assert(bucket_i == b.i1 || bucket_i == b.i2);
-                if (!buckets_[bucket_i].occupied(cuckoo_path[0].slot))
-                {
-                    std::cout << "found unoccupied\n";
-                    return true;
-                }
-                else
-                {
-                    std::cout << "cuckoo bucket occupied :(\n";
-                    return false;
-                }
+                return !buckets_[bucket_i].occupied(cuckoo_path[0].slot);
             }
 
             while (depth > 0)
@@ -892,13 +1622,23 @@ namespace cuckoohashtable
                 // std::cout << "to: " << to.bucket << ", " << to.slot << "\n";
 
                 // checks valid cuckoo, and that the hash value is the same
-                if (tb.occupied(ts) || !fb.occupied(fs) || fb.key(fs) != from.key)
+                if (tb.occupied(ts) || !fb.occupied(fs) || index_key(resolve(fb.key(fs))) != from.key)
                 {
                     return false;
                 }
 
-                buckets_.setK(to.bucket, ts, fb.partial(fs), std::move(fb.key(fs)));
+                const partial_t from_partial = buckets_.partial(from.bucket, fs);
+                const partial_t to_partial =
+                    seeds_[from.bucket] == seeds_[to.bucket]
+                        ? from_partial
+                        : partial_key(hashed_key(resolve(fb.key(fs)), seeds_[to.bucket]));
+                buckets_.setK(to.bucket, ts, to_partial, std::move(fb.key(fs)));
                 buckets_.eraseK(from.bucket, fs);
+                if (path)
+                {
+                    assert(path->num_moves < path->moves.size());
+                    path->moves[path->num_moves++] = cuckoo_move{from.bucket, fs, to.bucket, ts, from_partial, to_partial};
+                }
                 depth--;
                 // std::cout << "depth: " << depth << "\n";
             }
@@ -1020,7 +1760,7 @@ namespace cuckoohashtable
                     // If x has less than the maximum number of path components,
                     // create a new b_slot item, that represents the bucket we could
                     // have to come from if we kicked out the item at this slot.
-                    const size_type key = b.key(slot);
+                    const size_type key = index_key(resolve(b.key(slot)));
                     if (x.depth < MAX_BFS_PATH_LEN - 1)
                     {
                         assert(!q.full());
@@ -1034,6 +1774,283 @@ namespace cuckoohashtable
             return b_slot(0, 0, -1);
         }
 
+        // Bulk build types and functions
+
+        // bulk_entry carries a key with both of its buckets, so the sorted run
+        // is read sequentially and the buckets are computed only once.
+        // A key of bulk_build with its two buckets. Bucket indices fit in 32
+        // bits, as positions are returned as int32_t (see find), which keeps
+        // the two sorted copies small.
+        struct bulk_entry
+        {
+            uint32_t i1;
+            uint32_t i2;
+            key_type key;
+        };
+
+        // bulk_matcher places keys left over by bulk_build's greedy pass. Each
+        // search is a breadth-first search over buckets from the key's two
+        // buckets, where a bucket leads to the other bucket of each key stored
+        // in it, until it reaches a bucket with a free slot; the keys along
+        // the path then each move one step, which frees a slot for the new
+        // key. Visited marks are stamped with the search number, so nothing
+        // is cleared between searches.
+        class bulk_matcher
+        {
+        public:
+            bulk_matcher(cuckoo_hashtable &table, std::vector<uint8_t> &occupied)
+                : table_(table), occupied_(occupied), stamp_(occupied.size()), from_(occupied.size()),
+                  from_slot_(occupied.size()), search_(0) {}
+
+            // stores entry along a shortest augmenting path, or returns false
+            // if no bucket with a free slot is reachable
+            bool place(const bulk_entry &entry)
+            {
+                ++search_;
+                queue_.clear();
+                for (const uint32_t b : {entry.i1, entry.i2})
+                {
+                    if (stamp_[b] != search_)
+                    {
+                        stamp_[b] = search_;
+                        from_[b] = NO_BUCKET;
+                        queue_.push_back(b);
+                    }
+                }
+                const size_type hp = table_.hashpower();
+                for (size_type q = 0; q < queue_.size(); ++q)
+                {
+                    const uint32_t b = queue_[q];
+                    if (occupied_[b] < SLOT_PER_BUCKET)
+                    {
+                        augment(b, entry);
+                        return true;
+                    }
+                    const bucket &resident = table_.buckets_[b];
+                    for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
+                    {
+                        const size_type ik = table_.index_key(table_.resolve(resident.key(j)));
+                        const size_type i1 = index_hash(hp, ik);
+                        const uint32_t other = static_cast<uint32_t>(i1 == b ? alt_index(hp, ik, i1) : i1);
+                        if (stamp_[other] != search_)
+                        {
+                            stamp_[other] = search_;
+                            from_[other] = b;
+                            from_slot_[other] = static_cast<uint8_t>(j);
+                            queue_.push_back(other);
+                        }
+                    }
+                }
+                return false;
+            }
+
+        private:
+            static constexpr uint32_t NO_BUCKET = std::numeric_limits<uint32_t>::max();
+
+            // b has a free slot: moves each key on the path into the bucket
+            // after it, with its partial under that bucket's seed, and stores
+            // entry in the first bucket
+            void augment(uint32_t b, const bulk_entry &entry)
+            {
+                size_type slot = occupied_[b]++;
+                while (from_[b] != NO_BUCKET)
+                {
+                    const uint32_t prev = from_[b];
+                    const size_type prev_slot = from_slot_[b];
+                    key_type &key = table_.buckets_[prev].key(prev_slot);
+                    const partial_t p = table_.partial_key(table_.hashed_key(table_.resolve(key), table_.seeds_[b]));
+                    table_.add_to_bucket(b, slot, p, std::move(key));
+                    table_.buckets_.eraseK(prev, prev_slot);
+                    b = prev;
+                    slot = prev_slot;
+                }
+                table_.add_to_bucket(b, slot, table_.partial_key(table_.hashed_key(table_.resolve(entry.key), table_.seeds_[b])),
+                                     key_type(entry.key));
+            }
+
+            cuckoo_hashtable &table_;
+            std::vector<uint8_t> &occupied_;
+            std::vector<uint32_t> stamp_;
+            // the bucket and slot whose key leads to a bucket, NO_BUCKET for
+            // the new key's two
+            std::vector<uint32_t> from_;
+            std::vector<uint8_t> from_slot_;
+            std::vector<uint32_t> queue_;
+            uint32_t search_;
+        };
+
+        // The most bucket bits sorted per radix pass; 2^11 counters fit in L1.
+        static constexpr size_type BULK_RADIX_BITS = 11;
+
+        // How many entries ahead bulk_build prefetches the alternate bucket.
+        static constexpr size_type BULK_PREFETCH_DISTANCE = 8;
+
+        // radix_sort_by_bucket stably sorts the n entries at in by first
+        // bucket, LSD in as few passes of at most BULK_RADIX_BITS as cover hp
+        // bits, with every pass's counts taken in one read. The passes
+        // alternate between in and scratch, and it returns the one holding
+        // the sorted entries.
+        static bulk_entry *radix_sort_by_bucket(bulk_entry *in, bulk_entry *scratch, const size_type n,
+                                                const size_type hp)
+        {
+            const size_type passes = std::max<size_type>(1, (hp + BULK_RADIX_BITS - 1) / BULK_RADIX_BITS);
+            const size_type bits = (hp + passes - 1) / passes;
+            const size_type mask = (size_type(1) << bits) - 1;
+            std::vector<size_type> counts(passes << bits);
+            for (size_type i = 0; i < n; ++i)
+            {
+                for (size_type p = 0; p < passes; ++p)
+                    counts[(p << bits) + ((in[i].i1 >> (p * bits)) & mask)]++;
+            }
+            for (size_type p = 0; p < passes; ++p)
+            {
+                size_type *const c = &counts[p << bits];
+                size_type sum = 0;
+                for (size_type d = 0; d <= mask; ++d)
+                {
+                    const size_type cnt = c[d];
+                    c[d] = sum;
+                    sum += cnt;
+                }
+                for (size_type i = 0; i < n; ++i)
+                    scratch[c[(in[i].i1 >> (p * bits)) & mask]++] = in[i];
+                std::swap(in, scratch);
+            }
+            return in;
+        }
+
+        // insert_all inserts every key of other, and returns false if this
+        // table fills first
+        bool insert_all(const cuckoo_hashtable &other)
+        {
+            try
+            {
+                for (size_type i = 0; i < other.bucket_count(); ++i)
+                {
+                    const bucket &b = other.buckets_[i];
+                    for (size_type j = 0; j < slot_per_bucket(); ++j)
+                    {
+                        if (b.occupied(j))
+                            insert(key_type(b.key(j)));
+                    }
+                }
+            }
+            catch (const std::out_of_range &)
+            {
+                return false;
+            }
+            return true;
+        }
+
+        // Local seed search functions
+
+        // collect_collisions appends each of the key's buckets holding a
+        // fingerprint equal to the key's fingerprint under that bucket's seed,
+        // unless the key is stored in the table, where it matches as a true
+        // positive.
+        void collect_collisions(const source_key_type &key, std::vector<size_type> &out,
+                                const uint8_t *skip = nullptr) const
+        {
+            const auto b = compute_buckets(key);
+            const size_type before = out.size();
+            if (!(skip && skip[b.i1]) && bucket_has_fp(b.i1, partial_key(hashed_key(key, seeds_[b.i1]))))
+                out.push_back(b.i1);
+            if (b.i2 != b.i1 && !(skip && skip[b.i2]) &&
+                bucket_has_fp(b.i2, partial_key(hashed_key(key, seeds_[b.i2]))))
+                out.push_back(b.i2);
+            if (out.size() > before && cuckoo_find(key, b.i1, b.i2).status == ok)
+                out.resize(before);
+        }
+
+        bool bucket_has_fp(const size_type i, const partial_t fp) const
+        {
+            const bucket &b = buckets_[i];
+            for (size_type j = 0; j < slot_per_bucket(); ++j)
+            {
+                if (b.occupied(j) && buckets_.partial(i, j) == fp)
+                    return true;
+            }
+            return false;
+        }
+
+        // search_bucket_seed tries seeds after the bucket's current one, up to
+        // max_seed_, until none of the resident fingerprints matches any of the
+        // given keys, then rehashes the bucket with it. If every seed leaves a
+        // match, the bucket is rehashed with the seed matching the fewest keys,
+        // those keys are appended to residual, and it returns false.
+        bool search_bucket_seed(const size_type i, const std::vector<source_key_type> &keys,
+                                std::vector<source_key_type> &residual)
+        {
+            bucket &b = buckets_[i];
+            partial_t resident[SLOT_PER_BUCKET];
+            uint32_t best_seed = seeds_[i];
+            size_type best_matches = keys.size() + 1;
+            for (uint32_t seed = seeds_[i] + 1; seed <= max_seed_ && best_matches > 0; ++seed)
+            {
+                size_type count = 0;
+                for (size_type j = 0; j < slot_per_bucket(); ++j)
+                {
+                    if (b.occupied(j))
+                        resident[count++] = partial_key(hashed_key(resolve(b.key(j)), seed));
+                }
+                // counting stops once the seed cannot beat the best so far
+                size_type matches = 0;
+                for (size_type k = 0; k < keys.size() && matches < best_matches; ++k)
+                {
+                    const partial_t fp = partial_key(hashed_key(keys[k], seed));
+                    bool match = false;
+                    for (size_type j = 0; j < count; ++j)
+                        match |= resident[j] == fp;
+                    matches += match;
+                }
+                if (matches < best_matches)
+                {
+                    best_seed = seed;
+                    best_matches = matches;
+                }
+            }
+            if (best_seed != seeds_[i])
+            {
+                seeds_[i] = best_seed;
+                for (size_type j = 0; j < slot_per_bucket(); ++j)
+                {
+                    if (b.occupied(j))
+                        fp_to_bucket(i, j, partial_key(hashed_key(resolve(b.key(j)), best_seed)));
+                }
+            }
+            if (best_matches == 0)
+                return true;
+            for (const source_key_type &key : keys)
+            {
+                if (bucket_has_fp(i, partial_key(hashed_key(key, seeds_[i]))))
+                    residual.push_back(key);
+            }
+            return false;
+        }
+
+        // run_parallel splits [0, n) into num_threads contiguous ranges and calls
+        // fn(thread, begin, end) for each, on the calling thread when there is
+        // only one.
+        template <typename F>
+        static void run_parallel(const size_type num_threads, const size_type n, F fn)
+        {
+            if (num_threads <= 1 || n < num_threads)
+            {
+                fn(0, 0, n);
+                return;
+            }
+            std::vector<std::thread> workers;
+            const size_type chunk = (n + num_threads - 1) / num_threads;
+            for (size_type t = 0; t < num_threads; ++t)
+            {
+                const size_type begin = std::min(n, t * chunk);
+                const size_type end = std::min(n, begin + chunk);
+                workers.emplace_back(fn, t, begin, end);
+            }
+            for (auto &w : workers)
+                w.join();
+        }
+
         // Miscellaneous functions
 
         // reserve_calc takes in a parameter specifying a certain number of slots
@@ -1057,6 +2074,12 @@ namespace cuckoohashtable
         // The equality function
         key_equal eq_fn_;
 
+        // maps stored keys to hashed keys
+        key_source key_source_;
+
+        // maps keys to the value their buckets are derived from
+        index_policy index_policy_;
+
         // container of buckets. The size or memory location of the buckets cannot be
         // changed unless all the locks are taken on the table. Thus, it is only safe
         // to access the buckets_ container when you have at least one lock held.
@@ -1067,8 +2090,49 @@ namespace cuckoohashtable
 
         mutable std::vector<uint16_t> seeds_;
         mutable size_t num_lookup_rds_;
+        size_t num_elimination_passes_;
+        // set by start_lookup, cleared by rehash_buckets
+        mutable bool rehash_pending_;
+
+        // the largest seed a bucket may take, see set_max_seed
+        uint16_t max_seed_;
+
+        // keys of S matching a bucket that reached max_seed_
+        std::vector<source_key_type> spilled_;
+
+        // first header word of a checkpoint, "CKHTCKPT"
+        static constexpr uint64_t CHECKPOINT_MAGIC = 0x54504b435448434bULL;
+        static constexpr uint64_t CHECKPOINT_VERSION = 1;
+        // save_checkpoint writes keys in blocks of about this many bytes
+        static constexpr size_type CHECKPOINT_BLOCK_BYTES = size_type(1) << 20;
+
+        // internal counters, see tablestats.hh
+        const stats_recorder<CUCKOO_STATS> &recorder() const { return *this; }
     };
 
+    /**
+     * cuckoo_hashtable whose slots hold 32-bit indices into an external array
+     * of Key instead of the keys themselves. Insert and bulk_build take
+     * indices; find, lookup and eliminate_false_positives take keys.
+     */
+    template <class Key, std::size_t bits_per_key, class Hash = std::hash<Key>, std::size_t SLOT_PER_BUCKET = 4,
+              class IndexPolicy = raw_index_policy>
+    using indexed_cuckoo_hashtable =
+        cuckoo_hashtable<typename indexed_key_source<Key>::index_type, bits_per_key, Hash, std::equal_to<Key>,
+                         std::allocator<typename indexed_key_source<Key>::index_type>, SLOT_PER_BUCKET,
+                         indexed_key_source<Key>, IndexPolicy>;
+
+    /**
+     * cuckoo_hashtable whose alternate buckets stay within aligned chunks of
+     * 2^alt_range_bits buckets (see local_index_policy). Export into a
+     * CuckooFilter with cuckoofilter::LocalIndex<MixedIndex, alt_range_bits>.
+     */
+    template <class Key, std::size_t bits_per_key, class Hash = std::hash<Key>, std::size_t SLOT_PER_BUCKET = 4,
+              std::size_t alt_range_bits = 8>
+    using local_cuckoo_hashtable =
+        cuckoo_hashtable<Key, bits_per_key, Hash, std::equal_to<Key>, std::allocator<Key>, SLOT_PER_BUCKET,
+                         identity_key_source, local_index_policy<mixed_index_policy, alt_range_bits>>;
+
 }; // namespace cuckoohashtable
 
 #endif // CUCKOO_HASHTABLE_HH
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef CUCKOO_INDEX_POLICY_HH
+#define CUCKOO_INDEX_POLICY_HH
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cuckoohashtable
+{
+    /**
+     * maps a key to the 64-bit value its buckets are derived from: i1 is taken
+     * from the high 32 bits, and the policy's static alt_index(hp, ik, i1)
+     * gives the alternate bucket. alt_index must be an involution for a fixed
+     * index value, i.e. alt_index(hp, ik, alt_index(hp, ik, i1)) == i1.
+     *
+     * The filter has matching policies (cuckoofilter/src/indexpolicy.h). A
+     * table exported into a filter must use the matching policy on both sides,
+     * or the filter looks in the wrong buckets.
+     *
+     * Policies read a key through index_bits(key), which is the key itself for
+     * integers. Other key types (e.g. cuckoofilter::Digest128) provide an
+     * overload found by argument-dependent lookup.
+     */
+    inline uint64_t index_bits(uint64_t key) { return key; }
+
+    /**
+     * whole_table_alternate can place the alternate bucket anywhere in the
+     * table: it xors i1 with a multiple of the index bits above the hashpower.
+     */
+    struct whole_table_alternate
+    {
+        static uint64_t alt_index(std::size_t hp, uint64_t ik, uint64_t index)
+        {
+            // ensure fp is nonzero for the multiply. 0xc6a4a7935bd1e995 is the
+            // hash constant from 64-bit MurmurHash2
+            const uint64_t fp = (ik >> hp) + 1;
+            return (index ^ (fp * 0xc6a4a7935bd1e995ULL)) & ((uint64_t(1) << hp) - 1);
+        }
+    };
+
+    /**
+     * raw_index_policy uses the key as is, which is only balanced for
+     * uniformly random 64-bit keys.
+     */
+    struct raw_index_policy : whole_table_alternate
+    {
+        template <class K>
+        uint64_t operator()(const K &key) const { return index_bits(key); }
+    };
+
+    /**
+     * mixed_index_policy passes the key through the MurmurHash3 64-bit
+     * finalizer, so sequential keys or keys sharing high bits (e.g.
+     * certificate serials from one CA) still spread over all buckets. The
+     * finalizer is a bijection, so distinct keys keep distinct index values.
+     */
+    struct mixed_index_policy : whole_table_alternate
+    {
+        template <class K>
+        uint64_t operator()(const K &key) const
+        {
+            uint64_t k = index_bits(key);
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            k ^= k >> 33;
+            return k;
+        }
+    };
+    /**
+     * local_index_policy takes i1 from Base but keeps the alternate inside the
+     * aligned chunk of 2^alt_range_bits buckets that holds i1, so the two
+     * buckets of a lookup share a few pages (or, for small ranges, a pair of
+     * cache lines) instead of costing two independent DRAM misses. Smaller
+     * chunks lower the load factor the table can reach; see
+     * cuckoofilter/benchmarks/local-alternate.cc.
+     *
+     * The offset within the chunk comes from the low 32 bits of the index
+     * value, which i1 never uses, so it does not depend on the hashpower. It
+     * is never zero, so i1 and the alternate always differ.
+     */
+    template <class Base = mixed_index_policy, std::size_t alt_range_bits = 8>
+    struct local_index_policy : Base
+    {
+        static uint64_t alt_index(std::size_t hp, uint64_t ik, uint64_t index)
+        {
+            const std::size_t bits = hp < alt_range_bits ? hp : alt_range_bits;
+            if (bits == 0)
+                return index;
+            const uint64_t offset =
+                (static_cast<uint32_t>(ik) * 0xc6a4a7935bd1e995ULL) >> (64 - bits);
+            return index ^ (offset + (offset == 0));
+        }
+    };
+} // namespace cuckoohashtable
+
+#endif // CUCKOO_INDEX_POLICY_HH
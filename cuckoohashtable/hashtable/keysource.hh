@@ -0,0 +1,45 @@
+#ifndef CUCKOO_KEY_SOURCE_HH
+#define CUCKOO_KEY_SOURCE_HH
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cuckoohashtable
+{
+    /**
+     * maps the key stored in a bucket slot to the key that is hashed, indexed
+     * and compared. The table calls it wherever it reads a stored key.
+     *
+     * identity_key_source stores keys by value.
+     */
+    struct identity_key_source
+    {
+        template <class K>
+        const K &operator()(const K &k) const { return k; }
+    };
+
+    /**
+     * indexed_key_source stores a 32-bit index into an external array of keys
+     * instead of the key itself, for builds where the key set is already held
+     * in memory. The array must outlive the table and must not move.
+     *
+     * @tparam Key - type of the keys in the external array
+     */
+    template <class Key>
+    class indexed_key_source
+    {
+    public:
+        using index_type = uint32_t;
+
+        explicit indexed_key_source(const Key *keys = nullptr) : keys_(keys) {}
+
+        const Key &operator()(const index_type i) const { return keys_[i]; }
+
+        const Key *keys() const { return keys_; }
+
+    private:
+        const Key *keys_;
+    };
+} // namespace cuckoohashtable
+
+#endif // CUCKOO_KEY_SOURCE_HH
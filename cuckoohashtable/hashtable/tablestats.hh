@@ -0,0 +1,223 @@
+#ifndef CUCKOO_TABLE_STATS_HH
+#define CUCKOO_TABLE_STATS_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Build with -DCUCKOO_STATS=1 to record internal counters. When left at 0 the
+// recorder below is an empty class whose hooks compile away entirely.
+#ifndef CUCKOO_STATS
+#define CUCKOO_STATS 0
+#endif
+
+namespace cuckoohashtable
+{
+    /**
+     * snapshot of the internal counters of a cuckoo_hashtable, returned by
+     * cuckoo_hashtable::stats()
+     *
+     * Histograms are indexed by length; the last entry also counts anything
+     * longer than the histogram.
+     */
+    struct table_stats
+    {
+        static constexpr std::size_t HISTOGRAM_SIZE = 8;
+        using histogram = std::array<uint64_t, HISTOGRAM_SIZE>;
+
+        // false positives seen and buckets rehashed in one lookup round over S
+        struct lookup_round
+        {
+            uint64_t false_positives;
+            uint64_t rehashed_buckets;
+        };
+
+        bool enabled = false;
+
+        uint64_t inserts = 0;
+        uint64_t duplicates = 0;
+        uint64_t erases = 0;
+        uint64_t table_full = 0;
+        // keys displaced by cuckoopath_move, summed over all inserts
+        uint64_t kicks = 0;
+        // depth of each path returned by cuckoopath_search
+        histogram bfs_depth{};
+        // number of keys actually moved by each successful cuckoopath_move
+        histogram move_length{};
+
+        uint64_t finds = 0;
+        uint64_t find_probes = 0;
+        uint64_t lookups = 0;
+        uint64_t lookup_probes = 0;
+
+        std::vector<lookup_round> rounds;
+        // seed value -> number of buckets using it
+        std::map<uint16_t, uint64_t> seeds;
+
+        std::string to_json() const
+        {
+            std::stringstream ss;
+            ss << "{\"enabled\": " << (enabled ? "true" : "false")
+               << ", \"inserts\": " << inserts
+               << ", \"duplicates\": " << duplicates
+               << ", \"erases\": " << erases
+               << ", \"table_full\": " << table_full
+               << ", \"kicks\": " << kicks
+               << ", \"bfs_depth\": ";
+            json_array(ss, bfs_depth);
+            ss << ", \"move_length\": ";
+            json_array(ss, move_length);
+            ss << ", \"finds\": " << finds
+               << ", \"find_probes\": " << find_probes
+               << ", \"lookups\": " << lookups
+               << ", \"lookup_probes\": " << lookup_probes
+               << ", \"rounds\": [";
+            for (std::size_t i = 0; i < rounds.size(); ++i)
+            {
+                ss << (i ? ", " : "") << "{\"false_positives\": " << rounds[i].false_positives
+                   << ", \"rehashed_buckets\": " << rounds[i].rehashed_buckets << "}";
+            }
+            ss << "], \"seeds\": {";
+            bool first = true;
+            for (auto &k : seeds)
+            {
+                ss << (first ? "" : ", ") << "\"" << k.first << "\": " << k.second;
+                first = false;
+            }
+            ss << "}}";
+            return ss.str();
+        }
+
+        static void record(histogram &h, std::size_t len)
+        {
+            h[len < HISTOGRAM_SIZE ? len : HISTOGRAM_SIZE - 1]++;
+        }
+
+    private:
+        static void json_array(std::stringstream &ss, const histogram &h)
+        {
+            ss << "[";
+            for (std::size_t i = 0; i < h.size(); ++i)
+                ss << (i ? ", " : "") << h[i];
+            ss << "]";
+        }
+    };
+
+    /**
+     * hooks called by cuckoo_hashtable at each interesting event. The disabled
+     * specialization has no state and every hook is an empty inline function.
+     * The table derives from its recorder, so the disabled one takes no space,
+     * and the hooks are const so const lookups can record.
+     */
+    template <bool Enabled>
+    class stats_recorder
+    {
+    public:
+        static constexpr bool enabled = false;
+
+        void on_insert(uint64_t = 1) const {}
+        void on_duplicate() const {}
+        void on_erase() const {}
+        void on_table_full() const {}
+        void on_bfs_path(int) const {}
+        void on_path_move(std::size_t) const {}
+        void on_find(std::size_t) const {}
+        void on_lookup(std::size_t) const {}
+        void on_round_start() const {}
+        void on_false_positive(uint64_t = 1) const {}
+        void on_rehash(uint64_t) const {}
+
+        table_stats snapshot() const { return table_stats(); }
+    };
+    static_assert(std::is_empty<stats_recorder<false>>::value, "the disabled recorder must take no space");
+
+    /**
+     * The enabled recorder keeps its counters in relaxed atomics, since
+     * find() and lookup() record from every thread querying the table at
+     * once. The rounds are only recorded by the build, which is not run
+     * concurrently with anything else.
+     */
+    template <>
+    class stats_recorder<true>
+    {
+    public:
+        static constexpr bool enabled = true;
+
+        void on_insert(uint64_t n = 1) const { add(inserts_, n); }
+        void on_duplicate() const { add(duplicates_, 1); }
+        void on_erase() const { add(erases_, 1); }
+        void on_table_full() const { add(table_full_, 1); }
+        void on_bfs_path(int depth) const { record(bfs_depth_, depth); }
+        void on_path_move(std::size_t len) const
+        {
+            add(kicks_, len);
+            record(move_length_, len);
+        }
+        void on_find(std::size_t probes) const
+        {
+            add(finds_, 1);
+            add(find_probes_, probes);
+        }
+        void on_lookup(std::size_t probes) const
+        {
+            add(lookups_, 1);
+            add(lookup_probes_, probes);
+        }
+        void on_round_start() const { rounds_.push_back({0, 0}); }
+        void on_false_positive(uint64_t n = 1) const
+        {
+            if (!rounds_.empty())
+                rounds_.back().false_positives += n;
+        }
+        void on_rehash(uint64_t buckets) const
+        {
+            if (!rounds_.empty())
+                rounds_.back().rehashed_buckets += buckets;
+        }
+
+        table_stats snapshot() const
+        {
+            table_stats s;
+            s.enabled = true;
+            s.inserts = inserts_.load(std::memory_order_relaxed);
+            s.duplicates = duplicates_.load(std::memory_order_relaxed);
+            s.erases = erases_.load(std::memory_order_relaxed);
+            s.table_full = table_full_.load(std::memory_order_relaxed);
+            s.kicks = kicks_.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < table_stats::HISTOGRAM_SIZE; ++i)
+            {
+                s.bfs_depth[i] = bfs_depth_[i].load(std::memory_order_relaxed);
+                s.move_length[i] = move_length_[i].load(std::memory_order_relaxed);
+            }
+            s.finds = finds_.load(std::memory_order_relaxed);
+            s.find_probes = find_probes_.load(std::memory_order_relaxed);
+            s.lookups = lookups_.load(std::memory_order_relaxed);
+            s.lookup_probes = lookup_probes_.load(std::memory_order_relaxed);
+            s.rounds = rounds_;
+            return s;
+        }
+
+    private:
+        using counter = std::atomic<uint64_t>;
+        using histogram = std::array<counter, table_stats::HISTOGRAM_SIZE>;
+
+        static void add(counter &c, uint64_t n) { c.fetch_add(n, std::memory_order_relaxed); }
+        static void record(histogram &h, std::size_t len)
+        {
+            add(h[len < table_stats::HISTOGRAM_SIZE ? len : table_stats::HISTOGRAM_SIZE - 1], 1);
+        }
+
+        mutable counter inserts_{0}, duplicates_{0}, erases_{0}, table_full_{0}, kicks_{0};
+        mutable histogram bfs_depth_{}, move_length_{};
+        mutable counter finds_{0}, find_probes_{0}, lookups_{0}, lookup_probes_{0};
+        mutable std::vector<table_stats::lookup_round> rounds_;
+    };
+} // namespace cuckoohashtable
+
+#endif // CUCKOO_TABLE_STATS_HH
@@ -9,11 +9,18 @@
 
 using namespace std;
 
+// keeps a hashtable and a filter with identical layouts, inserting into both
+// key by key
 template <typename KeyType, size_t bits_per_fp, class Hash = CityHasher<KeyType>>
 class cuckoo_pair
 {
-    cuckoohashtable::cuckoo_hashtable<KeyType> *table_; // , CityHasher<KeyType>
-    cuckoofilter::CuckooFilter<KeyType, bits_per_fp> *filter_;
+    using table_t = cuckoohashtable::cuckoo_hashtable<KeyType, bits_per_fp, Hash>;
+    using filter_t = cuckoofilter::CuckooFilter<KeyType, bits_per_fp, Hash>;
+
+    table_t *table_;
+    filter_t *filter_;
+    // reused by every insert
+    typename table_t::paired_path path_;
 private:
     size_t num_items_;
     size_t size_;
@@ -22,30 +29,31 @@ public:
     explicit cuckoo_pair(const size_t n) : num_items_(n)
     {
         size_ = n / 0.95;
-        table_ = new cuckoohashtable::cuckoo_hashtable<KeyType>(size_);
-        filter_ = new cuckoofilter::CuckooFilter<KeyType, bits_per_fp>(size_, table_->hash_function(), table_->bucket_count());
+        table_ = new table_t(size_);
+        filter_ = new filter_t(size_, table_->get_seeds());
     }
 
+    cuckoo_pair(const cuckoo_pair &) = delete;
+    cuckoo_pair &operator=(const cuckoo_pair &) = delete;
+
     ~cuckoo_pair()
     {
-        // delete table_;
-        // delete filter_;
+        delete table_;
+        delete filter_;
     }
 
-    void insert(const KeyType &key)
+    // returns Ok if the key is in both afterwards, including when it already
+    // was, and NotSupported if the filter could not replay the table's insert
+    // and no longer mirrors it
+    cuckoofilter::Status insert(const KeyType &key)
     {
-        // first insert key into hashtable to get storage location (index & slot)
-        stack<pair<size_t, size_t>> cuckoo_trail = table_->paired_insert(key);
+        // first insert key into hashtable to get storage location (index &
+        // slot) and the keys moved to make room
+        if (!table_->paired_insert(key, path_))
+            return cuckoofilter::Ok; // already present
 
-        // if(cuckoo_trail.size() > 1) {
-        //     cout << "cuckoo trail for CF\n";
-        // }
-        // cout  << cuckoo_trail.top().first << ", " << cuckoo_trail.top().second << "\n";
-
-        // insert at same corresponding location in filter
-        assert(filter_->PairedInsert(key, cuckoo_trail) == cuckoofilter::Ok);
-        // cout << "lup after ins\n";
-        assert(filter_->Contain(key) == cuckoofilter::Ok);
+        // replay the moves and the insert in the filter
+        return filter_->PairedInsert(key, path_);
     }
 
     bool lookup(const KeyType &key)
@@ -60,9 +68,12 @@ public:
         return filter_->Contain(key) == cuckoofilter::Ok;
     }
 
+    const table_t &table() const { return *table_; }
+    const filter_t &filter() const { return *filter_; }
+
     void info()
     {
-        table_->info();
+        cout << table_->info();
         cout << filter_->Info() << "\n";
     }
 
@@ -0,0 +1,253 @@
+#ifndef EPOCH_SET_HH
+#define EPOCH_SET_HH
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "buildpipeline.hh"
+#include "cuckoofilter/src/cuckoofilter.h"
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
+
+// the month of a Unix time in UTC, counted from January 1970: the epoch of a
+// certificate expiring then
+inline uint32_t expiry_month(const int64_t unix_seconds)
+{
+    const time_t t = unix_seconds;
+    struct tm parts;
+    gmtime_r(&t, &parts);
+    return uint32_t((parts.tm_year - 70) * 12 + parts.tm_mon);
+}
+
+/**
+ * epoch_filter_set keeps the revoked keys of each expiry epoch in a seeded
+ * table and filter of their own:
+ *
+ *   add            files keys under their epochs, which the next build
+ *                  rebuilds from all of their keys
+ *   build          rebuilds the epochs added to since the last build, each
+ *                  as a task on a task_pool, so new revocations rebuild only
+ *                  the epochs they expire in
+ *   expire_before  drops whole epochs, keys and filter, once they expire
+ *   contain        probes every epoch: the candidate buckets of a batch of
+ *                  PROBE_BATCH epochs are all prefetched before any is
+ *                  tested, so their cache misses overlap
+ *
+ * Since a query probes every epoch, each epoch's false positives are
+ * eliminated for all of S rather than for the keys of S expiring with it.
+ * Each of E epochs then sees E times the keys of S per bucket that one
+ * filter of every key would, and the seed search grows exponentially in the
+ * fingerprints they match, so bits_per_key should be about log2(E) above
+ * what one filter would use. An epoch's keys are kept to rebuild it, and
+ * keys added since its last build are not found until the next one.
+ */
+template <typename KeyType, typename Hash, std::size_t bits_per_key = 12>
+class epoch_filter_set
+{
+public:
+    typedef cuckoohashtable::cuckoo_hashtable<KeyType, bits_per_key, Hash> table_type;
+    typedef cuckoofilter::CuckooFilter<KeyType, bits_per_key, Hash> filter_type;
+
+    static constexpr size_t PROBE_BATCH = 16;
+
+    /**
+     * @param max_load the load factor each epoch's table is sized for
+     * @param max_seed the seed cap of each epoch's table, see
+     * cuckoo_hashtable::set_max_seed
+     */
+    explicit epoch_filter_set(const double max_load = 0.95,
+                              const uint16_t max_seed = std::numeric_limits<uint16_t>::max())
+        : max_load_(max_load), max_seed_(max_seed) {}
+
+    // files n keys under epoch
+    void add(const uint32_t epoch, const KeyType *keys, const size_t n)
+    {
+        epoch_state &e = epochs_[epoch];
+        e.keys.insert(e.keys.end(), keys, keys + n);
+        e.dirty = true;
+    }
+
+    // files each of n keys under its epoch in epochs
+    void add(const KeyType *keys, const uint32_t *epochs, const size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            epoch_state &e = epochs_[epochs[i]];
+            e.keys.push_back(keys[i]);
+            e.dirty = true;
+        }
+    }
+
+    /**
+     * Rebuilds every epoch added to since its last build, one task per epoch
+     * on @p pool, and eliminates its false positives for @p s on that task.
+     *
+     * @param s array of keys known not to be in any epoch
+     * @param n number of keys in @p s
+     * @return the number of epochs rebuilt
+     * @throw std::logic_error if an epoch's filter cannot be copied out of
+     * its table; the epochs not yet rebuilt stay marked for the next build
+     */
+    size_t build(task_pool &pool, const KeyType *s, const size_t n)
+    {
+        task_pool::task_group group;
+        size_t rebuilt = 0;
+        for (auto &e : epochs_)
+        {
+            if (!e.second.dirty)
+                continue;
+            epoch_state *state = &e.second;
+            pool.submit(group, [this, state, s, n] { build_epoch(*state, s, n); });
+            rebuilt++;
+        }
+        try
+        {
+            pool.wait(group);
+        }
+        catch (...)
+        {
+            refresh();
+            throw;
+        }
+        refresh();
+        return rebuilt;
+    }
+
+    // drops every epoch before @p epoch, and returns how many were dropped
+    size_t expire_before(const uint32_t epoch)
+    {
+        const auto end = epochs_.lower_bound(epoch);
+        const size_t dropped = std::distance(epochs_.begin(), end);
+        epochs_.erase(epochs_.begin(), end);
+        refresh();
+        return dropped;
+    }
+
+    // whether some epoch's filter contains key
+    bool contain(const KeyType &key) const
+    {
+        typename filter_type::Probe probes[PROBE_BATCH];
+        for (size_t begin = 0; begin < live_.size(); begin += PROBE_BATCH)
+        {
+            const size_t count = std::min(PROBE_BATCH, live_.size() - begin);
+            for (size_t i = 0; i < count; ++i)
+                live_[begin + i]->Prefetch(key, &probes[i]);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (live_[begin + i]->Contain(key, probes[i]) == cuckoofilter::Ok)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // whether the filter of @p epoch contains key, for a key whose expiry is
+    // known
+    bool contain(const KeyType &key, const uint32_t epoch) const
+    {
+        const filter_type *f = filter(epoch);
+        return f && f->Contain(key) == cuckoofilter::Ok;
+    }
+
+    // the filter of @p epoch as of its last build, or nullptr if it has none
+    const filter_type *filter(const uint32_t epoch) const
+    {
+        const auto it = epochs_.find(epoch);
+        return it == epochs_.end() ? nullptr : it->second.filter.get();
+    }
+
+    size_t num_epochs() const { return epochs_.size(); }
+
+    // the number of keys filed under all epochs
+    size_t size() const
+    {
+        size_t n = 0;
+        for (const auto &e : epochs_)
+            n += e.second.keys.size();
+        return n;
+    }
+
+    // the tag bytes of every epoch's filter
+    size_t size_in_bytes() const
+    {
+        size_t bytes = 0;
+        for (const filter_type *f : live_)
+            bytes += f->SizeInBytes();
+        return bytes;
+    }
+
+private:
+    struct epoch_state
+    {
+        std::vector<KeyType> keys;
+        std::unique_ptr<filter_type> filter;
+        bool dirty = false;
+    };
+
+    // builds a table of the epoch's keys, doubling it while it fills, and
+    // copies its filter out through a view of its partials, so the table is
+    // freed once its filter is made. A table has at least enough buckets
+    // that each seed of a bucket expects to match one key of S, since a
+    // small epoch's few buckets would otherwise see so many that its seed
+    // search grows exponentially (see autotune.hh).
+    void build_epoch(epoch_state &e, const KeyType *s, const size_t n) const
+    {
+        const size_t spb = table_type::slot_per_bucket();
+        size_t slots = std::max(size_t(e.keys.size() / max_load_) + 1, (2 * n * spb >> bits_per_key) * spb);
+        std::unique_ptr<table_type> table;
+        while (true)
+        {
+            table.reset(new table_type(slots));
+            try
+            {
+                for (const KeyType &k : e.keys)
+                    table->insert(k);
+                break;
+            }
+            catch (const std::out_of_range &)
+            {
+                slots = table->capacity() * 2;
+            }
+        }
+        table->set_max_seed(max_seed_);
+        table->eliminate_false_positives(s, n, 1);
+
+        filter_type view(table->packed_partials(), table->get_seeds(), table->size());
+        view.Exclude(table->spilled().data(), table->spilled().size());
+        std::stringstream data;
+        std::unique_ptr<filter_type> filter(new filter_type(1));
+        if (view.Serialize(data) != cuckoofilter::Ok || filter->Deserialize(data) != cuckoofilter::Ok)
+            throw std::logic_error("epoch filter could not be copied out of its table");
+        e.filter = std::move(filter);
+        e.dirty = false;
+    }
+
+    // lists the epochs that have a filter, for contain
+    void refresh()
+    {
+        live_.clear();
+        for (const auto &e : epochs_)
+        {
+            if (e.second.filter)
+                live_.push_back(e.second.filter.get());
+        }
+    }
+
+    double max_load_;
+    uint16_t max_seed_;
+    std::map<uint32_t, epoch_state> epochs_;
+    // the filters of epochs_, in epoch order
+    std::vector<const filter_type *> live_;
+};
+
+template <typename KeyType, typename Hash, std::size_t bits_per_key>
+constexpr size_t epoch_filter_set<KeyType, Hash, bits_per_key>::PROBE_BATCH;
+
+#endif // EPOCH_SET_HH
@@ -1,56 +1,218 @@
+#include "autotune.hh"
+#include "buildpipeline.hh"
+#include "epochset.hh"
+#include "keygen.hh"
+#include "partitionedbuild.hh"
+#include "cuckoofilter/src/binaryfusefilter.h"
 #include "cuckoofilter/src/cuckoofilter.h"
 
 #include <math.h>
+#include <chrono>
 #include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
 
 #include "cuckoohashtable/city_hasher.hh"
 #include "cuckoohashtable/hashtable/cuckoohashtable.hh"
 
 using namespace std;
 
-// generate n 64-bit random numbers for running insert & lookup
-void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
+// the seed of every generated key set (see keygen.hh); R is stream 0 and S
+// stream 1 of it, or for certificates, the first and the rest of a population
+const uint64_t KEY_SEED = 1;
+
+// generate n 64-bit random numbers for running insert & lookup, from stream
+// of KEY_SEED on every thread
+void random_gen(uint64_t stream, size_t n, vector<uint64_t> &store)
+{
+    store.resize(n);
+    random_keys(KEY_SEED, stream, store.data(), n);
+}
+
+// exits with an error naming what failed unless status is Ok, so filter
+// calls are checked in builds with NDEBUG too
+void check_status(const cuckoofilter::Status status, const char *what)
+{
+    if (status != cuckoofilter::Ok)
+    {
+        cerr << "ERROR: " << what << " failed with status " << status << "\n";
+        exit(1);
+    }
+}
+
+// generate certificates first .. first + n - 1 of certs (issuer SPKI hash +
+// DER serial) and reduce them to digests in batches, so the raw bytes are
+// hashed only once
+void cert_digests(const cert_population &certs, uint64_t first, size_t n, cuckoofilter::Digest128 *store)
+{
+    const size_t batch = 1 << 16;
+    vector<string> keys;
+    string serial;
+    for (size_t begin = 0; begin < n; begin += batch)
+    {
+        const size_t count = min(batch, n - begin);
+        keys.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t issuer;
+            certs.certificate(first + begin + i, issuer, serial);
+            keys[i] = cuckoofilter::HashUtil::CertKey(certs.issuer(issuer), serial);
+        }
+        cuckoofilter::HashUtil::Digest128Batch(keys.data(), count, &store[begin]);
+    }
+}
+
+// the digests of certificates first .. first + n - 1 of certs, on every thread
+void cert_gen(const cert_population &certs, uint64_t first, size_t n, vector<cuckoofilter::Digest128> &store)
 {
     store.resize(n);
-    for (int i = 0; i < n; i++)
-        store[i] = (uint64_t(rd()) << 32) + rd();
+    parallel_ranges(n, 0, [&](size_t begin, size_t end) {
+        cert_digests(certs, first + begin, end - begin, &store[begin]);
+    });
 }
 
+// seeded hash used by the table and filter for each key type
 template <typename KeyType>
-vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, vector<KeyType> &s, vector<vector<KeyType>> &fp_table, FILE *file)
+struct KeyHasher
 {
-    cuckoohashtable::cuckoo_hashtable<KeyType, 12, CityHasher<KeyType>> table(init_size);
+    typedef CityHasher<KeyType> type;
+};
 
-    // add set R to table
-    for (KeyType c : r)
+template <>
+struct KeyHasher<cuckoofilter::Digest128>
+{
+    typedef cuckoofilter::Digest128Hash type;
+};
+
+template <typename KeyType>
+using HashTable = cuckoohashtable::cuckoo_hashtable<KeyType, 12, typename KeyHasher<KeyType>::type>;
+
+template <typename KeyType>
+using IndexedHashTable = cuckoohashtable::indexed_cuckoo_hashtable<KeyType, 12, typename KeyHasher<KeyType>::type>;
+
+// add set R to table, key by key, or with bulk in one sorted pass (see
+// cuckoo_hashtable::bulk_build), which is faster once the table outgrows the
+// cache and fills it further
+template <typename KeyType>
+void build_r(HashTable<KeyType> &table, vector<KeyType> &r, bool bulk)
+{
+    if (bulk)
     {
+        table.bulk_build(r.data(), r.size());
+        return;
+    }
+    for (KeyType c : r)
         table.insert(c);
+}
+
+// the indexed table stores positions in r, which must outlive the table
+template <typename KeyType>
+void build_r(IndexedHashTable<KeyType> &table, vector<KeyType> &r, bool bulk)
+{
+    vector<uint32_t> index(r.size());
+    iota(index.begin(), index.end(), 0);
+    if (bulk)
+    {
+        table.bulk_build(index.data(), index.size());
+        return;
     }
+    for (uint32_t i : index)
+        table.insert(i);
+}
 
-    // check for false negatives with set R
-    // size_t false_negs = 0;
-    for (KeyType c : r)
+// writes the table's checkpoint beside path and renames it over path, so a
+// crash while writing keeps the previous checkpoint
+template <typename Table>
+void write_checkpoint(const Table &table, const string &path)
+{
+    const string tmp = path + ".tmp";
     {
-        assert(table.lookup(c) >= 0);
-        assert(table.find(c).first >= 0); // first = index, second = slot
-        // if (table.lookup(c) < 0)
-        //     false_negs++;
+        ofstream out(tmp, ios::binary);
+        table.save_checkpoint(out);
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0)
+        perror("Couldn't write checkpoint");
+}
+
+// With a checkpoint path, a build resumes from the checkpoint there if there
+// is one, and saves one after R is inserted and after each lookup round with
+// false positives, before its rehash. The per-round and rehash stats written
+// to file cover only the rounds run since the resume.
+template <typename KeyType, typename Table>
+vector<uint16_t> hashtable_ops(Table &table, vector<KeyType> &r, vector<KeyType> &s, FILE *file, bool local_search, bool bulk,
+                               const char *checkpoint)
+{
+    int total_rehash = 0;
+    ifstream resume;
+    if (checkpoint)
+        resume.open(checkpoint, ios::binary);
+    if (resume.is_open())
+    {
+        table.load_checkpoint(resume);
+        cout << "resumed from " << checkpoint << " after " << table.num_rehashes() + 1 << " lookup rounds\n";
+        // resumed between a round's lookups and its rehash
+        if (table.rehash_pending())
+            total_rehash += table.rehash_buckets();
+    }
+    else
+    {
+        build_r(table, r, bulk);
+
+        // check for false negatives with set R; once lookup rounds have run,
+        // lookup would move the seeds of the buckets it matches
+        // size_t false_negs = 0;
+        for (KeyType c : r)
+        {
+            assert(table.lookup(c) >= 0);
+            assert(table.find(c).first >= 0); // first = index, second = slot
+            // if (table.lookup(c) < 0)
+            //     false_negs++;
+        }
+        // assert(false_negs == 0);
+
+        if (checkpoint)
+            write_checkpoint(table, checkpoint);
     }
-    // assert(false_negs == 0);
 
     // lookup set S and count false positives
 
     // track buckets needing rehash using a set
-    std::unordered_set<KeyType> rehashBSet;
-    int total_rehash = 0;
+    std::unordered_set<size_t> rehashBSet;
 
     /**
      * We check for false positives by looking up fingerprints using
      * mutually exclusive set S. Buckets yielding false positives are rehashed
      * with an incremented seed until no false positives remain from lookup.
+     *
+     * With local_search, each bucket with a false positive instead gathers
+     * every S key mapping to it and searches for a clean seed on its own, so
+     * a second lookup pass over S only verifies the result.
+     *
+     * Either way seeds stop at table.max_seed(), and the S keys still
+     * matching a bucket there are spilled for the filter to exclude.
      */
     fprintf(file, "lookup round, false positives, percent fp's\n");
-    while (1)
+    if (local_search)
+    {
+        vector<size_t> fps = table.eliminate_false_positives(s.data(), s.size());
+        for (size_t i = 0; i < fps.size(); i++)
+        {
+            double fp = (double)fps[i] * 100.0 / s.size();
+            cout << "pass " << i + 1 << " false positives: " << fps[i] << " out of " << s.size()
+                 << ", fp rate: " << fp << "%\n";
+            fprintf(file, "%lu, %lu, %.6f\n", i + 1, fps[i], fp);
+        }
+        for (size_t i = 0; i < table.bucket_count(); i++)
+        {
+            if (table.get_seed(i) > 0)
+            {
+                rehashBSet.insert(i);
+                total_rehash++;
+            }
+        }
+    }
+    while (!local_search)
     {
         size_t total_queries = 0;
         size_t false_queries = 0;
@@ -88,18 +250,40 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
         fprintf(file, "%lu, %lu, %.6f\n", table.num_rehashes() + 1, false_queries, fp);
 
         if (false_queries > 0)
+        {
+            if (checkpoint)
+                write_checkpoint(table, checkpoint);
             total_rehash += table.rehash_buckets();
+        }
         else
             break;
+
+        if (table.lookup_rounds_exhausted())
+        {
+            table.spill_false_positives(s.data(), s.size());
+            break;
+        }
     }
+    if (!table.spilled().empty())
+        cout << "spilled at seed " << table.max_seed() << ": " << table.spilled().size() << " keys of S\n";
+    // the build is complete, so the next run starts over
+    if (checkpoint)
+        remove(checkpoint);
 
     cout << table.info();
+    if (CUCKOO_STATS)
+        cout << "hashtable stats: " << table.stats().to_json() << "\n";
     fprintf(file, "\nslot per bucket, bucket count, capacity, load factor\n");
     fprintf(file, "%d, %lu, %lu, %.2f\n\n", table.slot_per_bucket(), table.bucket_count(), table.capacity(), table.load_factor() * 100.0);
     // table.bucketInfo();
 
     std::map<uint16_t, uint16_t> seed_map;
     table.seedInfo(seed_map);
+    cout << "rehashing seed map:\n(key : value) = # rehashes : # buckets\n";
+    for (auto &k : seed_map)
+        cout << "{" << k.first << ", " << k.second << "}\n";
+    cout << "total buckets: " << table.bucket_count() << "\nlookup rounds: " << table.lookup_rounds()
+         << ", elimination passes: " << table.elimination_passes() << "\n";
     fprintf(file, "rehashes per bucket, count\n");
     for (auto &k : seed_map)
     {
@@ -109,9 +293,7 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
     double avg_rehashes = (double)total_rehash / table.bucket_count();
     double rehash_percent = (double)rehashBSet.size() * 100.0 / table.bucket_count();
     fprintf(file, "\ntotal rehashes, max rehash, average per bucket, percent rehashed buckets\n");
-    fprintf(file, "%d, %lu, %.4f, %.3f\n\n", total_rehash, table.num_rehashes(), avg_rehashes, rehash_percent);
-
-    table.export_table(fp_table);
+    fprintf(file, "%d, %d, %.4f, %.3f\n\n", total_rehash, seed_map.rbegin()->first, avg_rehashes, rehash_percent);
 
     // size: 10k, hashpower: 12, hashmask: 4095
     // cout << "HT hashpower: " << table.hashpower() << " hashmask: " << table.hashmask(table.hashpower()) << "\n";
@@ -127,32 +309,10 @@ vector<uint16_t> hashtable_ops(const uint64_t &init_size, vector<KeyType> &r, ve
     return table.get_seeds();
 }
 
-template <typename KeyType>
-void create_filter(const uint64_t &init_size, vector<vector<KeyType>> &fp_table, vector<uint16_t> &seeds, vector<KeyType> &r, vector<KeyType> &s, FILE *file)
+// checks the filter has no false negatives on R and no false positives on S
+template <typename KeyType, typename Filter>
+void check_filter(const Filter &filter, vector<KeyType> &r, vector<KeyType> &s)
 {
-    cuckoofilter::CuckooFilter<KeyType, 12, CityHasher<KeyType>> filter(init_size, seeds);
-
-    // add Set R to filter
-    cout << "fp table size: " << fp_table.size() << "\n";
-    for (int i = 0; i < fp_table.size(); i++)
-    {
-        vector<KeyType> &b = fp_table.at(i);
-        // cout << "bucket size: " << b.size() << "\n";
-        // cout << "[ ";
-        for (int j = 0; j < b.size(); j++)
-        {
-            if (b.at(j) != 0)
-            {
-                // if (filter.CopyInsert(b.at(j), i, j) != cuckoofilter::Ok)
-                // {
-                //     cout << "ERROR: cannot copy " << b.at(j) << " into filter\n";
-                //     break;
-                // }
-                assert(filter.CopyInsert(b.at(j), i, j) == cuckoofilter::Ok);
-            }
-        }
-    }
-
     // check no false negatives - failing here with sizes above 10k :(
     cout << "\nChecking CF false negatives:\n";
     for (auto c : r)
@@ -183,6 +343,180 @@ void create_filter(const uint64_t &init_size, vector<vector<KeyType>> &fp_table,
     std::cout << "false positive rate is "
               << 100.0 * false_queries / total_queries << "%\n";
     cout << filter.Info() << "\n";
+    if (CUCKOO_STATS)
+        cout << "filter stats: " << filter.Stats().ToJson() << "\n";
+}
+
+template <typename KeyType, template <size_t> class TableType>
+void create_filter(const uint64_t &init_size, vector<vector<uint32_t>> &fp_table, vector<uint16_t> &seeds, const vector<KeyType> &spilled,
+                   vector<KeyType> &r, vector<KeyType> &s, FILE *file)
+{
+    cuckoofilter::CuckooFilter<KeyType, 12, typename KeyHasher<KeyType>::type, TableType> filter(init_size, seeds);
+    filter.Exclude(spilled.data(), spilled.size());
+
+    // add Set R to filter
+    cout << "fp table size: " << fp_table.size() << "\n";
+    for (int i = 0; i < fp_table.size(); i++)
+    {
+        vector<uint32_t> &b = fp_table.at(i);
+        // cout << "bucket size: " << b.size() << "\n";
+        // cout << "[ ";
+        for (int j = 0; j < b.size(); j++)
+        {
+            if (b.at(j) != 0)
+            {
+                check_status(filter.CopyInsert(b.at(j), i, j), "copying a tag into the filter");
+            }
+        }
+    }
+
+    check_filter(filter, r, s);
+}
+
+// queries the table's packed partials in place through a filter view, then
+// serializes the view and checks the filter read back from it
+template <typename KeyType, typename Table>
+void view_filter(const Table &table, vector<KeyType> &r, vector<KeyType> &s)
+{
+    typedef cuckoofilter::CuckooFilter<KeyType, 12, typename KeyHasher<KeyType>::type> Filter;
+
+    Filter view(table.packed_partials(), table.get_seeds(), table.size());
+    view.Exclude(table.spilled().data(), table.spilled().size());
+    check_filter(view, r, s);
+
+    stringstream out;
+    check_status(view.Serialize(out), "serializing the filter view");
+    cout << "serialized filter: " << out.str().size() << " bytes\n";
+    Filter filter(1);
+    check_status(filter.Deserialize(out), "deserializing the filter view");
+    check_filter(filter, r, s);
+}
+
+// an owning filter of the table's current partials, seeds and spilled keys
+template <typename KeyType>
+unique_ptr<cuckoofilter::CuckooFilter<KeyType, 12, typename KeyHasher<KeyType>::type>> table_filter(
+    const HashTable<KeyType> &table)
+{
+    typedef cuckoofilter::CuckooFilter<KeyType, 12, typename KeyHasher<KeyType>::type> Filter;
+
+    Filter view(table.packed_partials(), table.get_seeds(), table.size());
+    view.Exclude(table.spilled().data(), table.spilled().size());
+    stringstream out;
+    check_status(view.Serialize(out), "serializing the filter view");
+    unique_ptr<Filter> filter(new Filter(1));
+    check_status(filter->Deserialize(out), "deserializing the filter view");
+    return filter;
+}
+
+// builds the table and a filter of it, then expires R a quarter at a time:
+// each key is erased from the table and deleted from the filter where the
+// table held it, and both are compacted, the table rebuilding smaller once
+// its load allows. Reports the table and serialized filter after each step.
+template <typename KeyType>
+void run_expiry(const uint64_t &init_size, vector<KeyType> &r, vector<KeyType> &s, uint16_t max_seed)
+{
+    HashTable<KeyType> table(init_size);
+    table.set_max_seed(max_seed);
+    for (const KeyType &k : r)
+        table.insert(k);
+    table.eliminate_false_positives(s.data(), s.size());
+    auto filter = table_filter(table);
+
+    auto report = [&](size_t expired) {
+        for (size_t i = expired; i < r.size(); i++)
+            assert(filter->Contain(r[i]) == cuckoofilter::Ok);
+        for (const KeyType &l : s)
+            assert(filter->Contain(l) != cuckoofilter::Ok);
+        stringstream out;
+        check_status(filter->Serialize(out), "serializing the filter");
+        printf("expired %8lu: hashpower %2lu, load %5.1f%%, serialized filter %9lu bytes, %lu excluded\n", expired,
+               table.hashpower(), 100.0 * table.load_factor(), out.str().size(), table.spilled().size());
+    };
+    report(0);
+    size_t expired = 0;
+    for (int step = 1; step <= 3; step++)
+    {
+        const size_t end = r.size() * step / 4;
+        for (; expired < end; expired++)
+        {
+            const pair<int32_t, int32_t> pos = table.erase(r[expired]);
+            assert(pos.first >= 0);
+            check_status(filter->PairedDelete(r[expired], pos.first, pos.second), "deleting an expired key");
+        }
+        check_status(filter->Compact(), "compacting the filter");
+        if (table.compact(s.data(), s.size()))
+            filter = table_filter(table);
+        report(expired);
+    }
+}
+
+// R's expiry times are drawn uniformly from the 398 days, the longest TLS
+// certificate lifetime, from 2026-01-01 UTC, by stream 2 of KEY_SEED
+const int64_t EXPIRY_START = 1767225600;
+const int64_t EXPIRY_SPAN = 398 * 86400;
+
+// files R under its expiry months with 16-bit tags, 12 plus log2 of the
+// months (see epoch_filter_set), holding back every other key of the last
+// month, and builds every epoch. Then adds the held back keys as new
+// revocations, which rebuild only the last month, and expires the first
+// three months. Checks each state against R and S, reports it and times the
+// fused probe over S, which misses in every epoch.
+template <typename KeyType>
+void run_epochs(vector<KeyType> &r, vector<KeyType> &s, uint16_t max_seed)
+{
+    vector<uint64_t> expiry(r.size());
+    random_keys(KEY_SEED, 2, expiry.data(), expiry.size());
+    vector<uint32_t> epochs(r.size());
+    for (size_t i = 0; i < r.size(); i++)
+        epochs[i] = expiry_month(EXPIRY_START + int64_t(expiry[i] % EXPIRY_SPAN));
+    const uint32_t first = *min_element(epochs.begin(), epochs.end());
+    const uint32_t last = *max_element(epochs.begin(), epochs.end());
+
+    vector<KeyType> held;
+    epoch_filter_set<KeyType, typename KeyHasher<KeyType>::type, 16> set(0.95, max_seed);
+    for (size_t i = 0; i < r.size(); i++)
+    {
+        if (epochs[i] == last && i % 2)
+            held.push_back(r[i]);
+        else
+            set.add(&r[i], &epochs[i], 1);
+    }
+
+    task_pool pool(thread::hardware_concurrency());
+    uint32_t cut = first;
+    bool held_added = false;
+    auto step = [&](const char *name, size_t rebuilt, double seconds) {
+        // keys expired or not yet added are not in S, so may still match
+        for (size_t i = 0; i < r.size(); i++)
+        {
+            if (epochs[i] >= cut && (epochs[i] != last || i % 2 == 0 || held_added))
+                assert(set.contain(r[i]));
+        }
+        const auto start = chrono::steady_clock::now();
+        size_t false_queries = 0;
+        for (const KeyType &l : s)
+            false_queries += set.contain(l);
+        assert(false_queries == 0);
+        const double query_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%-7s epochs %2lu, keys %8lu, filter %9lu bytes, rebuilt %2lu in %7.3f s, fused probe %6.2f Mq/s\n",
+               name, set.num_epochs(), set.size(), set.size_in_bytes(), rebuilt, seconds,
+               s.size() / query_seconds / 1e6);
+    };
+
+    auto start = chrono::steady_clock::now();
+    size_t rebuilt = set.build(pool, s.data(), s.size());
+    step("build", rebuilt, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+    start = chrono::steady_clock::now();
+    set.add(last, held.data(), held.size());
+    rebuilt = set.build(pool, s.data(), s.size());
+    held_added = true;
+    step("revoke", rebuilt, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+    start = chrono::steady_clock::now();
+    cut = first + 3;
+    set.expire_before(cut);
+    step("expire", 0, chrono::duration<double>(chrono::steady_clock::now() - start).count());
 }
 
 /**
@@ -191,6 +525,249 @@ void create_filter(const uint64_t &init_size, vector<vector<KeyType>> &fp_table,
      * cout << key << " , cityhash: " << ch.operator()(key, seed);
     */
 
+// builds the table from R, eliminates false positives with S and copies the
+// result into a filter, or with view queries the table's partials in place
+template <typename KeyType>
+void run(const uint64_t &init_size, vector<KeyType> &r, vector<KeyType> &s, FILE *file, bool local_search, bool bulk, bool indexed,
+         bool morton, bool view, const char *checkpoint, uint16_t max_seed)
+{
+    typedef typename KeyHasher<KeyType>::type Hasher;
+
+    vector<vector<uint32_t>> fp_table;
+    vector<uint16_t> seeds;
+    vector<KeyType> spilled;
+    auto start = chrono::steady_clock::now();
+    double build_time;
+    if (indexed)
+    {
+        IndexedHashTable<KeyType> table(init_size, Hasher(), equal_to<KeyType>(),
+                                        allocator<uint32_t>(), cuckoohashtable::indexed_key_source<KeyType>(r.data()));
+        table.set_max_seed(max_seed);
+        seeds = hashtable_ops(table, r, s, file, local_search, bulk, checkpoint);
+        build_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        spilled = table.spilled();
+        if (view)
+            view_filter(table, r, s);
+        else
+            table.export_table(fp_table);
+    }
+    else
+    {
+        HashTable<KeyType> table(init_size);
+        table.set_max_seed(max_seed);
+        seeds = hashtable_ops(table, r, s, file, local_search, bulk, checkpoint);
+        build_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        spilled = table.spilled();
+        if (view)
+            view_filter(table, r, s);
+        else
+            table.export_table(fp_table);
+    }
+
+    cout << "table build time: " << build_time << " s\n";
+    if (view)
+        return;
+
+    /*
+    cout << "retrieved seeds: [ ";
+    for (auto i : seeds)
+    {
+        cout << i << " ";
+    }
+    cout << "]\n";
+    */
+
+    if (morton)
+        create_filter<KeyType, cuckoofilter::MortonTable>(init_size, fp_table, seeds, spilled, r, s, file);
+    else
+        create_filter<KeyType, cuckoofilter::SingleTable>(init_size, fp_table, seeds, spilled, r, s, file);
+}
+
+// Generators for the build pipeline: chunk c of a set holds its keys from
+// c * CHUNK_SIZE on, so chunks can be generated in any order and on any
+// thread, and the sets are the ones random_gen and cert_gen generate.
+const size_t CHUNK_SIZE = size_t(1) << 16;
+
+struct random_chunks
+{
+    uint64_t stream;
+    void operator()(size_t c, uint64_t *out, size_t n) const
+    {
+        random_keys(KEY_SEED, stream, c * CHUNK_SIZE, out, n);
+    }
+};
+
+struct cert_chunks
+{
+    uint64_t first;
+    const cert_population *certs;
+    void operator()(size_t c, cuckoofilter::Digest128 *out, size_t n) const
+    {
+        cert_digests(*certs, first + c * CHUNK_SIZE, n, out);
+    }
+};
+
+// generates R and S, builds the table and serializes its filter as
+// overlapping stages on a task pool, and reports each stage's time
+template <typename KeyType, typename Generator>
+void run_pipeline(const uint64_t &init_size, size_t size, Generator gen_r, Generator gen_s, uint16_t max_seed)
+{
+    typedef cuckoofilter::CuckooFilter<KeyType, 12, typename KeyHasher<KeyType>::type> Filter;
+
+    task_pool pool(thread::hardware_concurrency());
+    HashTable<KeyType> table(init_size);
+    table.set_max_seed(max_seed);
+    vector<KeyType> r, s;
+    ofstream out("cuckoo_filter.bin", ios::binary);
+    const pipeline_report report = run_build_pipeline<Filter>(pool, table, r, size, s, size * 100, gen_r, gen_s, out,
+                                                               CHUNK_SIZE);
+
+    cout << table.info();
+    cout << "pipeline on " << pool.num_threads() << " threads\n";
+    cout << "stage            start (s)   wall (s)    cpu (s)\n";
+    for (const stage_time &t : report.stages)
+        printf("%-15s %10.3f %10.3f %10.3f\n", t.name.c_str(), t.start, t.wall, t.cpu);
+    printf("%-15s %10.3f %10.3f %10.3f\n", "total", 0.0, report.wall, report.cpu);
+    cout << "serialized filter: " << report.serialized_bytes << " bytes\n";
+    cout << "false negatives: " << report.false_negatives << "\n";
+    std::cout << "false positive rate is "
+              << 100.0 * report.false_positives / s.size() << "%\n";
+}
+
+// builds the filter a partition of the buckets at a time, spilling R and S to
+// partition files in the working directory (see partitionedbuild.hh), then
+// reads cuckoo_filter.bin back and checks it against regenerated R and S
+//
+// Both buckets of a key lie in one chunk of 2^8 buckets under the local index
+// policies, and a partition holds whole chunks, so no key crosses partitions.
+template <typename KeyType, typename Generator>
+void run_partitioned(const uint64_t &init_size, size_t size, Generator gen_r, Generator gen_s, uint16_t max_seed)
+{
+    typedef typename KeyHasher<KeyType>::type Hasher;
+    typedef cuckoohashtable::local_index_policy<cuckoohashtable::raw_index_policy> IndexPolicy;
+    typedef cuckoofilter::CuckooFilter<KeyType, 12, Hasher, cuckoofilter::SingleTable,
+                                       cuckoofilter::LocalIndex<cuckoofilter::RawIndex>>
+        Filter;
+    const size_t partition_bits = 4;
+    const size_t chunk_size = CHUNK_SIZE;
+
+    // the hashpower HashTable<KeyType>(init_size) would have
+    size_t hashpower = 0;
+    while ((uint64_t(1) << hashpower) * 4 < init_size)
+        hashpower++;
+
+    partitioned_report report;
+    {
+        ofstream out("cuckoo_filter.bin", ios::binary);
+        report = run_partitioned_build<KeyType, 12, Hasher, IndexPolicy>(hashpower, partition_bits, size, size * 100, gen_r,
+                                                                         gen_s, ".", out, thread::hardware_concurrency(),
+                                                                         chunk_size, max_seed);
+    }
+    cout << report.partitions << " partitions of " << (size_t(1) << (hashpower - partition_bits)) << " buckets\n";
+    cout << "keys stored: " << report.num_items << ", cross-partition: " << report.cross_keys
+         << ", deferred: " << report.deferred_keys << "\n";
+    cout << "most keys of S in memory: " << report.max_partition_s << " of " << size * 100 << "\n";
+    if (report.spilled_keys > 0)
+        cout << "spilled at seed " << max_seed << ": " << report.spilled_keys << " keys of S\n";
+    printf("route: %.3f s, build: %.3f s\n", report.route_seconds, report.build_seconds);
+    cout << "serialized filter: " << report.output_bytes << " bytes\n";
+
+    Filter filter(1);
+    ifstream in("cuckoo_filter.bin", ios::binary);
+    check_status(filter.Deserialize(in), "reading the partitioned filter");
+    vector<KeyType> chunk(chunk_size);
+    size_t false_negatives = 0, false_positives = 0;
+    for (size_t begin = 0; begin < size; begin += chunk_size)
+    {
+        const size_t n = min(chunk_size, size - begin);
+        gen_r(begin / chunk_size, chunk.data(), n);
+        for (size_t i = 0; i < n; i++)
+            false_negatives += filter.Contain(chunk[i]) != cuckoofilter::Ok;
+    }
+    for (size_t begin = 0; begin < size * 100; begin += chunk_size)
+    {
+        const size_t n = min(chunk_size, size * 100 - begin);
+        gen_s(begin / chunk_size, chunk.data(), n);
+        for (size_t i = 0; i < n; i++)
+            false_positives += filter.Contain(chunk[i]) == cuckoofilter::Ok;
+    }
+    cout << "false negatives: " << false_negatives << "\n";
+    std::cout << "false positive rate is "
+              << 100.0 * false_positives / (size * 100) << "%\n";
+}
+
+// predicts the shipped bytes and build time of each tag width, bucket size,
+// load and seed width from builds on samples of R and S (see autotune.hh),
+// and prints them with the Pareto-optimal ones before the build starts. The
+// build below still uses 12-bit tags, 4 slots and the load from main.
+template <typename KeyType>
+void tune(const vector<KeyType> &r, const vector<KeyType> &s)
+{
+    auto start = chrono::steady_clock::now();
+    const vector<tune_estimate> estimates =
+        autotune<KeyType, typename KeyHasher<KeyType>::type>(r.data(), r.size(), s.data(), s.size(), r.size(), s.size());
+    auto print = [&](const tune_estimate &e) {
+        const tune_config &c = e.config;
+        char target[16];
+        if (c.max_target_load > c.target_load)
+            snprintf(target, sizeof(target), "%.2f-%.2f", c.target_load, c.max_target_load);
+        else
+            snprintf(target, sizeof(target), "%.2f", c.target_load);
+        printf("%4lu %5lu %9s %6.2f %5lu", c.bits_per_key, c.slots_per_bucket, target, c.load, c.seed_bits);
+        if (!e.feasible)
+        {
+            printf("   infeasible\n");
+            return;
+        }
+        printf(" %11.0f %10.0f %10.0f %11.0f %8.3f %7.3f\n", e.tag_bytes, e.seed_bytes, e.exclusion_bytes,
+               e.total_bytes(), 8 * e.total_bytes() / r.size(), e.build_seconds);
+    };
+    const char *header =
+        "bits slots    target   load seedb   tag bytes seed bytes excl bytes total bytes  bit/key build s\n";
+    printf("%s", header);
+    for (const tune_estimate &e : estimates)
+        print(e);
+    printf("target loads that round to the same power-of-two bucket count are built once, at the load shown\n");
+
+    // the smallest shippable configuration heads its front
+    const vector<tune_estimate> front = pareto_front(estimates, true);
+    printf("\npareto front of shippable configurations (4 slots):\n%s", header);
+    for (const tune_estimate &e : front)
+        print(e);
+    const vector<tune_estimate> unshippable = pareto_front(estimates, false);
+    printf("\npareto front of other bucket sizes, which CuckooFilter cannot hold:\n%s", header);
+    for (const tune_estimate &e : unshippable)
+        print(e);
+    cout << "tuning time: " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s\n\n";
+}
+
+// builds a cascade of binary fuse filters over R and S instead, to compare
+// bits per key of R and build time with the seeded filter
+template <typename KeyType>
+void run_fuse(vector<KeyType> &r, vector<KeyType> &s)
+{
+    cuckoofilter::BinaryFuseCascade<KeyType, uint8_t, typename KeyHasher<KeyType>::type> cascade;
+    auto start = chrono::steady_clock::now();
+    if (cascade.Build(r.data(), r.size(), s.data(), s.size()) != cuckoofilter::Ok)
+    {
+        cout << "ERROR: cannot build the cascade\n";
+        return;
+    }
+    cout << "cascade build time: " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s\n";
+
+    cout << "\nChecking cascade false negatives:\n";
+    for (auto c : r)
+        assert(cascade.Contain(c) == cuckoofilter::Ok);
+
+    size_t false_queries = 0;
+    for (auto l : s)
+        false_queries += cascade.Contain(l) == cuckoofilter::Ok;
+    std::cout << "false positive rate is "
+              << 100.0 * false_queries / s.size() << "%\n";
+    cout << cascade.Info();
+    cout << "\t\tbit/key:   " << 8.0 * cascade.SizeInBytes() / r.size() << "\n";
+}
+
 int main(int argc, char **argv)
 {
     if (argc <= 1)
@@ -199,18 +776,56 @@ int main(int argc, char **argv)
         return {};
     }
 
-    typedef uint64_t KeyType;
-    vector<KeyType> r;
-    vector<KeyType> s;
-
     uint64_t size = atoi(argv[1]); // 240000 for ~91% load factor
+    // optional flags after the size: "local" uses per-bucket seed search
+    // instead of rounds, "indexed" stores 32-bit indices into R in the table,
+    // "cert" uses digests of certificate-like keys instead of 64-bit integers,
+    // "morton" stores the filter in a MortonTable instead of a SingleTable,
+    // "fuse" builds a binary fuse filter cascade instead of the seeded filter,
+    // "view" queries the table's packed partials instead of a copied filter,
+    // "pipeline" overlaps generation, build, serialization and verification
+    // on a task pool (see buildpipeline.hh), "checkpoint" saves the table to
+    // cuckoo_checkpoint.bin during the build and resumes from it if present,
+    // "partitioned" builds a range of buckets at a time with R and S spilled
+    // to disk (see partitionedbuild.hh), "cap" caps seeds and lookup rounds
+    // at 3 and excludes the remaining false positives in the filter, "tune"
+    // prints the predicted size and build time of other configurations first,
+    // "expire" removes R from the table and filter in steps and compacts them,
+    // "epochs" keeps a table and filter per expiry month (see epochset.hh),
+    // "bulk" builds R with cuckoo_hashtable::bulk_build
+    bool local_search = false;
+    bool bulk = false;
+    bool indexed = false;
+    bool cert = false;
+    bool morton = false;
+    bool fuse = false;
+    bool view = false;
+    bool pipeline = false;
+    bool checkpoint = false;
+    bool partitioned = false;
+    bool cap = false;
+    bool tune_first = false;
+    bool expire = false;
+    bool by_epoch = false;
+    for (int i = 2; i < argc; i++)
+    {
+        local_search |= string(argv[i]) == "local";
+        bulk |= string(argv[i]) == "bulk";
+        indexed |= string(argv[i]) == "indexed";
+        cert |= string(argv[i]) == "cert";
+        morton |= string(argv[i]) == "morton";
+        fuse |= string(argv[i]) == "fuse";
+        view |= string(argv[i]) == "view";
+        pipeline |= string(argv[i]) == "pipeline";
+        checkpoint |= string(argv[i]) == "checkpoint";
+        partitioned |= string(argv[i]) == "partitioned";
+        cap |= string(argv[i]) == "cap";
+        tune_first |= string(argv[i]) == "tune";
+        expire |= string(argv[i]) == "expire";
+        by_epoch |= string(argv[i]) == "epochs";
+    }
 
-    int seed = 1;
-    mt19937 rd(seed);
-
-    // 64-bit random numbers to insert and lookup -> lookup_size = insert_size * 100
-    random_gen(size, r, rd);
-    random_gen(size * 100, s, rd);
+    const uint16_t max_seed = cap ? 3 : numeric_limits<uint16_t>::max();
 
     // max load factor of 95%
     double max_lf = 0.95;
@@ -227,19 +842,67 @@ int main(int argc, char **argv)
     fprintf(file, "insert size, lookup size, init size, max percent load factor\n");
     fprintf(file, "%lu, %lu, %lu, %.1f\n\n", size, size * 100, init_size, max_lf * 100);
 
-    vector<vector<KeyType>> fp_table;
-    vector<uint16_t> seeds = hashtable_ops(init_size, r, s, fp_table, file);
-
-    /*
-    cout << "retrieved seeds: [ ";
-    for (auto i : seeds)
+    // keys to insert and lookup -> lookup_size = insert_size * 100
+    if (cert)
     {
-        cout << i << " ";
+        // R and S are disjoint parts of one population of certificates
+        const cert_population certs(KEY_SEED, size * 101);
+        vector<cuckoofilter::Digest128> r, s;
+        if (pipeline)
+        {
+            run_pipeline<cuckoofilter::Digest128>(init_size, size, cert_chunks{0, &certs}, cert_chunks{size, &certs}, max_seed);
+            fclose(file);
+            return 0;
+        }
+        if (partitioned)
+        {
+            run_partitioned<cuckoofilter::Digest128>(init_size, size, cert_chunks{0, &certs}, cert_chunks{size, &certs}, max_seed);
+            fclose(file);
+            return 0;
+        }
+        cert_gen(certs, 0, size, r);
+        cert_gen(certs, size, size * 100, s);
+        if (tune_first)
+            tune(r, s);
+        if (fuse)
+            run_fuse(r, s);
+        else if (expire)
+            run_expiry(init_size, r, s, max_seed);
+        else if (by_epoch)
+            run_epochs(r, s, max_seed);
+        else
+            run(init_size, r, s, file, local_search, bulk, indexed, morton, view,
+                checkpoint ? "cuckoo_checkpoint.bin" : nullptr, max_seed);
+    }
+    else
+    {
+        if (pipeline)
+        {
+            run_pipeline<uint64_t>(init_size, size, random_chunks{0}, random_chunks{1}, max_seed);
+            fclose(file);
+            return 0;
+        }
+        if (partitioned)
+        {
+            run_partitioned<uint64_t>(init_size, size, random_chunks{0}, random_chunks{1}, max_seed);
+            fclose(file);
+            return 0;
+        }
+        vector<uint64_t> r, s;
+        random_gen(0, size, r);
+        random_gen(1, size * 100, s);
+        if (tune_first)
+            tune(r, s);
+        if (fuse)
+            run_fuse(r, s);
+        else if (expire)
+            run_expiry(init_size, r, s, max_seed);
+        else if (by_epoch)
+            run_epochs(r, s, max_seed);
+        else
+            run(init_size, r, s, file, local_search, bulk, indexed, morton, view,
+                checkpoint ? "cuckoo_checkpoint.bin" : nullptr, max_seed);
     }
-    cout << "]\n";
-    */
-
-    create_filter(init_size, fp_table, seeds, r, s, file);
 
     fclose(file);
 
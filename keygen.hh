@@ -0,0 +1,197 @@
+#ifndef KEYGEN_HH
+#define KEYGEN_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Counter-based key generation. Every key is a pure function of a seed, a
+ * stream and the key's position, so a set can be generated in chunks, in any
+ * order and on any number of threads, and always comes out the same.
+ */
+
+// the SplitMix64 finalizer: a bijection on 64-bit words that passes BigCrush
+// when applied to a counter
+inline uint64_t splitmix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// the first word of stream of seed; the stream's keys step from it by the
+// golden ratio, as SplitMix64's state does
+inline uint64_t stream_base(const uint64_t seed, const uint64_t stream)
+{
+    return splitmix64(splitmix64(seed) ^ (stream * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL));
+}
+
+// key i of stream of seed
+inline uint64_t stream_key(const uint64_t seed, const uint64_t stream, const uint64_t i)
+{
+    return splitmix64(stream_base(seed, stream) + (i + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+/**
+ * Calls f(begin, end) on num_threads contiguous ranges covering [0, n), each
+ * on its own thread, and waits for them. num_threads 0 uses every hardware
+ * thread.
+ */
+template <typename F>
+void parallel_ranges(const size_t n, size_t num_threads, F f)
+{
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::max<size_t>(1, std::min(num_threads, n / 4096));
+    if (num_threads == 1)
+    {
+        f(size_t(0), n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < num_threads; ++t)
+        workers.emplace_back(f, n * t / num_threads, n * (t + 1) / num_threads);
+    for (std::thread &w : workers)
+        w.join();
+}
+
+// keys first .. first + n - 1 of stream of seed
+inline void random_keys(const uint64_t seed, const uint64_t stream, const uint64_t first, uint64_t *out,
+                        const size_t n)
+{
+    const uint64_t base = stream_base(seed, stream);
+    for (size_t i = 0; i < n; ++i)
+        out[i] = splitmix64(base + (first + i + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+// keys 0 .. n - 1 of stream of seed, generated on num_threads threads
+inline void random_keys(const uint64_t seed, const uint64_t stream, uint64_t *out, const size_t n,
+                        const size_t num_threads = 0)
+{
+    parallel_ranges(n, num_threads, [&](size_t begin, size_t end) {
+        random_keys(seed, stream, begin, out + begin, end - begin);
+    });
+}
+
+/**
+ * cert_population is a deterministic set of count certificates, each an
+ * issuer and a DER serial number, in random order. It models what the
+ * revocation filter is built from:
+ *
+ *   issuer sizes    Zipf-distributed with exponent skew, so a few large CAs
+ *                   issue most certificates
+ *   serials         each issuer's serials have a fixed length of 8 to 20
+ *                   bytes; a fraction sequential of the issuers count up
+ *                   from a random start, the rest draw random serials
+ *
+ * Certificate j is a function of j alone, so any range can be generated on
+ * any thread. R and S are disjoint ranges of one population, so revoked
+ * certificates are a random subset of everything issued, and an issuer's
+ * revoked serials interleave with its valid ones as in a real CRL. The cert_*
+ * runs in csv/ look up 100 certificates of S per certificate of R.
+ */
+class cert_population
+{
+public:
+    cert_population(const uint64_t seed, const uint64_t count, const size_t num_issuers = 64,
+                    const double skew = 1.0, const double sequential = 0.25)
+        : seed_(seed), count_(count), offsets_(num_issuers + 1), lengths_(num_issuers),
+          sequential_(num_issuers), starts_(num_issuers), issuers_(num_issuers, std::string(32, '\0'))
+    {
+        // sizes by Zipf weight, rounded down, with the remainder handed out to
+        // the largest issuers
+        std::vector<double> weights(num_issuers);
+        double total = 0;
+        for (size_t i = 0; i < num_issuers; ++i)
+            total += weights[i] = 1.0 / std::pow(double(i + 1), skew);
+        std::vector<uint64_t> sizes(num_issuers);
+        uint64_t assigned = 0;
+        for (size_t i = 0; i < num_issuers; ++i)
+            assigned += sizes[i] = uint64_t(count * weights[i] / total);
+        for (size_t i = 0; assigned < count; i = (i + 1) % num_issuers, ++assigned)
+            sizes[i]++;
+        for (size_t i = 0; i < num_issuers; ++i)
+        {
+            offsets_[i + 1] = offsets_[i] + sizes[i];
+            const uint64_t h = stream_key(seed, ISSUER_STREAM, i);
+            lengths_[i] = 8 + h % 13;
+            sequential_[i] = (h >> 8) % 1024 < sequential * 1024;
+            starts_[i] = stream_key(seed, ISSUER_STREAM, num_issuers + i);
+            for (size_t b = 0; b < issuers_[i].size(); ++b)
+                issuers_[i][b] = static_cast<char>(stream_key(seed, ISSUER_KEY_STREAM, i * 32 + b));
+        }
+        // the smallest power of four covering count, for the permutation
+        half_bits_ = 1;
+        while ((uint64_t(1) << (2 * half_bits_)) < count)
+            half_bits_++;
+    }
+
+    uint64_t size() const { return count_; }
+    size_t num_issuers() const { return lengths_.size(); }
+
+    // the 32-byte issuer key hash of issuer i
+    const std::string &issuer(const size_t i) const { return issuers_[i]; }
+
+    // certificate j: its issuer, and its serial's DER content bytes in serial
+    void certificate(const uint64_t j, size_t &issuer, std::string &serial) const
+    {
+        const uint64_t k = permute(j);
+        issuer = std::upper_bound(offsets_.begin(), offsets_.end(), k) - offsets_.begin() - 1;
+        const uint64_t rank = k - offsets_[issuer];
+        serial.assign(lengths_[issuer], '\0');
+        // the bytes above the low 8 are fixed per issuer for sequential
+        // serials, and random otherwise
+        const uint64_t low = sequential_[issuer] ? starts_[issuer] + rank : stream_key(seed_, SERIAL_STREAM, k);
+        for (size_t b = 0; b < serial.size(); ++b)
+        {
+            const size_t from_end = serial.size() - 1 - b;
+            uint64_t w = low;
+            if (from_end >= 8)
+                w = sequential_[issuer] ? stream_key(seed_, ISSUER_STREAM, (1 + from_end / 8) * num_issuers() + issuer)
+                                        : stream_key(seed_, SERIAL_STREAM, (from_end / 8) * count_ + k);
+            serial[b] = static_cast<char>(w >> (8 * (from_end % 8)));
+        }
+        serial[0] &= 0x7f; // DER integers are positive
+    }
+
+private:
+    static const uint64_t ISSUER_STREAM = 0x1551;
+    static const uint64_t ISSUER_KEY_STREAM = 0x1552;
+    static const uint64_t SERIAL_STREAM = 0x5e71;
+    static const uint64_t PERMUTE_STREAM = 0x9e75;
+
+    // a bijection on [0, count): a 4-round Feistel network on 2 * half_bits_
+    // bits, applied again while the result falls outside the range
+    uint64_t permute(uint64_t j) const
+    {
+        const uint64_t mask = (uint64_t(1) << half_bits_) - 1;
+        do
+        {
+            uint64_t left = j >> half_bits_, right = j & mask;
+            for (uint64_t round = 0; round < 4; ++round)
+            {
+                const uint64_t f = stream_key(seed_, PERMUTE_STREAM, (round << 58) ^ right) & mask;
+                const uint64_t next = left ^ f;
+                left = right;
+                right = next;
+            }
+            j = (left << half_bits_) | right;
+        } while (j >= count_);
+        return j;
+    }
+
+    uint64_t seed_;
+    uint64_t count_;
+    std::vector<uint64_t> offsets_;
+    std::vector<size_t> lengths_;
+    std::vector<uint8_t> sequential_;
+    std::vector<uint64_t> starts_;
+    std::vector<std::string> issuers_;
+    size_t half_bits_;
+};
+
+#endif // KEYGEN_HH
@@ -0,0 +1,359 @@
+#ifndef PARTITIONED_BUILD_HH
+#define PARTITIONED_BUILD_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "cuckoofilter/src/cuckoofilter.h"
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
+
+/**
+ * partition_key is a key of one partition's table: the key with the buckets
+ * it may occupy, relative to the partition's first bucket. A key whose other
+ * bucket lies in another partition has i1 == i2, the one bucket it may
+ * occupy here.
+ */
+template <class Key>
+struct partition_key
+{
+    Key key;
+    uint32_t i1, i2;
+
+    bool operator==(const partition_key &other) const { return key == other.key; }
+};
+
+// hashes a partition_key as its key, so partials and seeds match the
+// unpartitioned table's
+template <class Hash>
+struct partition_hasher
+{
+    template <class Key>
+    uint64_t operator()(const partition_key<Key> &k, uint32_t seed = 0) const
+    {
+        return Hash()(k.key, seed);
+    }
+};
+
+/**
+ * partition_index_policy places a partition_key in the buckets it carries:
+ * i1 in the high 32 bits of the index value, i2 in the low, and the alternate
+ * of either is the other.
+ */
+struct partition_index_policy
+{
+    template <class Key>
+    uint64_t operator()(const partition_key<Key> &k) const
+    {
+        return uint64_t(k.i1) << 32 | k.i2;
+    }
+
+    static uint64_t alt_index(std::size_t, uint64_t ik, uint64_t index)
+    {
+        const uint64_t i1 = ik >> 32;
+        const uint64_t i2 = static_cast<uint32_t>(ik);
+        return index == i1 ? i2 : i1;
+    }
+};
+
+/**
+ * partition_spill keeps one file of records per partition in a directory.
+ * Appends are buffered per partition and written in blocks, opening the file
+ * only to write a block, so the number of partitions is not bounded by open
+ * file descriptors.
+ */
+template <class T>
+class partition_spill
+{
+    static_assert(std::is_trivially_copyable<T>::value, "spilled records are written as bytes");
+
+public:
+    partition_spill(const std::string &dir, const std::string &name, const size_t partitions)
+        : buffers_(partitions)
+    {
+        for (size_t p = 0; p < partitions; ++p)
+        {
+            paths_.push_back(dir + "/" + name + "." + std::to_string(p) + ".bin");
+            std::remove(paths_.back().c_str());
+        }
+    }
+
+    partition_spill(const partition_spill &) = delete;
+    partition_spill &operator=(const partition_spill &) = delete;
+
+    ~partition_spill()
+    {
+        for (const std::string &path : paths_)
+            std::remove(path.c_str());
+    }
+
+    void append(const size_t p, const T &record)
+    {
+        buffers_[p].push_back(record);
+        if (buffers_[p].size() == BLOCK_RECORDS)
+            flush(p);
+    }
+
+    // reads back all records of partition p and removes its file
+    std::vector<T> take(const size_t p)
+    {
+        flush(p);
+        std::vector<T> records;
+        std::ifstream in(paths_[p], std::ios::binary | std::ios::ate);
+        if (in.is_open())
+        {
+            records.resize(static_cast<size_t>(in.tellg()) / sizeof(T));
+            in.seekg(0);
+            in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(T));
+            if (!in)
+                throw std::runtime_error("cannot read " + paths_[p]);
+        }
+        std::remove(paths_[p].c_str());
+        return records;
+    }
+
+private:
+    static constexpr size_t BLOCK_RECORDS = size_t(1) << 14;
+
+    void flush(const size_t p)
+    {
+        std::vector<T> &buffer = buffers_[p];
+        if (buffer.empty())
+            return;
+        std::ofstream out(paths_[p], std::ios::binary | std::ios::app);
+        out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(T));
+        if (!out)
+            throw std::runtime_error("cannot write " + paths_[p]);
+        buffer.clear();
+    }
+
+    std::vector<std::string> paths_;
+    std::vector<std::vector<T>> buffers_;
+};
+
+// results of run_partitioned_build
+struct partitioned_report
+{
+    size_t partitions;
+    size_t num_items;
+    // keys of R whose two buckets lie in different partitions, and those of
+    // them that did not fit in their first partition's bucket
+    size_t cross_keys, deferred_keys;
+    // the most keys of S held in memory at once, and the keys of S excluded
+    // by the filter after their buckets reached the seed cap
+    size_t max_partition_s, spilled_keys;
+    double route_seconds, build_seconds;
+    size_t output_bytes;
+};
+
+/**
+ * run_partitioned_build builds the filter of an unpartitioned table of
+ * 2^hashpower buckets one range of buckets at a time, for sets R and S too
+ * large to hold in memory with the whole table:
+ *
+ *   route     R and S, generated in chunks by gen_r(chunk, out, n) and
+ *             gen_s, are spilled to per-partition files in dir: a key of S
+ *             to the partitions of both of its buckets, a key of R to the
+ *             earlier of the two
+ *   build     for each of the 2^partition_bits partitions in order, its keys
+ *             are inserted into a table of its buckets only, and false
+ *             positives of its keys of S are eliminated
+ *   stitch    each partition's seeds and packed partials are joined in
+ *             out, in CuckooFilter::Serialize's format, followed by the keys
+ *             of S spilled at the seed cap max_seed as its exclusion set
+ *
+ * Only one partition's table and keys are in memory at a time. A key of R
+ * whose buckets lie in two partitions may only take the bucket in its first
+ * partition there, so it cannot move during cuckooing; if that bucket is
+ * full, the key is deferred to the later partition and inserted into its
+ * other bucket before that partition's own keys. FP elimination needs no
+ * such care, since a bucket's seed depends only on the keys of R and S that
+ * map to it.
+ *
+ * Under a whole-table index policy all but 1/2^partition_bits of the keys
+ * cross partitions, and with one bucket each the partitions overflow well
+ * below the load an unpartitioned table reaches. Builds meant to be
+ * partitioned should use local_index_policy with alt_range_bits no greater
+ * than hashpower - partition_bits, under which no key crosses.
+ *
+ * The result is the filter an unpartitioned build would produce up to
+ * placement and seeds, and is read back with CuckooFilter::Deserialize.
+ * The item count in its header is written last, so out must be seekable.
+ *
+ * @throw std::invalid_argument if there are more partitions than buckets
+ * @throw std::runtime_error if a partition overflows, or a spill file cannot
+ * be written
+ */
+template <typename KeyType, std::size_t bits_per_key, typename Hash,
+          typename IndexPolicy = cuckoohashtable::raw_index_policy, typename GenR, typename GenS>
+partitioned_report run_partitioned_build(const size_t hashpower, const size_t partition_bits, const size_t nr,
+                                         const size_t ns, GenR gen_r, GenS gen_s, const std::string &dir,
+                                         std::ostream &out, const size_t num_threads = 0,
+                                         const size_t chunk_size = size_t(1) << 16,
+                                         const uint16_t max_seed = std::numeric_limits<uint16_t>::max())
+{
+    typedef partition_key<KeyType> entry;
+    typedef cuckoohashtable::cuckoo_hashtable<entry, bits_per_key, partition_hasher<Hash>, std::equal_to<entry>,
+                                              std::allocator<entry>, 4, cuckoohashtable::identity_key_source,
+                                              partition_index_policy>
+        Table;
+    using clock = std::chrono::steady_clock;
+
+    if (partition_bits > hashpower)
+        throw std::invalid_argument("more partitions than buckets");
+    const size_t local_hp = hashpower - partition_bits;
+    const size_t partitions = size_t(1) << partition_bits;
+    const uint64_t num_buckets = uint64_t(1) << hashpower;
+
+    // the buckets of a key in the unpartitioned table, as compute_buckets
+    const IndexPolicy index_policy;
+    auto buckets_of = [&](const KeyType &key, uint64_t &i1, uint64_t &i2) {
+        const uint64_t ik = index_policy(key);
+        i1 = static_cast<uint32_t>(ik >> 32) & (num_buckets - 1);
+        i2 = IndexPolicy::alt_index(hashpower, ik, i1);
+    };
+    // the key with its buckets in partition p, where at least one of them is
+    auto local_entry = [&](const KeyType &key, const size_t p) {
+        uint64_t i1, i2;
+        buckets_of(key, i1, i2);
+        const uint64_t base = uint64_t(p) << local_hp;
+        const bool in1 = (i1 >> local_hp) == p, in2 = (i2 >> local_hp) == p;
+        const uint32_t l1 = static_cast<uint32_t>((in1 ? i1 : i2) - base);
+        const uint32_t l2 = static_cast<uint32_t>((in2 ? i2 : i1) - base);
+        return entry{key, l1, l2};
+    };
+
+    partitioned_report report = partitioned_report();
+    report.partitions = partitions;
+    const clock::time_point route_start = clock::now();
+
+    partition_spill<KeyType> r_files(dir, "r", partitions), s_files(dir, "s", partitions),
+        deferred_files(dir, "deferred", partitions);
+    std::vector<KeyType> chunk(chunk_size);
+    for (size_t begin = 0; begin < nr; begin += chunk_size)
+    {
+        const size_t n = std::min(chunk_size, nr - begin);
+        gen_r(begin / chunk_size, chunk.data(), n);
+        for (size_t k = 0; k < n; ++k)
+        {
+            uint64_t i1, i2;
+            buckets_of(chunk[k], i1, i2);
+            const size_t p1 = i1 >> local_hp, p2 = i2 >> local_hp;
+            r_files.append(std::min(p1, p2), chunk[k]);
+            report.cross_keys += p1 != p2;
+        }
+    }
+    for (size_t begin = 0; begin < ns; begin += chunk_size)
+    {
+        const size_t n = std::min(chunk_size, ns - begin);
+        gen_s(begin / chunk_size, chunk.data(), n);
+        for (size_t k = 0; k < n; ++k)
+        {
+            uint64_t i1, i2;
+            buckets_of(chunk[k], i1, i2);
+            const size_t p1 = i1 >> local_hp, p2 = i2 >> local_hp;
+            s_files.append(p1, chunk[k]);
+            if (p2 != p1)
+                s_files.append(p2, chunk[k]);
+        }
+    }
+    std::vector<KeyType>().swap(chunk);
+    report.route_seconds = std::chrono::duration<double>(clock::now() - route_start).count();
+
+    const clock::time_point build_start = clock::now();
+    const std::streampos header_pos = out.tellp();
+    const uint32_t header[2] = {cuckoofilter::kSerializedMagic, bits_per_key};
+    uint64_t counts[2] = {num_buckets, 0};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(counts), sizeof(counts));
+    // seeds go to out in partition order, and the partials, which follow all
+    // seeds, to a spill file copied after them
+    const std::string partials_path = dir + "/partials.bin";
+    std::ofstream partials(partials_path, std::ios::binary | std::ios::trunc);
+    // keys of S matching buckets that reached the seed cap, which follow the
+    // partials as the filter's exclusion set
+    std::vector<KeyType> spilled;
+
+    for (size_t p = 0; p < partitions; ++p)
+    {
+        Table table((size_t(1) << local_hp) * Table::slot_per_bucket());
+        table.set_max_seed(max_seed);
+
+        // deferred keys have one bucket here, so they go first
+        for (const KeyType &key : deferred_files.take(p))
+        {
+            if (!table.try_insert(local_entry(key, p)))
+                throw std::runtime_error("partition " + std::to_string(p) + " overflowed");
+        }
+        const std::vector<KeyType> r = r_files.take(p);
+        std::vector<KeyType> cross;
+        for (const KeyType &key : r)
+        {
+            uint64_t i1, i2;
+            buckets_of(key, i1, i2);
+            if ((i1 >> local_hp) != (i2 >> local_hp))
+                cross.push_back(key);
+            else if (!table.try_insert(local_entry(key, p)))
+                throw std::runtime_error("partition " + std::to_string(p) + " overflowed");
+        }
+        // a cross key that does not fit moves on to its other bucket's
+        // partition, which comes later
+        for (const KeyType &key : cross)
+        {
+            if (table.try_insert(local_entry(key, p)))
+                continue;
+            uint64_t i1, i2;
+            buckets_of(key, i1, i2);
+            deferred_files.append(std::max(i1, i2) >> local_hp, key);
+            report.deferred_keys++;
+        }
+
+        std::vector<entry> s;
+        for (const KeyType &key : s_files.take(p))
+            s.push_back(local_entry(key, p));
+        report.max_partition_s = std::max(report.max_partition_s, s.size());
+        table.eliminate_false_positives(s.data(), s.size(), num_threads);
+        std::vector<entry>().swap(s);
+        for (const entry &e : table.spilled())
+            spilled.push_back(e.key);
+
+        const std::vector<uint16_t> seeds = table.get_seeds();
+        out.write(reinterpret_cast<const char *>(seeds.data()), seeds.size() * sizeof(uint16_t));
+        partials.write(table.packed_partials(), table.packed_partials_bytes());
+        report.num_items += table.size();
+    }
+
+    partials.close();
+    if (!partials)
+        throw std::runtime_error("cannot write " + partials_path);
+    {
+        std::ifstream in(partials_path, std::ios::binary);
+        out << in.rdbuf();
+    }
+    std::remove(partials_path.c_str());
+    const uint64_t num_spilled = spilled.size();
+    out.write(reinterpret_cast<const char *>(&num_spilled), sizeof(num_spilled));
+    out.write(reinterpret_cast<const char *>(spilled.data()), spilled.size() * sizeof(KeyType));
+    report.spilled_keys = spilled.size();
+    const std::streampos end_pos = out.tellp();
+    out.seekp(header_pos + std::streamoff(sizeof(header)));
+    counts[1] = report.num_items;
+    out.write(reinterpret_cast<const char *>(counts), sizeof(counts));
+    out.seekp(end_pos);
+    if (!out)
+        throw std::runtime_error("cannot write the filter");
+    report.output_bytes = end_pos - header_pos;
+    report.build_seconds = std::chrono::duration<double>(clock::now() - build_start).count();
+    return report;
+}
+
+#endif // PARTITIONED_BUILD_HH
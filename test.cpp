@@ -1,83 +1,909 @@
+// Checks of the table and filter, each a function run by main that asserts
+// what it expects. Build without NDEBUG, and with the counters recorded:
+//
+//     g++ -std=c++14 test.cpp cuckoofilter/src/hashutil.cc -lssl -lcrypto -lpthread -o test
+#ifdef NDEBUG
+#error "test.cpp checks with assert, so cannot be built with NDEBUG"
+#endif
+#define CUCKOO_STATS 1
+
+#include "cuckoofilter/src/binaryfusefilter.h"
 #include "cuckoofilter/src/cuckoofilter.h"
 #include <assert.h>
-#include <math.h>
+#include <openssl/sha.h>
+#include <string.h>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <vector>
-#include <tr1/unordered_map>
+
+#include "cuckoopair.hh"
+#include "epochset.hh"
+#include "keygen.hh"
+#include "partitionedbuild.hh"
+#include "cuckoohashtable/city_hasher.hh"
+#include "cuckoohashtable/hashtable/cuckoohashtable.hh"
 using namespace std;
 
-// generate n 64-bit random numbers
-void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
+typedef cuckoohashtable::cuckoo_hashtable<uint64_t, 12, CityHasher<uint64_t>> Table;
+typedef cuckoofilter::CuckooFilter<uint64_t, 12, CityHasher<uint64_t>> Filter;
+
+// generate n 64-bit random numbers, from stream of seed (see keygen.hh)
+void random_gen(uint64_t seed, uint64_t stream, size_t n, vector<uint64_t> &store)
 {
     store.resize(n);
-    for (int i = 0; i < n; i++)
-        store[i] = (uint64_t(rd()) << 32) + rd();
+    random_keys(seed, stream, store.data(), n);
 }
 
-size_t lookup(cuckoofilter::CuckooFilter<size_t, 16> &cf, vector<uint64_t> &s)
+// the counters of a table and of a filter viewing it add up when many
+// threads query them at once
+void test_concurrent_stats(const uint64_t seed)
 {
-    // lookup set S and count false positives
-    cout << "s lookup\n";
-    size_t total_queries = 0;
-    size_t false_queries = 0;
-    for (size_t i = 0; i < s.size(); i++)
+    const size_t num_keys = 1 << 14, num_threads = 4;
+    vector<uint64_t> r;
+    random_gen(seed, 0, num_keys, r);
+    Table table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    const Filter filter(table.packed_partials(), table.get_seeds(), table.size());
+
+    vector<thread> readers;
+    for (size_t t = 0; t < num_threads; t++)
+    {
+        readers.emplace_back([&]() {
+            for (auto k : r)
+            {
+                assert(table.find(k).first >= 0);
+                assert(filter.Contain(k) == cuckoofilter::Ok);
+            }
+        });
+    }
+    for (auto &t : readers)
+        t.join();
+
+    const cuckoohashtable::table_stats ts = table.stats();
+    assert(ts.inserts == num_keys);
+    assert(ts.finds == num_threads * num_keys);
+    assert(ts.find_probes >= ts.finds && ts.find_probes <= 2 * ts.finds);
+    const cuckoofilter::FilterStats fs = filter.Stats();
+    assert(fs.contains == num_threads * num_keys);
+    assert(fs.contain_hits == fs.contains);
+    assert(fs.probes >= fs.contains && fs.probes <= 2 * fs.contains);
+    cout << "concurrent stats: ok\n";
+}
+
+// eliminating false positives leaves no rehash pending, so the table's
+// checkpoint restores a finished build that can spill at the seed cap
+void test_eliminate_checkpoint(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    const vector<size_t> fps = table.eliminate_false_positives(s.data(), s.size(), 1);
+    assert(fps.back() == 0);
+    assert(!table.rehash_pending());
+
+    stringstream checkpoint;
+    table.save_checkpoint(checkpoint);
+    Table restored(table.capacity());
+    restored.load_checkpoint(checkpoint);
+    assert(!restored.rehash_pending());
+    assert(restored.spill_false_positives(s.data(), s.size()) == 0);
+    for (auto k : r)
+        assert(restored.find(k).first >= 0);
+    cout << "eliminate then checkpoint: ok\n";
+}
+
+// keys of S stored in the table are true positives, which no seed removes,
+// so elimination leaves the buckets holding them alone
+void test_eliminate_overlap(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table clean(num_keys / 0.9), table(num_keys / 0.9);
+    for (auto k : r)
+    {
+        clean.insert(k);
+        table.insert(k);
+    }
+    clean.eliminate_false_positives(s.data(), s.size(), 1);
+
+    // keys of R in buckets where no key of S matched, added to S
+    vector<int32_t> overlap_buckets;
+    for (auto k : r)
     {
-        // assert(cf.Contain(l) == cuckoofilter::NotFound); // not accurate - haven't accounted for alternate buckets
-        if (cf.Contain(s.at(i)) != cuckoofilter::NotFound)
+        const int32_t i = clean.find(k).first;
+        if (clean.get_seed(i) == 0 && overlap_buckets.size() < 64)
         {
-            false_queries++;
+            overlap_buckets.push_back(i);
+            s.push_back(k);
         }
-        total_queries++;
     }
-    // Output the measured false positive rate
-    cout << "total fp's: " << false_queries << " out of " << total_queries << "\n";
-    cout << "false positive rate is " << 100.0 * false_queries / total_queries << "%\n";
-    return false_queries;
+    assert(!overlap_buckets.empty());
+
+    table.set_max_seed(1024);
+    const vector<size_t> fps = table.eliminate_false_positives(s.data(), s.size(), 1);
+    assert(fps.back() == 0);
+    for (const int32_t i : overlap_buckets)
+        assert(table.get_seed(i) == 0);
+    for (size_t i = 0; i < table.bucket_count(); i++)
+        assert(table.get_seed(i) < table.max_seed());
+    assert(table.spilled().empty());
+    cout << "eliminate with S and R overlapping: ok\n";
 }
 
-int main(int argc, char **argv)
+// Deserialize rejects headers whose counts no filter could have before
+// allocating for them, and leaves the filter as it was
+void test_deserialize_counts(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 10;
+    vector<uint64_t> r;
+    random_gen(seed, 0, num_keys, r);
+    Table table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    const Filter view(table.packed_partials(), table.get_seeds(), table.size());
+    stringstream out;
+    assert(view.Serialize(out) == cuckoofilter::Ok);
+    const string data = out.str();
+
+    // the bucket count follows the 8-byte magic and bits per item, and the
+    // exclusion count, with no exclusions, ends the data
+    auto with_count = [&](size_t offset, uint64_t count) {
+        string corrupt = data;
+        memcpy(&corrupt[offset], &count, sizeof(count));
+        return corrupt;
+    };
+    const size_t exclusions_at = data.size() - sizeof(uint64_t);
+    for (const string &corrupt : {with_count(8, 0), with_count(8, 3), with_count(8, uint64_t(1) << 40),
+                                  with_count(8, table.bucket_count() * 2), with_count(exclusions_at, uint64_t(1) << 60)})
+    {
+        Filter filter(num_keys);
+        assert(filter.Add(r[0]) == cuckoofilter::Ok);
+        stringstream in(corrupt);
+        assert(filter.Deserialize(in) == cuckoofilter::NotSupported);
+        assert(filter.Contain(r[0]) == cuckoofilter::Ok);
+    }
+
+    Filter filter(1);
+    stringstream in(data);
+    assert(filter.Deserialize(in) == cuckoofilter::Ok);
+    for (auto k : r)
+        assert(filter.Contain(k) == cuckoofilter::Ok);
+    cout << "deserialize counts: ok\n";
+}
+
+// between a lookup round raising seeds and rehash_buckets, find and erase
+// still locate every key, although its bucket's partials are stale
+void test_find_mid_round(const uint64_t seed)
+{
+    const size_t num_keys = 10000;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+
+    table.start_lookup();
+    size_t raised = 0;
+    for (auto k : s)
+        raised += table.lookup(k) >= 0;
+    assert(raised > 0 && table.rehash_pending());
+    for (auto k : r)
+        assert(table.find(k).first >= 0);
+    for (size_t i = 0; i < num_keys / 4; i++)
+        assert(table.erase(r[i]).first >= 0);
+    table.rehash_buckets();
+
+    for (size_t i = 0; i < num_keys; i++)
+        assert((table.find(r[i]).first >= 0) == (i >= num_keys / 4));
+    cout << "find mid round: ok\n";
+}
+
+// bulk_build places a static key set at 98% load, drops its duplicates,
+// and leaves the table empty when the keys do not fit
+void test_bulk_build(const uint64_t seed)
+{
+    const size_t slots = (size_t(1) << 16) * 4, num_keys = slots * 0.98, num_duplicates = 1000;
+    vector<uint64_t> r;
+    random_gen(seed, 0, num_keys, r);
+    r.insert(r.end(), r.begin(), r.begin() + num_duplicates);
+
+    Table table(slots);
+    assert(table.bulk_build(r.data(), r.size()) == num_keys);
+    assert(table.size() == num_keys);
+    assert(table.stats().duplicates == num_duplicates);
+    for (auto k : r)
+        assert(table.find(k).first >= 0);
+    bool threw = false;
+    try
+    {
+        table.bulk_build(r.data(), r.size());
+    }
+    catch (const logic_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    Table full(1 << 12);
+    threw = false;
+    try
+    {
+        full.bulk_build(r.data(), full.capacity() + 1);
+    }
+    catch (const out_of_range &)
+    {
+        threw = true;
+    }
+    assert(threw && full.empty());
+    cout << "bulk build: ok\n";
+}
+
+// under the whole-table index policy most keys cross partitions; those that
+// find their first partition's bucket full are deferred to the later one
+// without the build failing, and the stitched filter holds every key
+void test_partitioned_cross(const uint64_t seed)
 {
-    int seed = 1;
-    mt19937 rd(seed);
+    const size_t hashpower = 10, partition_bits = 2, nr = 2000, ns = 20000;
+    auto gen_r = [&](size_t c, uint64_t *out, size_t n) { random_keys(seed, 0, c << 10, out, n); };
+    auto gen_s = [&](size_t c, uint64_t *out, size_t n) { random_keys(seed, 1, c << 10, out, n); };
+    stringstream out;
+    const partitioned_report report = run_partitioned_build<uint64_t, 12, CityHasher<uint64_t>>(
+        hashpower, partition_bits, nr, ns, gen_r, gen_s, ".", out, 1, size_t(1) << 10);
+    assert(report.num_items == nr);
+    assert(report.cross_keys > nr / 2);
+    assert(report.deferred_keys > 0);
 
-    size_t rehash_limit = 5;
+    Filter filter(1);
+    assert(filter.Deserialize(out) == cuckoofilter::Ok);
+    vector<uint64_t> r;
+    random_gen(seed, 0, nr, r);
+    for (auto k : r)
+        assert(filter.Contain(k) == cuckoofilter::Ok);
+    cout << "partitioned build with cross keys: ok\n";
+}
 
-    size_t total_items = 50;
-    cout << "inserting " << total_items << " items\n";
-    size_t n = total_items / 0.95;
-    // int n = total_items/1.2;
-    cout << "creating filter size " << n << "\n";
-    cuckoofilter::CuckooFilter<size_t, 16> cf(n);
+// paired inserts into a nearly full pair, which move keys of the table,
+// leave its filter as a copy of the table's partials would be
+void test_paired_insert(const uint64_t seed)
+{
+    // 95% of 2^10 buckets, the load cuckoo_pair sizes for
+    const size_t num_keys = 3891;
+    vector<uint64_t> r;
+    random_gen(seed, 0, num_keys, r);
+    cuckoo_pair<uint64_t, 12> pair(num_keys);
+    for (auto k : r)
+        assert(pair.insert(k) == cuckoofilter::Ok);
+    assert(pair.insert(r[0]) == cuckoofilter::Ok);
+    assert(pair.table().stats().kicks > 0);
+
+    vector<vector<uint32_t>> fp_table;
+    pair.table().export_table(fp_table);
+    Filter copied(num_keys, pair.table().get_seeds());
+    for (size_t i = 0; i < fp_table.size(); i++)
+        for (size_t j = 0; j < fp_table[i].size(); j++)
+            if (fp_table[i][j] != 0)
+                assert(copied.CopyInsert(fp_table[i][j], i, j) == cuckoofilter::Ok);
+    stringstream paired_bytes, copied_bytes;
+    assert(pair.filter().Serialize(paired_bytes) == cuckoofilter::Ok);
+    assert(copied.Serialize(copied_bytes) == cuckoofilter::Ok);
+    assert(paired_bytes.str() == copied_bytes.str());
+    for (auto k : r)
+        assert(pair.lookup(k));
+    cout << "paired insert: ok\n";
+}
+
+// a view of a table's partials refuses every write and leaves the table's
+// storage as it was, while a filter copied from it takes them
+void test_view_writes(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 12;
     vector<uint64_t> r;
-    vector<uint64_t> s;
+    random_gen(seed, 0, num_keys, r);
+    Table table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    const string before(table.packed_partials(), table.packed_partials_bytes());
+
+    Filter view(table.packed_partials(), table.get_seeds(), table.size());
+    Table::paired_path path = Table::paired_path();
+    size_t dropped = 0;
+    assert(view.Add(r[0]) == cuckoofilter::NotSupported);
+    assert(view.Delete(r[0]) == cuckoofilter::NotSupported);
+    assert(view.CopyInsert(1, 0, 0) == cuckoofilter::NotSupported);
+    assert(view.PairedInsert(r[0], path) == cuckoofilter::NotSupported);
+    assert(view.PairedDelete(r[0], 0, 0) == cuckoofilter::NotSupported);
+    assert(view.Compact(&dropped) == cuckoofilter::NotSupported);
+    assert(string(table.packed_partials(), table.packed_partials_bytes()) == before);
+    assert(view.Size() == num_keys);
+    for (auto k : r)
+        assert(view.Contain(k) == cuckoofilter::Ok);
+
+    stringstream bytes;
+    assert(view.Serialize(bytes) == cuckoofilter::Ok);
+    Filter copied(1);
+    assert(copied.Deserialize(bytes) == cuckoofilter::Ok);
+    assert(copied.Delete(r[0]) == cuckoofilter::Ok);
+    assert(copied.Compact(&dropped) == cuckoofilter::Ok);
+    assert(string(table.packed_partials(), table.packed_partials_bytes()) == before);
+    assert(view.Contain(r[0]) == cuckoofilter::Ok);
+
+    // reading a filter into a view replaces the view with an owned table
+    bytes.clear();
+    bytes.seekg(0);
+    assert(view.Deserialize(bytes) == cuckoofilter::Ok);
+    assert(view.Delete(r[0]) == cuckoofilter::Ok);
+    assert(string(table.packed_partials(), table.packed_partials_bytes()) == before);
+    cout << "view and copied filter writes: ok\n";
+}
+
+// the local search clears every bucket in one detection pass and verifies
+// in a second, counted as elimination passes rather than lookup rounds, and
+// a filter viewing the table then rejects all of S and accepts all of R
+void test_eliminate_local_search(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    const vector<size_t> fps = table.eliminate_false_positives(s.data(), s.size(), 2);
+    assert(fps.size() == 2 && fps[0] > 0 && fps[1] == 0);
+    assert(table.elimination_passes() == 2);
+    assert(table.lookup_rounds() == 0);
+    assert(table.stats().rounds.size() == 2);
+    assert(table.spilled().empty());
+
+    const Filter filter(table.packed_partials(), table.get_seeds(), table.size());
+    for (auto k : r)
+        assert(filter.Contain(k) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(filter.Contain(k) != cuckoofilter::Ok);
+    cout << "eliminate with local search: ok\n";
+}
+
+// a table of indices into R places and rehashes exactly as a table of the
+// keys themselves, so both give the same filter
+void test_indexed_table(const uint64_t seed)
+{
+    typedef cuckoohashtable::indexed_cuckoo_hashtable<uint64_t, 12, CityHasher<uint64_t>> IndexedTable;
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table table(num_keys / 0.9);
+    IndexedTable indexed(num_keys / 0.9, CityHasher<uint64_t>(), equal_to<uint64_t>(), allocator<uint32_t>(),
+                         cuckoohashtable::indexed_key_source<uint64_t>(r.data()));
+    for (uint32_t i = 0; i < num_keys; i++)
+    {
+        table.insert(r[i]);
+        indexed.insert(i);
+    }
+    for (auto k : r)
+        assert(indexed.find(k).first >= 0);
+    assert(indexed.find(s[0]).first < 0);
+
+    assert(table.eliminate_false_positives(s.data(), s.size(), 1) == indexed.eliminate_false_positives(s.data(), s.size(), 1));
+    assert(table.get_seeds() == indexed.get_seeds());
+    assert(string(table.packed_partials(), table.packed_partials_bytes()) ==
+           string(indexed.packed_partials(), indexed.packed_partials_bytes()));
+    cout << "indexed table: ok\n";
+}
+
+// builds a table of r under its index policy and eliminates s, then checks
+// that a filter with the matching policy, copied from the table, accepts
+// every key of r and rejects every key of s
+template <typename PolicyTable, typename PolicyFilter>
+void check_policy_round_trip(const vector<uint64_t> &r, const vector<uint64_t> &s)
+{
+    PolicyTable table(r.size() / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    assert(table.eliminate_false_positives(s.data(), s.size(), 1).back() == 0);
+    assert(table.spilled().empty());
+
+    const PolicyFilter view(table.packed_partials(), table.get_seeds(), table.size());
+    stringstream bytes;
+    assert(view.Serialize(bytes) == cuckoofilter::Ok);
+    PolicyFilter filter(1);
+    assert(filter.Deserialize(bytes) == cuckoofilter::Ok);
+    for (auto k : r)
+        assert(filter.Contain(k) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(filter.Contain(k) != cuckoofilter::Ok);
+}
 
-    // 64-bit random numbers to insert and lookup -> lookup_size = insert_size * 100
-    random_gen(total_items, r, rd);
-    random_gen(total_items * 100, s, rd);
+// sequential keys all share bucket 0 under the raw policy, and spread over
+// the table under the mixed one
+void test_mixed_index(const uint64_t seed)
+{
+    typedef cuckoohashtable::cuckoo_hashtable<uint64_t, 12, CityHasher<uint64_t>, equal_to<uint64_t>,
+                                              allocator<uint64_t>, 4, cuckoohashtable::identity_key_source,
+                                              cuckoohashtable::mixed_index_policy>
+        MixedTable;
+    typedef cuckoofilter::CuckooFilter<uint64_t, 12, CityHasher<uint64_t>, cuckoofilter::SingleTable,
+                                       cuckoofilter::MixedIndex>
+        MixedFilter;
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r(num_keys), s(num_keys * 16);
+    for (size_t i = 0; i < r.size(); i++)
+        r[i] = seed + i;
+    for (size_t i = 0; i < s.size(); i++)
+        s[i] = seed + num_keys + i;
+
+    Table raw(num_keys / 0.9);
+    bool full = false;
+    try
+    {
+        for (auto k : r)
+            raw.insert(k);
+    }
+    catch (const out_of_range &)
+    {
+        full = true;
+    }
+    assert(full);
+
+    check_policy_round_trip<MixedTable, MixedFilter>(r, s);
+    cout << "mixed index policy: ok\n";
+}
+
+// under the local policy both buckets of a key lie in one chunk of 2^8
+// buckets, the key is found in one of them, and the filter with the
+// matching LocalIndex reads the table back
+void test_local_index(const uint64_t seed)
+{
+    typedef cuckoohashtable::local_cuckoo_hashtable<uint64_t, 12, CityHasher<uint64_t>> LocalTable;
+    typedef cuckoohashtable::local_index_policy<cuckoohashtable::mixed_index_policy, 8> Policy;
+    typedef cuckoofilter::CuckooFilter<uint64_t, 12, CityHasher<uint64_t>, cuckoofilter::SingleTable,
+                                       cuckoofilter::LocalIndex<cuckoofilter::MixedIndex, 8>>
+        LocalFilter;
+    const size_t num_keys = 1 << 14;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+
+    LocalTable table(num_keys / 0.9);
+    for (auto k : r)
+        table.insert(k);
+    const size_t hp = table.hashpower();
+    assert(hp > 8);
+    const Policy policy;
+    for (auto k : r)
+    {
+        const uint64_t ik = policy(k);
+        const uint64_t i1 = (ik >> 32) & ((uint64_t(1) << hp) - 1);
+        const uint64_t i2 = Policy::alt_index(hp, ik, i1);
+        assert(i1 != i2 && (i1 >> 8) == (i2 >> 8));
+        const int32_t index = table.find(k).first;
+        assert(uint64_t(index) == i1 || uint64_t(index) == i2);
+    }
+
+    check_policy_round_trip<LocalTable, LocalFilter>(r, s);
+    cout << "local index policy: ok\n";
+}
+
+// certificate keys reduce to the first 128 bits of their SHA-256, and a
+// table and filter of the digests keep R and reject S
+void test_cert_digests(const uint64_t seed)
+{
+    typedef cuckoohashtable::cuckoo_hashtable<cuckoofilter::Digest128, 12, cuckoofilter::Digest128Hash> DigestTable;
+    typedef cuckoofilter::CuckooFilter<cuckoofilter::Digest128, 12, cuckoofilter::Digest128Hash> DigestFilter;
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> serials;
+    random_gen(seed, 0, num_keys * 17, serials);
+    vector<string> keys(serials.size());
+    for (size_t i = 0; i < serials.size(); i++)
+    {
+        // two issuers, serials of 8 octets
+        const string issuer(32, static_cast<char>(i & 1));
+        keys[i] = cuckoofilter::HashUtil::CertKey(issuer, string(reinterpret_cast<const char *>(&serials[i]), 8));
+        assert(keys[i].size() == 32 + 1 + 8 && keys[i][32] == 8);
+    }
+    // the length prefix keeps pairs apart whose concatenations are equal
+    assert(cuckoofilter::HashUtil::CertKey("ab", "c") != cuckoofilter::HashUtil::CertKey("a", "bc"));
+    vector<cuckoofilter::Digest128> digests(keys.size());
+    cuckoofilter::HashUtil::Digest128Batch(keys.data(), keys.size(), digests.data());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        unsigned char md[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char *>(keys[i].data()), keys[i].size(), md);
+        assert(memcmp(&digests[i].hi, md, 8) == 0 && memcmp(&digests[i].lo, md + 8, 8) == 0);
+        assert(cuckoofilter::index_bits(digests[i]) == digests[i].hi);
+    }
+
+    DigestTable table(num_keys / 0.9);
+    for (size_t i = 0; i < num_keys; i++)
+        table.insert(digests[i]);
+    assert(table.eliminate_false_positives(&digests[num_keys], digests.size() - num_keys, 1).back() == 0);
+    assert(table.spilled().empty());
+    const DigestFilter filter(table.packed_partials(), table.get_seeds(), table.size());
+    for (size_t i = 0; i < digests.size(); i++)
+        assert((filter.Contain(digests[i]) == cuckoofilter::Ok) == (i < num_keys));
+    cout << "certificate digests: ok\n";
+}
+
+// every engine the CPU supports hashes as OpenSSL does, at lengths around
+// the padding boundaries and at counts that leave lanes of AVX2 unfilled
+void test_sha256_batch(const uint64_t seed)
+{
+    const cuckoofilter::HashUtil::SHA256Engine engines[] = {
+        cuckoofilter::HashUtil::kSHA256Auto, cuckoofilter::HashUtil::kSHA256Scalar,
+        cuckoofilter::HashUtil::kSHA256ShaNi, cuckoofilter::HashUtil::kSHA256Avx2};
+    const size_t lengths[] = {0, 1, 41, 55, 56, 63, 64, 65, 119, 120, 128, 300};
+    const size_t n = 13;
+    assert(cuckoofilter::HashUtil::SHA256EngineSupported(cuckoofilter::HashUtil::kSHA256Scalar));
+    for (size_t len : lengths)
+    {
+        vector<uint64_t> words;
+        random_gen(seed, len, (n * len + 7) / 8, words);
+        const uint8_t *in = reinterpret_cast<const uint8_t *>(words.data());
+        vector<uint8_t> expected(n * SHA256_DIGEST_LENGTH);
+        for (size_t i = 0; i < n; i++)
+            SHA256(in + i * len, len, &expected[i * SHA256_DIGEST_LENGTH]);
+        for (auto engine : engines)
+        {
+            vector<uint8_t> out(n * SHA256_DIGEST_LENGTH, 0xa5);
+            const bool supported = cuckoofilter::HashUtil::SHA256EngineSupported(engine);
+            assert(cuckoofilter::HashUtil::SHA256Batch(in, len, n, out.data(), engine) == supported);
+            if (supported)
+                assert(out == expected);
+            else
+                assert(out == vector<uint8_t>(n * SHA256_DIGEST_LENGTH, 0xa5));
+        }
+    }
+    cout << "batched SHA-256: ok\n";
+}
+
+// tags past the 39 slots of a block spill to the side table, stay findable
+// and deletable there, and leave the next block alone; a filter copied into
+// MortonTable at a load that spills keeps R, rejects S and deletes all of R
+void test_morton_spills(const uint64_t seed)
+{
+    // with 12-bit tags a block serves 13 buckets with 39 slots
+    const size_t buckets_per_block = 13, slots_per_block = 39;
+    cuckoofilter::MortonTable<12> blocks(2 * buckets_per_block);
+    for (size_t i = 0; i < buckets_per_block; i++)
+        for (uint32_t j = 1; j <= 4; j++)
+            assert(blocks.CopyTagToBucket(i, j - 1, i * 4 + j));
+    assert(blocks.NumSpilled() == buckets_per_block * 4 - slots_per_block);
+    assert(!blocks.CopyTagToBucket(0, 0, 100));
+    assert(blocks.CopyTagToBucket(buckets_per_block, 0, 100));
+    for (size_t i = 0; i < buckets_per_block; i++)
+    {
+        assert(blocks.NumTagsInBucket(i) == 4);
+        for (uint32_t j = 1; j <= 4; j++)
+            assert(blocks.FindTagInBucket(i, i * 4 + j));
+        assert(!blocks.FindTagInBucket(i, 100));
+    }
+    // the last bucket's tags are the last stored, so all spilled
+    const size_t last = buckets_per_block - 1;
+    assert(blocks.DeleteTagFromBucket(last, last * 4 + 4));
+    assert(!blocks.DeleteTagFromBucket(last, last * 4 + 4));
+    assert(blocks.DeleteTagFromBucket(0, 1));
+    assert(blocks.NumSpilled() == buckets_per_block * 4 - slots_per_block - 1);
+    assert(blocks.NumTagsInBucket(last) == 3 && blocks.NumTagsInBucket(0) == 3);
+    assert(!blocks.FindTagInBucket(last, last * 4 + 4) && !blocks.FindTagInBucket(0, 1));
+    assert(blocks.FindTagInBucket(last, last * 4 + 3) && blocks.FindTagInBucket(0, 2));
+    assert(blocks.NumTagsInBucket(buckets_per_block) == 1 && blocks.FindTagInBucket(buckets_per_block, 100));
+
+    typedef cuckoofilter::CuckooFilter<uint64_t, 12, CityHasher<uint64_t>, cuckoofilter::MortonTable> MortonFilter;
+    // 95% of 2^10 buckets, well past the load blocks start spilling at
+    const size_t num_keys = 3891;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table table(num_keys);
+    for (auto k : r)
+        table.insert(k);
+    assert(table.eliminate_false_positives(s.data(), s.size(), 1).back() == 0);
+    assert(table.spilled().empty());
+    vector<vector<uint32_t>> fp_table;
+    table.export_table(fp_table);
+    MortonFilter filter(table.size(), table.get_seeds());
+    for (size_t i = 0; i < fp_table.size(); i++)
+        for (size_t j = 0; j < fp_table[i].size(); j++)
+            if (fp_table[i][j] != 0)
+                assert(filter.CopyInsert(fp_table[i][j], i, j) == cuckoofilter::Ok);
+    assert(filter.Info().find("Spilled tags: 0\n") == string::npos);
+    for (auto k : r)
+        assert(filter.Contain(k) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(filter.Contain(k) != cuckoofilter::Ok);
+    for (auto k : r)
+        assert(filter.Delete(k) == cuckoofilter::Ok);
+    assert(filter.Size() == 0);
+    assert(filter.Info().find("Spilled tags: 0\n") != string::npos);
+    for (auto k : r)
+        assert(filter.Contain(k) != cuckoofilter::Ok);
+    cout << "morton table spills: ok\n";
+}
 
-    // add set R to filter
-    for (auto c : r)
+// a binary fuse filter holds every key it is built from, duplicates
+// included, whatever the thread count, at about its fingerprint's false
+// positive rate; a cascade over R and S is exact on both
+void test_binary_fuse(const uint64_t seed)
+{
+    typedef cuckoofilter::BinaryFuseFilter<uint64_t, uint8_t, CityHasher<uint64_t>> Fuse;
+    typedef cuckoofilter::BinaryFuseCascade<uint64_t, uint8_t, CityHasher<uint64_t>> Cascade;
+    const size_t num_keys = 1 << 14;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    vector<uint64_t> duplicated(r);
+    duplicated.insert(duplicated.end(), r.begin(), r.begin() + num_keys / 2);
+
+    Fuse single(duplicated.size()), threaded(duplicated.size());
+    assert(single.Build(duplicated.data(), duplicated.size(), 1) == cuckoofilter::Ok);
+    assert(threaded.Build(duplicated.data(), duplicated.size(), 4) == cuckoofilter::Ok);
+    assert(single.Size() == num_keys && threaded.Size() == num_keys);
+    assert(single.Seed() == threaded.Seed());
+    for (auto k : r)
+        assert(single.Contain(k) == cuckoofilter::Ok && threaded.Contain(k) == cuckoofilter::Ok);
+    size_t false_positives = 0;
+    for (auto k : s)
     {
-        assert(cf.Add(c) == cuckoofilter::Ok);
-        assert(cf.Contain(c) == cuckoofilter::Ok);
-        // if(cf.Contain(c) != cuckoofilter::Ok) {
-        //     cout << "ERROR\n";
-        //     return 1;
-        // }
+        assert(single.Contain(k) == threaded.Contain(k));
+        false_positives += single.Contain(k) == cuckoofilter::Ok;
     }
+    // 1/256 expected
+    assert(false_positives > s.size() / 512 && false_positives < s.size() / 128);
+
+    Fuse small(num_keys / 2);
+    assert(small.Build(r.data(), r.size()) == cuckoofilter::NotEnoughSpace);
+    Fuse tiny(1);
+    assert(tiny.Build(r.data(), 1) == cuckoofilter::Ok && tiny.Contain(r[0]) == cuckoofilter::Ok);
+
+    Cascade cascade;
+    assert(cascade.Build(r.data(), r.size(), s.data(), s.size()) == cuckoofilter::Ok);
+    assert(cascade.NumLevels() > 1);
+    for (auto k : r)
+        assert(cascade.Contain(k) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(cascade.Contain(k) != cuckoofilter::Ok);
+    // a key of both sets never separates
+    s.push_back(r[0]);
+    assert(cascade.Build(r.data(), r.size(), s.data(), s.size()) == cuckoofilter::NotEnoughSpace);
+    assert(cascade.NumLevels() == 0);
+    cout << "binary fuse filter and cascade: ok\n";
+}
 
-    // cout << cf.Info() << "\n";
-    size_t rehash_lup = 0;
-    while (lookup(cf, s) > 0 && rehash_lup < rehash_limit)
+// checks that every spilled key is a key of S the filter copied from table
+// accepts, and that with them excluded the filter, and the one read back
+// from its bytes, accepts R and rejects S
+void check_spilled_exclusions(const Table &table, const vector<uint64_t> &r, const vector<uint64_t> &s)
+{
+    assert(!table.spilled().empty());
+    for (size_t i = 0; i < table.bucket_count(); i++)
+        assert(table.get_seed(i) <= table.max_seed());
+    Filter view(table.packed_partials(), table.get_seeds(), table.size());
+    for (auto k : table.spilled())
     {
-        cf.RehashCheck(s);
-        rehash_lup++;
-        if (rehash_lup >= rehash_limit)
-            cout << "rehashed too many times...\n";
+        assert(find(s.begin(), s.end(), k) != s.end());
+        assert(view.Contain(k) == cuckoofilter::Ok);
     }
-    cout << "full rehash lookup count: " << rehash_lup << "\n";
-    // lookup(cf, s);
-    // for(auto c : r)
-    //     assert(cf.Contain(c) == cuckoofilter::Ok);
+    assert(view.Exclude(table.spilled().data(), table.spilled().size()) == cuckoofilter::Ok);
+    stringstream bytes;
+    assert(view.Serialize(bytes) == cuckoofilter::Ok);
+    Filter filter(1);
+    assert(filter.Deserialize(bytes) == cuckoofilter::Ok);
+    for (auto k : r)
+        assert(view.Contain(k) == cuckoofilter::Ok && filter.Contain(k) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(view.Contain(k) != cuckoofilter::Ok && filter.Contain(k) != cuckoofilter::Ok);
+}
+
+// with seeds capped, both local search and lookup rounds stop at the cap and
+// spill the false positives left, which the filter then excludes
+void test_spill_cap(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table local(num_keys / 0.9), rounds(num_keys / 0.9);
+    for (auto k : r)
+    {
+        local.insert(k);
+        rounds.insert(k);
+    }
+
+    local.set_max_seed(1);
+    const vector<size_t> fps = local.eliminate_false_positives(s.data(), s.size(), 1);
+    assert(fps.back() == 0);
+    check_spilled_exclusions(local, r, s);
+
+    rounds.set_max_seed(1);
+    size_t num_rounds = 0;
+    while (true)
+    {
+        rounds.start_lookup();
+        size_t false_positives = 0;
+        for (auto k : s)
+            false_positives += rounds.lookup(k) >= 0;
+        num_rounds++;
+        assert(false_positives > 0);
+        rounds.rehash_buckets();
+        if (rounds.lookup_rounds_exhausted())
+            break;
+    }
+    assert(num_rounds == 1);
+    const size_t spilled = rounds.spill_false_positives(s.data(), s.size());
+    assert(spilled == rounds.spilled().size());
+    check_spilled_exclusions(rounds, r, s);
+    cout << "spill at the seed cap: ok\n";
+}
+
+// erasing keys keeps every seed, so R stays in and S out without another
+// round; a filter replaying the erases with PairedDelete and compacted
+// matches the compacted table byte for byte, and a table compacted into a
+// smaller hashpower still keeps R and rejects S
+void test_erase_compact(const uint64_t seed)
+{
+    const size_t num_keys = 1 << 12;
+    vector<uint64_t> r, s;
+    random_gen(seed, 0, num_keys, r);
+    random_gen(seed, 1, num_keys * 16, s);
+    Table kept(num_keys / 0.9), rebuilt(num_keys / 0.9);
+    for (Table *table : {&kept, &rebuilt})
+    {
+        for (auto k : r)
+            table->insert(k);
+        // spill some keys of S, for compaction to drop
+        table->set_max_seed(1);
+        assert(table->eliminate_false_positives(s.data(), s.size(), 1).back() == 0);
+        assert(!table->spilled().empty());
+    }
+
+    vector<vector<uint32_t>> fp_table;
+    kept.export_table(fp_table);
+    Filter filter(num_keys, kept.get_seeds());
+    for (size_t i = 0; i < fp_table.size(); i++)
+        for (size_t j = 0; j < fp_table[i].size(); j++)
+            if (fp_table[i][j] != 0)
+                assert(filter.CopyInsert(fp_table[i][j], i, j) == cuckoofilter::Ok);
+    assert(filter.Exclude(kept.spilled().data(), kept.spilled().size()) == cuckoofilter::Ok);
+
+    const size_t num_erased = num_keys / 4 * 3;
+    for (size_t i = 0; i < num_erased; i++)
+    {
+        const auto pos = kept.find(r[i]);
+        assert(kept.erase(r[i]) == pos);
+        assert(kept.erase(r[i]) == make_pair(-1, -1));
+        assert(filter.PairedDelete(r[i], pos.first, pos.second) == cuckoofilter::Ok);
+        assert(rebuilt.erase(r[i]) == pos);
+    }
+    assert(kept.size() == num_keys - num_erased && kept.stats().erases == num_erased);
+    for (size_t i = num_erased; i < num_keys; i++)
+        assert(kept.find(r[i]).first >= 0 && filter.Contain(r[i]) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(filter.Contain(k) != cuckoofilter::Ok);
+
+    // a max_load no smaller hashpower meets only resets seeds and spills
+    const size_t num_spilled = kept.spilled().size();
+    const size_t hashpower = kept.hashpower();
+    fp_table.clear();
+    kept.export_table(fp_table);
+    size_t num_reset = 0;
+    for (size_t i = 0; i < kept.bucket_count(); i++)
+        num_reset += kept.get_seed(i) > 0 && count(fp_table[i].begin(), fp_table[i].end(), 0) == kept.slot_per_bucket();
+    assert(num_reset > 0);
+    assert(!kept.compact(s.data(), s.size(), 0.01, 1));
+    assert(kept.hashpower() == hashpower);
+    size_t num_dropped = 0;
+    assert(filter.Compact(&num_dropped) == cuckoofilter::Ok);
+    assert(num_dropped > 0 && num_dropped == num_spilled - kept.spilled().size());
+    for (size_t i = 0; i < kept.bucket_count(); i++)
+        assert(kept.get_seed(i) == 0 || count(fp_table[i].begin(), fp_table[i].end(), 0) < kept.slot_per_bucket());
+    Filter view(kept.packed_partials(), kept.get_seeds(), kept.size());
+    assert(view.Exclude(kept.spilled().data(), kept.spilled().size()) == cuckoofilter::Ok);
+    stringstream filter_bytes, view_bytes;
+    assert(filter.Serialize(filter_bytes) == cuckoofilter::Ok);
+    assert(view.Serialize(view_bytes) == cuckoofilter::Ok);
+    assert(filter_bytes.str() == view_bytes.str());
+
+    assert(rebuilt.compact(s.data(), s.size(), 0.9, 1));
+    assert(rebuilt.hashpower() < hashpower && rebuilt.size() == num_keys - num_erased);
+    for (size_t i = 0; i < rebuilt.bucket_count(); i++)
+        assert(rebuilt.get_seed(i) <= rebuilt.max_seed());
+    Filter smaller(rebuilt.packed_partials(), rebuilt.get_seeds(), rebuilt.size());
+    assert(smaller.Exclude(rebuilt.spilled().data(), rebuilt.spilled().size()) == cuckoofilter::Ok);
+    for (size_t i = num_erased; i < num_keys; i++)
+        assert(smaller.Contain(r[i]) == cuckoofilter::Ok);
+    for (auto k : s)
+        assert(smaller.Contain(k) != cuckoofilter::Ok);
+    cout << "erase and compact: ok\n";
+}
+
+// epochs are UTC months; an epoch set finds each key of R in its epoch and
+// through the fused probe over more than one batch of epochs, rebuilds only
+// the epochs added to, and drops expired epochs whole
+void test_epoch_set(const uint64_t seed)
+{
+    assert(expiry_month(0) == 0);
+    // 2026-01-01 and 2026-02-01 UTC
+    assert(expiry_month(1767225600) == 56 * 12 && expiry_month(1767225600 - 1) == 56 * 12 - 1);
+    assert(expiry_month(1769904000 - 1) == 56 * 12 && expiry_month(1769904000) == 56 * 12 + 1);
+
+    typedef epoch_filter_set<uint64_t, CityHasher<uint64_t>, 16> EpochSet;
+    const size_t num_epochs = EpochSet::PROBE_BATCH + 4, keys_per_epoch = 256;
+    vector<uint64_t> r, s, added;
+    random_gen(seed, 0, num_epochs * keys_per_epoch, r);
+    random_gen(seed, 1, r.size() * 16, s);
+    random_gen(seed, 2, keys_per_epoch, added);
+    vector<uint32_t> epochs(r.size());
+    for (size_t i = 0; i < r.size(); i++)
+        epochs[i] = 100 + i % num_epochs;
+
+    EpochSet set;
+    set.add(r.data(), epochs.data(), r.size());
+    task_pool pool(4);
+    assert(set.build(pool, s.data(), s.size()) == num_epochs);
+    assert(set.num_epochs() == num_epochs && set.size() == r.size());
+    for (size_t i = 0; i < r.size(); i++)
+        assert(set.contain(r[i]) && set.contain(r[i], epochs[i]));
+    for (auto k : s)
+        assert(!set.contain(k));
+    assert(set.filter(100 + num_epochs) == nullptr && !set.contain(r[0], 100 + num_epochs));
+
+    // only the epoch added to is rebuilt
+    vector<const EpochSet::filter_type *> filters;
+    for (uint32_t e = 100; e < 100 + num_epochs; e++)
+        filters.push_back(set.filter(e));
+    const uint32_t last = 100 + num_epochs - 1;
+    set.add(last, added.data(), added.size());
+    assert(set.build(pool, s.data(), s.size()) == 1);
+    for (uint32_t e = 100; e < last; e++)
+        assert(set.filter(e) == filters[e - 100]);
+    for (auto k : added)
+        assert(set.contain(k) && set.contain(k, last));
+    assert(set.build(pool, s.data(), s.size()) == 0);
+
+    const size_t bytes = set.size_in_bytes();
+    assert(set.expire_before(103) == 3);
+    assert(set.num_epochs() == num_epochs - 3 && set.size() == r.size() - 3 * keys_per_epoch + added.size());
+    assert(set.size_in_bytes() < bytes && set.filter(102) == nullptr);
+    for (size_t i = 0; i < r.size(); i++)
+        if (epochs[i] >= 103)
+            assert(set.contain(r[i]));
+    for (auto k : s)
+        assert(!set.contain(k));
+    cout << "epoch filter set: ok\n";
+}
+
+int main(int argc, char **argv)
+{
+    const uint64_t seed = 1;
+    test_concurrent_stats(seed);
+    test_find_mid_round(seed);
+    test_bulk_build(seed);
+    test_eliminate_local_search(seed);
+    test_indexed_table(seed);
+    test_mixed_index(seed);
+    test_local_index(seed);
+    test_cert_digests(seed);
+    test_sha256_batch(seed);
+    test_morton_spills(seed);
+    test_binary_fuse(seed);
+    test_spill_cap(seed);
+    test_erase_compact(seed);
+    test_epoch_set(seed);
+    test_eliminate_checkpoint(seed);
+    test_eliminate_overlap(seed);
+    test_deserialize_counts(seed);
+    test_partitioned_cross(seed);
+    test_paired_insert(seed);
+    test_view_writes(seed);
+    cout << "all tests passed\n";
     return 0;
 }